@@ -17,38 +17,34 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 #include <assert.h>
 
 #include "skiplist_config.h"
+#if SKIPLIST_LATENCY
+#include <time.h>
+#endif
+#if SKIPLIST_SWMR
+#include <sched.h>
+#endif
 #include "skiplist.h"
+#include "skiplist_epoch.h"
 #include "skiplist_macros_internal.h"
-
-struct skiplist {
-    size_t count;
-    struct skiplist_node *head;
-    skiplist_cmp_cb *cmp;
-    skiplist_alloc_cb *alloc;
-    void *alloc_udata;
-};
-
-struct skiplist_node {
-    int h;                  /* node height */
-    void *k;                /* key */
-    void *v;                /* value */
-
-    /* Forward pointers.
-     * allocated with (h)*sizeof(N*) extra bytes. */
-    struct skiplist_node *next[];
-};
+#include "skiplist_internal.h"
 
 /* Sentinel. */
-static struct skiplist_node SENTINEL = { 0, NULL, NULL };
-#define IS_SENTINEL(n) (n == &SENTINEL)
+struct skiplist_node skiplist_sentinel = { .h = 0, .k = NULL, .v = NULL };
 
-static struct skiplist_node *
-node_alloc(struct skiplist *sl, uint8_t height, void *key, void *value);
 static void *def_alloc(void *p,
     size_t osize, size_t nsize, void *udata);
+#if SKIPLIST_SNAPSHOTS
+static void values_free(struct skiplist *sl, struct skiplist_value *e);
+#endif
+#if SKIPLIST_LATENCY
+static uint64_t latency_now(void);
+static void latency_record(struct skiplist *sl,
+    enum skiplist_op op, uint64_t nsec);
+#endif
 
 /* Create a new skiplist, returns NULL on error.
  * A comparison callback is required.
@@ -65,8 +61,27 @@ struct skiplist *skiplist_new(skiplist_cmp_cb *cmp,
         sl->cmp = cmp;
         sl->alloc = alloc;
         sl->alloc_udata = alloc_udata;
+        sl->epoch = NULL;
+        sl->frozen = false;
+        sl->gen = 0;
+#if SKIPLIST_SNAPSHOTS
+        sl->version = 0;
+        sl->history = false;
+        sl->snapshots = NULL;
+        sl->deferred = NULL;
+#endif
+#if SKIPLIST_SWMR
+        sl->seq = 0;
+#endif
+#if SKIPLIST_STATS
+        memset(&sl->stats, 0, sizeof(sl->stats));
+#endif
+#if SKIPLIST_LATENCY
+        memset(sl->latency, 0, sizeof(sl->latency));
+#endif
 
-        struct skiplist_node *head = node_alloc(sl, 1, &SENTINEL, &SENTINEL);
+        struct skiplist_node *head = skiplist_node_alloc(sl, 1,
+            &SENTINEL, &SENTINEL);
         if (head == NULL) {
             alloc(sl, sizeof(*sl), 0, alloc_udata);
             return NULL;
@@ -78,7 +93,7 @@ struct skiplist *skiplist_new(skiplist_cmp_cb *cmp,
 
 /* Allocate a node. The forward pointers are initialized to &SENTINEL.
  * Returns NULL on failure. */
-static struct skiplist_node *node_alloc(struct skiplist *sl,
+struct skiplist_node *skiplist_node_alloc(struct skiplist *sl,
         uint8_t height, void *key, void *value) {
     assert(height > 0);
     assert(height <= SKIPLIST_MAX_HEIGHT);
@@ -89,6 +104,14 @@ static struct skiplist_node *node_alloc(struct skiplist *sl,
     n->h = height;
     n->k = key;
     n->v = value;
+#if SKIPLIST_SNAPSHOTS
+    n->born = sl->version;
+    n->died = NODE_ALIVE;
+    n->vals = NULL;
+#endif
+#if SKIPLIST_ADAPTIVE
+    n->hits = 0;
+#endif
     LOG2("allocated %d-level node at %p\n", height, (void *)n);
     DO(height, n->next[i] = &SENTINEL);
     return n;
@@ -110,9 +133,63 @@ static void *def_alloc(void *p,
 
 
 /* Free a node. If necessary, everything it references should be
- * freed by the calling function. */
-static void node_free(struct skiplist *sl, struct skiplist_node *n) {
-    sl->alloc(n, sizeof(*n) + n->h * sizeof(n), 0, sl->alloc_udata);
+ * freed by the calling function. With an epoch domain attached, the
+ * node is retired instead, and freed once no reader can see it. */
+void skiplist_node_free(struct skiplist *sl, struct skiplist_node *n) {
+    size_t size = sizeof(*n) + n->h * sizeof(n);
+    sl->gen++;                  /* invalidate cursors */
+#if SKIPLIST_SNAPSHOTS
+    values_free(sl, n->vals);
+#endif
+    if (sl->epoch) {
+        if (skiplist_epoch_retire(sl->epoch, n, size,
+                sl->alloc, sl->alloc_udata)) {
+            return;
+        }
+        skiplist_epoch_synchronize(sl->epoch);
+    }
+    sl->alloc(n, size, 0, sl->alloc_udata);
+}
+
+/* Allocate a copy of N with HEIGHT levels, to take its place. It takes
+ * over N's history, and N's links on the levels both have; any other
+ * levels are left for the caller to link. */
+static struct skiplist_node *node_copy(struct skiplist *sl,
+        struct skiplist_node *n, int height) {
+    struct skiplist_node *nn = skiplist_node_alloc(sl, height, n->k, n->v);
+    if (nn == NULL) { return NULL; }
+#if SKIPLIST_SNAPSHOTS
+    nn->born = n->born;
+    nn->died = n->died;
+    nn->vals = n->vals;
+    n->vals = NULL;
+#endif
+#if SKIPLIST_ADAPTIVE
+    nn->hits = n->hits;
+#endif
+    int shared = height < n->h ? height : n->h;
+    DO(shared, nn->next[i] = n->next[i]);
+    return nn;
+}
+
+/* Replace N with a copy one level taller. PREVS[i] must be the node
+ * before N on each of its levels, and the last node before it on the
+ * level above. Returns the copy, or NULL on alloc failure. */
+static struct skiplist_node *raise_node(struct skiplist *sl,
+        struct skiplist_node **prevs, struct skiplist_node *n) {
+    assert(n->h < sl->head->h);
+    struct skiplist_node *nn = node_copy(sl, n, n->h + 1);
+    if (nn == NULL) { return NULL; }
+    nn->next[n->h] = prevs[n->h]->next[n->h];
+    DO(nn->h, PUBLISH(prevs[i]->next[i], nn));
+    LOG2("raised %p to %d levels\n", (void *)nn, nn->h);
+    skiplist_node_free(sl, n);
+    return nn;
+}
+
+void skiplist_set_epoch(struct skiplist *sl, struct skiplist_epoch *e) {
+    assert(sl);
+    sl->epoch = e;
 }
 
 /* Set the random seed used when randomly constructing skiplists. */
@@ -138,8 +215,10 @@ uint8_t SKIPLIST_GEN_HEIGHT(void) {
 #endif
 
 /* Get pointers to the HEIGHT nodes that precede the position
- * for key. Used by add/set/delete/delete_all. */
-static void init_prevs(struct skiplist *sl, void *key,
+ * for key. Used by add/set/delete/delete_all. Returns how the node
+ * after prevs[0] compares to KEY (> 0 if it's the sentinel), so
+ * callers needn't compare it again. */
+static int init_prevs(struct skiplist *sl, void *key,
         struct skiplist_node *head, int height,
         struct skiplist_node **prevs) {
     assert(sl);
@@ -147,6 +226,8 @@ static void init_prevs(struct skiplist *sl, void *key,
     struct skiplist_node *cur = NULL, *next = NULL;
     int lvl = height - 1, res = 0;
 
+    STAT_PATH_BEGIN();
+
     cur = head;
     LOG2("sentinel is %p\n", (void *)&SENTINEL);
     LOG2("head is %p\n", (void *)head);
@@ -155,8 +236,9 @@ static void init_prevs(struct skiplist *sl, void *key,
         assert(lvl < cur->h);
         assert(cur->h <= SKIPLIST_MAX_HEIGHT);
         next = cur->next[lvl];
+        STAT_VISIT(sl, lvl);
         LOG2("next is %p, level is %d\n", (void *)next, lvl);
-        res = IS_SENTINEL(next) ? 1 : sl->cmp(next->k, key);
+        res = IS_SENTINEL(next) ? 1 : CMP(sl, next->k, key);
         LOG2("res is %d\n", res);
         if (res < 0) {              /* < - advance. */
             cur = next;
@@ -165,80 +247,562 @@ static void init_prevs(struct skiplist *sl, void *key,
             lvl--;
         }
     } while (lvl >= 0);
+    STAT_PATH_END(sl);
+    return res;
 }
 
-static bool grow_head(struct skiplist *sl, struct skiplist_node *nn) {
+/* Replace the head with NEW_HEAD, which is as tall as NN. NN must
+ * already be linked on the old head's levels: a reader that takes one
+ * of the new levels down has to find it there. */
+static void grow_head(struct skiplist *sl, struct skiplist_node *new_head,
+        struct skiplist_node *nn) {
     struct skiplist_node *old_head = sl->head;
-    LOG2("growing head from %d to %d\n", old_head->h, nn->h);
-    struct skiplist_node *new_head = node_alloc(sl, nn->h,
-        &SENTINEL, &SENTINEL);
-    if (new_head == NULL) {
-        fprintf(stderr, "alloc fail\n");
-        return false;
-    }
+    LOG2("growing head from %d to %d\n", old_head->h, new_head->h);
     DO(old_head->h, new_head->next[i] = old_head->next[i]);
     for (int i = old_head->h; i < new_head->h; i++) {
-        /* The actual next[i] will be set later. */
         new_head->next[i] = nn;
     }
-    sl->head = new_head;
-    node_free(sl, old_head);
-    return true;
+    PUBLISH(sl->head, new_head);
+    skiplist_node_free(sl, old_head);
 }
 
-static bool add_or_set(struct skiplist *sl, int try_replace,
-        void *key, void *value, void **old) {
-    assert(sl);
-    struct skiplist_node *head = sl->head;
-    assert(head);
-    int cur_height = head->h;
-    struct skiplist_node *prevs[cur_height];
-
-    init_prevs(sl, key, head, cur_height, prevs);
+/* Move PREVS, left by a search for an earlier key, forward to KEY.
+ * This is a finger search: climb while the next node on the level above
+ * is still before KEY, then descend as usual. The cost depends on how
+ * far it moves rather than on the size of the list. */
+static void advance_prevs(struct skiplist *sl, void *key, int height,
+        struct skiplist_node **prevs) {
+    int top = 0;
+    STAT_PATH_BEGIN();
+    while (top + 1 < height) {
+        struct skiplist_node *next = prevs[top + 1]->next[top + 1];
+        STAT_VISIT(sl, top + 1);
+        if (IS_SENTINEL(next) || CMP(sl, next->k, key) >= 0) { break; }
+        top++;
+    }
 
-    if (try_replace) {
-        struct skiplist_node *next = prevs[0]->next[0];
-        if (!IS_SENTINEL(next)) {
-            int res = sl->cmp(next->k, key);
-            if (res == 0) { /* key exists, replace value */
-                if (old) { *old = next->v; }
-                next->v = value;
-                return true;
-            } else {        /* not found */
-                if (old) { *old = NULL; }
-            }
+    /* Until the search moves past a level's old prev, that is where
+     * it continues from; once it has, it is past all the lower ones. */
+    struct skiplist_node *cur = prevs[top];
+    bool moved = false;
+    for (int lvl = top; lvl >= 0; lvl--) {
+        if (!moved) { cur = prevs[lvl]; }
+        for (;;) {
+            struct skiplist_node *next = cur->next[lvl];
+            STAT_VISIT(sl, lvl);
+            if (IS_SENTINEL(next) || CMP(sl, next->k, key) >= 0) { break; }
+            cur = next;
+            moved = true;
         }
+        prevs[lvl] = cur;
     }
+    STAT_PATH_END(sl);
+}
 
+/* Allocate a node for KEY and VALUE and link it in after PREVS, which
+ * has SKIPLIST_MAX_HEIGHT slots, one filled in per level of the head.
+ * Afterward PREVS is the new node at each of its levels (and matches
+ * the head's height, if it grew), ready for inserting a later key.
+ * Returns false on alloc failure. */
+static bool insert_after(struct skiplist *sl, struct skiplist_node **prevs,
+        void *key, void *value) {
+    struct skiplist_node *head = sl->head;
+    int cur_height = head->h;
     uint8_t new_height = SKIPLIST_GEN_HEIGHT();
-    struct skiplist_node *nn = node_alloc(sl, new_height, key, value);
+    struct skiplist_node *nn = skiplist_node_alloc(sl, new_height,
+        key, value);
     if (nn == NULL) { return false; }
+#if SKIPLIST_SNAPSHOTS
+    nn->born = ++sl->version;
+#endif
 
+    struct skiplist_node *new_head = NULL;
     if (new_height > cur_height) {
-        if (!grow_head(sl, nn)) { return false; }
-        DO(cur_height, if (prevs[i] == /* old */ head)
-                           prevs[i] = sl->head);
-        head = sl->head;
+        new_head = skiplist_node_alloc(sl, new_height, &SENTINEL, &SENTINEL);
+        if (new_head == NULL) {
+            sl->alloc(nn, sizeof(*nn) + nn->h * sizeof(nn),
+                0, sl->alloc_udata);
+            return false;
+        }
     }
 
+    SEQ_WRITE_BEGIN(sl);
     /* Insert n between prev[lvl] and prevs->next[lvl] */
     int minH = nn->h < cur_height ? nn->h : cur_height;
     for (int i = 0; i < minH; i++) {
         assert(i < prevs[i]->h);
         nn->next[i] = prevs[i]->next[i];
         assert(prevs[i]->h <= SKIPLIST_MAX_HEIGHT);
-        prevs[i]->next[i] = nn;
+        PUBLISH(prevs[i]->next[i], nn);
     }
+    if (new_head) { grow_head(sl, new_head, nn); }
+    DO(nn->h, prevs[i] = nn);
     sl->count++;
+    SEQ_WRITE_END(sl);
     return true;
 }
 
+#if SKIPLIST_SNAPSHOTS
+/* Every write is stamped with the next version number: nodes record
+ * the versions when they were added and deleted, and values the
+ * version when they were set. A snapshot is the version current when
+ * it was taken, and sees exactly what was there then.
+ *
+ * While any snapshot is open, history back to the oldest one is kept:
+ * deleting a node only marks it dead (live operations skip it), and
+ * skiplist_set pushes the new value onto the node's version chain.
+ * Releasing a snapshot sweeps out whatever no remaining one needs. */
+struct skiplist_snapshot {
+    struct skiplist *sl;
+    uint64_t version;
+    struct skiplist_snapshot *newer;
+    struct skiplist_snapshot *older;
+};
+
+static bool visible_at(struct skiplist_node *n, uint64_t version) {
+    return n->born <= version && version < ATOMIC_LOAD(&n->died);
+}
+
+/* N's value as of VERSION. The value is read before the version chain,
+ * since the writer publishes them in the other order. */
+static void *value_at(struct skiplist_node *n, uint64_t version) {
+    void *v = ATOMIC_LOAD(&n->v);
+    struct skiplist_value *e = ATOMIC_LOAD(&n->vals);
+    while (e != NULL && e->from > version) { e = ATOMIC_LOAD(&e->older); }
+    return e ? e->v : v;
+}
+
+/* The version of the oldest open snapshot. There must be one. */
+static uint64_t horizon(struct skiplist *sl) {
+    struct skiplist_snapshot *s = sl->snapshots;
+    assert(s);
+    while (s->older) { s = s->older; }
+    return s->version;
+}
+
+static void value_free(struct skiplist *sl, struct skiplist_value *e) {
+    if (sl->epoch) {
+        if (skiplist_epoch_retire(sl->epoch, e, sizeof(*e),
+                sl->alloc, sl->alloc_udata)) {
+            return;
+        }
+        skiplist_epoch_synchronize(sl->epoch);
+    }
+    sl->alloc(e, sizeof(*e), 0, sl->alloc_udata);
+}
+
+static void values_free(struct skiplist *sl, struct skiplist_value *e) {
+    while (e != NULL) {
+        struct skiplist_value *older = e->older;
+        value_free(sl, e);
+        e = older;
+    }
+}
+
+/* Drop the part of N's version chain that no reader at or after
+ * version HORIZON can need: everything past the first value that was
+ * set by then. */
+static void trim_values(struct skiplist *sl, struct skiplist_node *n,
+        uint64_t horizon) {
+    struct skiplist_value *e = n->vals;
+    while (e != NULL && e->from > horizon) { e = e->older; }
+    if (e != NULL && e->older != NULL) {
+        struct skiplist_value *doomed = e->older;
+        PUBLISH(e->older, NULL);
+        values_free(sl, doomed);
+    }
+}
+
+static struct skiplist_value *value_new(struct skiplist *sl, void *v,
+        uint64_t from, struct skiplist_value *older) {
+    struct skiplist_value *e = sl->alloc(NULL, 0,
+        sizeof(*e), sl->alloc_udata);
+    if (e) {
+        e->v = v;
+        e->from = from;
+        e->older = older;
+    }
+    return e;
+}
+
+/* A free callback held back until no open snapshot can see the pair
+ * (or old value) it is called on: snapshots taken before version UNTIL
+ * still can. */
+struct skiplist_deferred {
+    void *k;
+    void *v;
+    skiplist_free_cb *cb;
+    void *udata;
+    uint64_t until;
+    struct skiplist_deferred *next;
+};
+
+static void deferred_free(struct skiplist *sl, struct skiplist_deferred *d) {
+    while (d != NULL) {
+        struct skiplist_deferred *next = d->next;
+        sl->alloc(d, sizeof(*d), 0, sl->alloc_udata);
+        d = next;
+    }
+}
+
+/* Allocate COUNT (> 0) entries for defer_cb, chained through next.
+ * Returns NULL on failure. */
+static struct skiplist_deferred *deferred_alloc(struct skiplist *sl,
+        size_t count) {
+    struct skiplist_deferred *d = NULL;
+    for (size_t i = 0; i < count; i++) {
+        struct skiplist_deferred *e = sl->alloc(NULL, 0,
+            sizeof(*e), sl->alloc_udata);
+        if (e == NULL) {
+            deferred_free(sl, d);
+            return NULL;
+        }
+        e->next = d;
+        d = e;
+    }
+    return d;
+}
+
+/* Queue CB to be called on K and V once every snapshot taken before
+ * version UNTIL is released, using the first entry from *SPARE. */
+static void defer_cb(struct skiplist *sl, struct skiplist_deferred **spare,
+        void *k, void *v, skiplist_free_cb *cb, void *udata,
+        uint64_t until) {
+    struct skiplist_deferred *d = *spare;
+    assert(d);
+    *spare = d->next;
+    d->k = k;
+    d->v = v;
+    d->cb = cb;
+    d->udata = udata;
+    d->until = until;
+    d->next = sl->deferred;
+    sl->deferred = d;
+    sl->history = true;
+}
+
+/* Call the deferred callbacks that no snapshot at or after version
+ * OLDEST still needs held back, or all of them if none is OPEN. */
+static void run_deferred(struct skiplist *sl, bool open, uint64_t oldest) {
+    struct skiplist_deferred **p = &sl->deferred;
+    while (*p != NULL) {
+        struct skiplist_deferred *d = *p;
+        if (!open || d->until <= oldest) {
+            *p = d->next;
+            d->cb(d->k, d->v, d->udata);
+            sl->alloc(d, sizeof(*d), 0, sl->alloc_udata);
+        } else {
+            p = &d->next;
+        }
+    }
+}
+
+/* Mark live node N deleted. Call inside a write. */
+static void retire_node(struct skiplist *sl, struct skiplist_node *n) {
+    sl->count--;
+    sl->history = true;
+    PUBLISH(n->died, ++sl->version);
+}
+
+/* The first live node with KEY, starting from N, or NULL. */
+static struct skiplist_node *live_eq(struct skiplist *sl,
+        struct skiplist_node *n, void *key) {
+    while (!IS_SENTINEL(n) && CMP(sl, n->k, key) == 0) {
+        if (IS_LIVE(n)) { return n; }
+        n = n->next[0];
+    }
+    return NULL;
+}
+
+static struct skiplist_node *first_live(struct skiplist *sl) {
+    struct skiplist_node *n = sl->head->next[0];
+    while (!IS_SENTINEL(n) && !IS_LIVE(n)) { n = n->next[0]; }
+    return IS_SENTINEL(n) ? NULL : n;
+}
+
+/* The last live node, or NULL. Starting from the last node, step back
+ * one run of equal keys at a time, by searching for the run's key,
+ * until one has a live node in it. */
+static struct skiplist_node *last_live(struct skiplist *sl) {
+    struct skiplist_node *head = sl->head, *cur = head;
+    for (int lvl = head->h - 1; lvl >= 0; lvl--) {
+        while (!IS_SENTINEL(cur->next[lvl])) { cur = cur->next[lvl]; }
+    }
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    while (cur != head && !IS_LIVE(cur)) {
+        init_prevs(sl, cur->k, head, head->h, prevs);
+        struct skiplist_node *found = prevs[0];
+        for (struct skiplist_node *n = prevs[0]->next[0]; n != cur;
+             n = n->next[0]) {
+            if (IS_LIVE(n)) { found = n; }
+        }
+        cur = found;
+    }
+    return cur == head ? NULL : cur;
+}
+
+/* skiplist_set while snapshots are open: push the new value onto the
+ * node's version chain, rather than overwriting the old one. */
+static bool set_snapshot(struct skiplist *sl, struct skiplist_node **prevs,
+        void *key, void *value, void **old) {
+    struct skiplist_node *n = live_eq(sl, prevs[0]->next[0], key);
+    if (old) { *old = n ? n->v : NULL; }
+    if (n == NULL) { return insert_after(sl, prevs, key, value); }
+
+    struct skiplist_value *older = n->vals;
+    if (older == NULL) {
+        older = value_new(sl, n->v, n->born, NULL);
+        if (older == NULL) { return false; }
+    }
+    struct skiplist_value *e = value_new(sl, value,
+        sl->version + 1, older);
+    if (e == NULL) {
+        if (older != n->vals) {
+            sl->alloc(older, sizeof(*older), 0, sl->alloc_udata);
+        }
+        return false;
+    }
+
+    SEQ_WRITE_BEGIN(sl);
+    sl->version++;
+    sl->history = true;
+    PUBLISH(n->vals, e);
+    PUBLISH(n->v, value);
+    trim_values(sl, n, horizon(sl));
+    SEQ_WRITE_END(sl);
+    return true;
+}
+
+/* delete_one_or_all while snapshots are open. */
+static bool delete_snapshot(struct skiplist *sl, struct skiplist_node *n,
+        void *key, skiplist_free_cb *cb, void *udata, void **old) {
+    n = live_eq(sl, n, key);
+    if (n == NULL) { return false; }
+
+    SEQ_WRITE_BEGIN(sl);
+    if (cb == NULL) {
+        if (old) { *old = n->v; }
+        retire_node(sl, n);
+        SEQ_WRITE_END(sl);
+        return true;
+    }
+    /* Snapshots can still see the pairs, so CB has to wait. */
+    size_t live = 0;
+    for (struct skiplist_node *m = n;
+         !IS_SENTINEL(m) && CMP(sl, m->k, key) == 0; m = m->next[0]) {
+        if (IS_LIVE(m)) { live++; }
+    }
+    struct skiplist_deferred *spare = deferred_alloc(sl, live);
+    if (spare == NULL) { return false; }
+    SEQ_WRITE_BEGIN(sl);
+    while (!IS_SENTINEL(n) && CMP(sl, n->k, key) == 0) {
+        if (IS_LIVE(n)) {
+            retire_node(sl, n);
+            defer_cb(sl, &spare, n->k, n->v, cb, udata, n->died);
+        }
+        n = n->next[0];
+    }
+    SEQ_WRITE_END(sl);
+    return false;
+}
+
+/* pop_first/pop_last while snapshots are open. */
+static bool pop_snapshot(struct skiplist *sl, struct skiplist_node *n,
+        void **key, void **value) {
+    if (n == NULL) { return false; }
+    if (key) { *key = n->k; }
+    if (value) { *value = n->v; }
+    SEQ_WRITE_BEGIN(sl);
+    retire_node(sl, n);
+    SEQ_WRITE_END(sl);
+    return true;
+}
+
+/* One pass over the whole list, freeing the dead nodes and old values
+ * that no open snapshot can see, and calling the deferred callbacks
+ * that are due. If CLEAR, every live node is deleted first, as by
+ * skiplist_clear, but with CB deferred. Returns how many live nodes
+ * that was, or 0 on alloc failure. */
+static size_t sweep(struct skiplist *sl, bool clear,
+        skiplist_free_cb *cb, void *udata) {
+    struct skiplist_node *head = sl->head;
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    DO(head->h, prevs[i] = head);
+    bool open = sl->snapshots != NULL;
+    uint64_t oldest = open ? horizon(sl) : 0;
+    struct skiplist_deferred *spare = NULL;
+    if (clear && cb && sl->count > 0) {
+        spare = deferred_alloc(sl, sl->count);
+        if (spare == NULL) { return 0; }
+    }
+    uint64_t now = clear ? ++sl->version : sl->version;
+    bool history = false;
+    size_t ct = 0;
+
+    SEQ_WRITE_BEGIN(sl);
+    struct skiplist_node *n = head->next[0];
+    while (!IS_SENTINEL(n)) {
+        struct skiplist_node *next = n->next[0];
+        if (IS_LIVE(n) && clear) {
+            if (cb) { defer_cb(sl, &spare, n->k, n->v, cb, udata, now); }
+            sl->count--;
+            ct++;
+            PUBLISH(n->died, now);
+        }
+
+        if (!IS_LIVE(n) && (!open || n->died <= oldest)) {
+            DO(n->h, PUBLISH(prevs[i]->next[i], n->next[i]));
+            skiplist_node_free(sl, n);
+        } else {
+            if (!open && n->vals != NULL) {
+                struct skiplist_value *doomed = n->vals;
+                PUBLISH(n->vals, NULL);
+                values_free(sl, doomed);
+            } else if (open) {
+                trim_values(sl, n, oldest);
+            }
+            if (!IS_LIVE(n) || n->vals != NULL) { history = true; }
+            DO(n->h, prevs[i] = n);
+        }
+        n = next;
+    }
+    SEQ_WRITE_END(sl);
+    run_deferred(sl, open, oldest);
+    sl->history = history || sl->deferred != NULL;
+    return ct;
+}
+#endif
+
+static bool add_or_set(struct skiplist *sl, int try_replace,
+        void *key, void *value, void **old) {
+    assert(sl);
+    struct skiplist_node *head = sl->head;
+    assert(head);
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+
+    int res = init_prevs(sl, key, head, head->h, prevs);
+
+#if SKIPLIST_SNAPSHOTS
+    if (try_replace && sl->snapshots) {
+        return set_snapshot(sl, prevs, key, value, old);
+    }
+#endif
+    if (try_replace) {
+        if (res == 0) {     /* key exists, replace value */
+            struct skiplist_node *next = prevs[0]->next[0];
+            if (old) { *old = next->v; }
+            SEQ_WRITE_BEGIN(sl);
+            PUBLISH(next->v, value);
+            SEQ_WRITE_END(sl);
+            return true;
+        } else {            /* not found */
+            if (old) { *old = NULL; }
+        }
+    }
+
+    return insert_after(sl, prevs, key, value);
+}
+
 bool skiplist_add(struct skiplist *sl, void *key, void *value) {
-    return add_or_set(sl, 0, key, value, NULL);
+    if (sl->frozen) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_ADD);
+    LAT_BEGIN();
+    bool res = add_or_set(sl, 0, key, value, NULL);
+    LAT_END(sl, SKIPLIST_OP_ADD);
+    return res;
 }
 
 bool skiplist_set(struct skiplist *sl, void *key, void *value, void **old) {
-    return add_or_set(sl, 1, key, value, old);
+    if (sl->frozen) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_SET);
+    LAT_BEGIN();
+    bool res = add_or_set(sl, 1, key, value, old);
+    LAT_END(sl, SKIPLIST_OP_SET);
+    return res;
+}
+
+bool skiplist_upsert(struct skiplist *sl, void *key,
+        skiplist_upsert_cb *cb, void *udata) {
+    assert(sl);
+    assert(cb);
+    if (sl->frozen) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_SET);
+    LAT_BEGIN();
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    int res = init_prevs(sl, key, sl->head, sl->head->h, prevs);
+    struct skiplist_node *n = res == 0 ? prevs[0]->next[0] : NULL;
+    bool ok = true;
+
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        n = live_eq(sl, prevs[0]->next[0], key);
+        if (n == NULL) {
+            ok = insert_after(sl, prevs, key, cb(key, NULL, udata));
+        } else {
+            void *v = n->v;
+            (void)cb(key, &v, udata);
+            if (v != n->v) { ok = set_snapshot(sl, prevs, key, v, NULL); }
+        }
+        LAT_END(sl, SKIPLIST_OP_SET);
+        return ok;
+    }
+#endif
+    if (n == NULL) {
+        ok = insert_after(sl, prevs, key, cb(key, NULL, udata));
+    } else {
+        void *v = n->v;
+        (void)cb(key, &v, udata);
+        if (v != n->v) {
+            SEQ_WRITE_BEGIN(sl);
+            PUBLISH(n->v, v);
+            SEQ_WRITE_END(sl);
+        }
+    }
+    LAT_END(sl, SKIPLIST_OP_SET);
+    return ok;
+}
+
+void **skiplist_emplace(struct skiplist *sl, void *key, bool *inserted) {
+    assert(sl);
+    if (sl->frozen) { return NULL; }
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) { return NULL; }
+#endif
+    STAT_OP(sl, SKIPLIST_OP_SET);
+    LAT_BEGIN();
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    int res = init_prevs(sl, key, sl->head, sl->head->h, prevs);
+    struct skiplist_node *n = NULL;
+    if (res == 0) {
+        n = prevs[0]->next[0];
+    } else if (insert_after(sl, prevs, key, NULL)) {
+        n = prevs[0];           /* the new node */
+    }
+    if (inserted) { *inserted = n != NULL && res != 0; }
+    LAT_END(sl, SKIPLIST_OP_SET);
+    return n ? &n->v : NULL;
+}
+
+size_t skiplist_add_sorted(struct skiplist *sl, size_t count,
+        void **keys, void **values) {
+    assert(sl);
+    assert(keys);
+    assert(values);
+    if (sl->frozen) { return 0; }
+    STAT_OP(sl, SKIPLIST_OP_ADD);
+    LAT_BEGIN();
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    size_t i = 0;
+    if (count > 0) {
+        init_prevs(sl, keys[0], sl->head, sl->head->h, prevs);
+    }
+    for (i = 0; i < count; i++) {
+        assert(i == 0 || CMP(sl, keys[i - 1], keys[i]) <= 0);
+        if (i > 0) { advance_prevs(sl, keys[i], sl->head->h, prevs); }
+        if (!insert_after(sl, prevs, keys[i], values[i])) { break; }
+    }
+    LAT_END(sl, SKIPLIST_OP_ADD);
+    return i;
 }
 
 static bool delete_one_or_all(struct skiplist *sl, void *key,
@@ -249,21 +813,29 @@ static bool delete_one_or_all(struct skiplist *sl, void *key,
     struct skiplist_node *prevs[cur_height];
     init_prevs(sl, key, head, cur_height, prevs);
 
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        return delete_snapshot(sl, prevs[0]->next[0], key, cb, udata, old);
+    }
+#endif
     struct skiplist_node *doomed = prevs[0]->next[0];
-    if (IS_SENTINEL(doomed) || 0 != sl->cmp(doomed->k, key)) {
+    if (IS_SENTINEL(doomed) || 0 != CMP(sl, doomed->k, key)) {
         return false;           /* not found */
     }
 
+    SEQ_WRITE_BEGIN(sl);
     if (cb == NULL) {           /* delete one w/ key */
-        DO(doomed->h, prevs[i]->next[i]=doomed->next[i]);
+        DO(doomed->h, PUBLISH(prevs[i]->next[i], doomed->next[i]));
         if (old) { *old = doomed->v; }
-        node_free(sl, doomed);
+        skiplist_node_free(sl, doomed);
         sl->count--;
+        SEQ_WRITE_END(sl);
         return true;
     } else {                    /* delete all w/ key */
         int res = 0;
         int tdh = 0;            /* tallest doomed height */
         struct skiplist_node *nexts[cur_height];
+        struct skiplist_node *first = doomed;
 
         DO(cur_height, nexts[i] = &SENTINEL);
 
@@ -293,30 +865,345 @@ static bool delete_one_or_all(struct skiplist *sl, void *key,
             if (SKIPLIST_LOG_LEVEL > 1)
                 DO(tdh, fprintf(stderr, "nexts[%d] = %p\n", i, (void *)nexts[i]));
 
-            cb(key, doomed->v, udata);
-            sl->count--;
-            node_free(sl, doomed);
             res = IS_SENTINEL(next)
-              ? -1 : sl->cmp(next->k, key);
+              ? -1 : CMP(sl, next->k, key);
             doomed = next;
         } while (res == 0);
 
         LOG2("tdh is %d\n", tdh);
         DO(tdh,
             LOG2("setting prevs[%d]->next[%d] to %p\n", i, i, (void *)nexts[i]);
-            prevs[i]->next[i] = nexts[i]);
+            PUBLISH(prevs[i]->next[i], nexts[i]));
+
+        /* Only free once the run is unlinked, so no reader that
+         * starts after a node is retired can still reach it. */
+        struct skiplist_node *n = first;
+        while (n != doomed) {
+            struct skiplist_node *next = n->next[0];
+            cb(key, n->v, udata);
+            sl->count--;
+            skiplist_node_free(sl, n);
+            n = next;
+        }
+        SEQ_WRITE_END(sl);
         return false;
     }
 }
 
 bool skiplist_delete(struct skiplist *sl, void *key, void **value) {
-    return delete_one_or_all(sl, key, NULL, NULL, value);
+    if (sl->frozen) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_DELETE);
+    LAT_BEGIN();
+    bool res = delete_one_or_all(sl, key, NULL, NULL, value);
+    LAT_END(sl, SKIPLIST_OP_DELETE);
+    return res;
 }
 
 void skiplist_delete_all(struct skiplist *sl, void *key,
         skiplist_free_cb *cb, void *udata) {
     assert(cb);
+    if (sl->frozen) { return; }
+    STAT_OP(sl, SKIPLIST_OP_DELETE_ALL);
+    LAT_BEGIN();
     (void) delete_one_or_all(sl, key, cb, udata, NULL);
+    LAT_END(sl, SKIPLIST_OP_DELETE_ALL);
+}
+
+/* Write batches. Operations are collected, then stably sorted by key,
+ * so operations on the same key keep their order, and applied in one
+ * sweep: the search for each key continues from the previous one (see
+ * advance_prevs), and every node is allocated before the skiplist is
+ * touched, so an alloc failure changes nothing. */
+enum batch_kind { BATCH_ADD, BATCH_SET, BATCH_DELETE };
+
+struct batch_op {
+    void *k;
+    void *v;
+    enum batch_kind kind;
+    struct skiplist_node *n;    /* preallocated for adds and sets */
+};
+
+struct skiplist_write_batch {
+    struct skiplist *sl;
+    size_t count;
+    size_t cap;
+    struct batch_op *ops;
+};
+
+struct skiplist_write_batch *skiplist_write_batch_new(struct skiplist *sl) {
+    assert(sl);
+    struct skiplist_write_batch *b = sl->alloc(NULL, 0, sizeof(*b),
+        sl->alloc_udata);
+    if (b) {
+        b->sl = sl;
+        b->count = 0;
+        b->cap = 0;
+        b->ops = NULL;
+    }
+    return b;
+}
+
+static bool batch_push(struct skiplist_write_batch *b,
+        enum batch_kind kind, void *key, void *value) {
+    assert(b);
+    struct skiplist *sl = b->sl;
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? 2 * b->cap : 16;
+        struct batch_op *ops = sl->alloc(NULL, 0, cap * sizeof(*ops),
+            sl->alloc_udata);
+        if (ops == NULL) { return false; }
+        if (b->ops) {
+            memcpy(ops, b->ops, b->count * sizeof(*ops));
+            sl->alloc(b->ops, b->cap * sizeof(*ops), 0, sl->alloc_udata);
+        }
+        b->ops = ops;
+        b->cap = cap;
+    }
+    struct batch_op *op = &b->ops[b->count++];
+    op->k = key;
+    op->v = value;
+    op->kind = kind;
+    op->n = NULL;
+    return true;
+}
+
+bool skiplist_write_batch_add(struct skiplist_write_batch *b,
+        void *key, void *value) {
+    return batch_push(b, BATCH_ADD, key, value);
+}
+
+bool skiplist_write_batch_set(struct skiplist_write_batch *b,
+        void *key, void *value) {
+    return batch_push(b, BATCH_SET, key, value);
+}
+
+bool skiplist_write_batch_delete(struct skiplist_write_batch *b,
+        void *key) {
+    return batch_push(b, BATCH_DELETE, key, NULL);
+}
+
+size_t skiplist_write_batch_count(struct skiplist_write_batch *b) {
+    assert(b);
+    return b->count;
+}
+
+/* Stable bottom-up merge sort of the batch, using TMP. */
+static void batch_sort(struct skiplist *sl, struct batch_op *ops,
+        struct batch_op *tmp, size_t count) {
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t lo = 0; lo < count; lo += 2 * width) {
+            size_t mid = lo + width < count ? lo + width : count;
+            size_t hi = mid + width < count ? mid + width : count;
+            size_t a = lo, b = mid, o = lo;
+            while (a < mid && b < hi) {
+                if (CMP(sl, ops[b].k, ops[a].k) < 0) {
+                    tmp[o++] = ops[b++];
+                } else {
+                    tmp[o++] = ops[a++];
+                }
+            }
+            while (a < mid) { tmp[o++] = ops[a++]; }
+            while (b < hi) { tmp[o++] = ops[b++]; }
+        }
+        memcpy(ops, tmp, count * sizeof(*ops));
+    }
+}
+
+static void batch_free_nodes(struct skiplist *sl,
+        struct skiplist_write_batch *b) {
+    for (size_t i = 0; i < b->count; i++) {
+        struct skiplist_node *n = b->ops[i].n;
+        if (n) {
+            sl->alloc(n, sizeof(*n) + n->h * sizeof(n), 0, sl->alloc_udata);
+            b->ops[i].n = NULL;
+        }
+    }
+}
+
+/* Allocate every node the batch could need, and grow the head to fit
+ * the tallest, so nothing can fail once the sweep starts. */
+static bool batch_prealloc(struct skiplist *sl,
+        struct skiplist_write_batch *b) {
+    uint8_t max_h = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        struct batch_op *op = &b->ops[i];
+        if (op->kind == BATCH_DELETE) { continue; }
+        op->n = skiplist_node_alloc(sl, SKIPLIST_GEN_HEIGHT(), op->k, op->v);
+        if (op->n == NULL) { goto fail; }
+        if (op->n->h > max_h) { max_h = op->n->h; }
+    }
+
+    struct skiplist_node *old_head = sl->head;
+    if (max_h > old_head->h) {
+        struct skiplist_node *head = skiplist_node_alloc(sl, max_h,
+            &SENTINEL, &SENTINEL);
+        if (head == NULL) { goto fail; }
+        DO(old_head->h, head->next[i] = old_head->next[i]);
+        SEQ_WRITE_BEGIN(sl);
+        PUBLISH(sl->head, head);
+        SEQ_WRITE_END(sl);
+        skiplist_node_free(sl, old_head);
+    }
+    return true;
+
+fail:
+    batch_free_nodes(sl, b);
+    return false;
+}
+
+/* Link N in right after PREVS, which are left as they were. */
+static void batch_link(struct skiplist *sl, struct skiplist_node **prevs,
+        struct skiplist_node *n) {
+#if SKIPLIST_SNAPSHOTS
+    n->born = ++sl->version;
+#endif
+    for (int i = 0; i < n->h; i++) {
+        n->next[i] = prevs[i]->next[i];
+        PUBLISH(prevs[i]->next[i], n);
+    }
+    sl->count++;
+}
+
+/* The sweep: for each run of operations on one key, PREVS are the last
+ * nodes before the key, so the first node with the key (if any) is
+ * right after PREVS[0], and it is the next node on each of its levels. */
+static void batch_sweep(struct skiplist *sl, struct skiplist_write_batch *b,
+        skiplist_free_cb *cb, void *udata) {
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    int height = sl->head->h;
+    SEQ_WRITE_BEGIN(sl);
+    for (size_t i = 0; i < b->count; i++) {
+        struct batch_op *op = &b->ops[i];
+        bool same = i > 0 && CMP(sl, b->ops[i - 1].k, op->k) == 0;
+        if (i == 0) {
+            init_prevs(sl, op->k, sl->head, height, prevs);
+        } else if (!same) {
+            advance_prevs(sl, op->k, height, prevs);
+        }
+        struct skiplist_node *n = prevs[0]->next[0];
+        bool found = !IS_SENTINEL(n) && CMP(sl, n->k, op->k) == 0;
+
+        switch (op->kind) {
+        case BATCH_ADD:
+            batch_link(sl, prevs, op->n);
+            break;
+        case BATCH_SET:
+            if (found) {
+                if (cb) { cb(op->k, n->v, udata); }
+                PUBLISH(n->v, op->v);
+                sl->alloc(op->n, sizeof(*n) + op->n->h * sizeof(n),
+                    0, sl->alloc_udata);
+            } else {
+                batch_link(sl, prevs, op->n);
+            }
+            break;
+        case BATCH_DELETE:
+            if (found) {
+                for (int lvl = 0; lvl < n->h; lvl++) {
+                    PUBLISH(prevs[lvl]->next[lvl], n->next[lvl]);
+                }
+                if (cb) { cb(n->k, n->v, udata); }
+                skiplist_node_free(sl, n);
+                sl->count--;
+            }
+            break;
+        }
+        op->n = NULL;
+    }
+    SEQ_WRITE_END(sl);
+}
+
+#if SKIPLIST_SNAPSHOTS
+struct batch_set_env {
+    void *value;
+    void *old;
+    bool replaced;
+};
+
+static void *batch_set_cb(void *key, void **value, void *udata) {
+    struct batch_set_env *env = (struct batch_set_env *) udata;
+    (void)key;
+    if (value == NULL) { return env->value; }
+    env->old = *value;
+    env->replaced = true;
+    *value = env->value;
+    return NULL;
+}
+
+/* With snapshots open, each operation keeps history as usual, and CB
+ * is deferred until no snapshot can see what it is called on. */
+static bool batch_apply_each(struct skiplist *sl,
+        struct skiplist_write_batch *b, skiplist_free_cb *cb, void *udata) {
+    for (size_t i = 0; i < b->count; i++) {
+        struct batch_op *op = &b->ops[i];
+        struct batch_set_env env = { op->v, NULL, false };
+        struct skiplist_deferred *spare = NULL;
+        void *old = NULL;
+        bool ok = true;
+        if (cb && op->kind != BATCH_ADD) {
+            spare = deferred_alloc(sl, 1);
+            if (spare == NULL) { return false; }
+        }
+        switch (op->kind) {
+        case BATCH_ADD:
+            ok = skiplist_add(sl, op->k, op->v);
+            break;
+        case BATCH_SET:
+            ok = skiplist_upsert(sl, op->k, batch_set_cb, &env);
+            if (ok && env.replaced && spare) {
+                defer_cb(sl, &spare, op->k, env.old, cb, udata,
+                    sl->version);
+            }
+            break;
+        case BATCH_DELETE:
+            if (skiplist_delete(sl, op->k, &old) && spare) {
+                defer_cb(sl, &spare, op->k, old, cb, udata, sl->version);
+            }
+            break;
+        }
+        deferred_free(sl, spare);
+        if (!ok) { return false; }
+    }
+    return true;
+}
+#endif
+
+bool skiplist_write_batch_apply(struct skiplist_write_batch *b,
+        skiplist_free_cb *cb, void *udata) {
+    assert(b);
+    struct skiplist *sl = b->sl;
+    if (sl->frozen) { return false; }
+    if (b->count == 0) { return true; }
+
+    struct batch_op *tmp = sl->alloc(NULL, 0, b->count * sizeof(*tmp),
+        sl->alloc_udata);
+    if (tmp == NULL) { return false; }
+    batch_sort(sl, b->ops, tmp, b->count);
+    sl->alloc(tmp, b->count * sizeof(*tmp), 0, sl->alloc_udata);
+
+    bool res = true;
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        res = batch_apply_each(sl, b, cb, udata);
+        if (res) { b->count = 0; }
+        return res;
+    }
+#endif
+    res = batch_prealloc(sl, b);
+    if (res) {
+        batch_sweep(sl, b, cb, udata);
+        b->count = 0;
+    }
+    return res;
+}
+
+void skiplist_write_batch_free(struct skiplist_write_batch *b) {
+    assert(b);
+    struct skiplist *sl = b->sl;
+    if (b->ops) {
+        sl->alloc(b->ops, b->cap * sizeof(*b->ops), 0, sl->alloc_udata);
+    }
+    sl->alloc(b, sizeof(*b), 0, sl->alloc_udata);
 }
 
 static struct skiplist_node *get_first_eq_node(struct skiplist *sl, void *key) {
@@ -324,19 +1211,26 @@ static struct skiplist_node *get_first_eq_node(struct skiplist *sl, void *key) {
     struct skiplist_node *head = sl->head;
     int height = head->h;
     int lvl = height - 1;
-    struct skiplist_node *cur = head, *next = NULL;
+    struct skiplist_node *cur = head, *next = NULL, *eq = NULL;
+    STAT_PATH_BEGIN();
 
     do {
         assert(cur->h > lvl);
         next = cur->next[lvl];
+        STAT_VISIT(sl, lvl);
 
         assert(next->h <= SKIPLIST_MAX_HEIGHT);
-        int res = IS_SENTINEL(next) ? 1 : sl->cmp(next->k, key);
+        /* Once a match is seen on a level above, it is usually the next
+         * node on the levels below too, and needn't be compared again. */
+        int res = next == eq ? 0
+            : IS_SENTINEL(next) ? 1 : CMP(sl, next->k, key);
+        if (res == 0) { eq = next; }
         if (res < 0) {  /* next->key < key, advance */
             cur = next;
         } else if (res >= 0) { /* next->key >= key, descend */
             /* Descend when == to make sure it's the FIRST match. */
             if (lvl == 0) {
+                STAT_PATH_END(sl);
                 if (res == 0) { return next; } /* found */
                 return NULL;               /* not found */
             }
@@ -344,26 +1238,244 @@ static struct skiplist_node *get_first_eq_node(struct skiplist *sl, void *key) {
         }
     } while (lvl >= 0);
 
+    STAT_PATH_END(sl);
     return NULL;                 /* not found */
 }
 
-bool skiplist_get(struct skiplist *sl, void *key, void **value) {
+/* get_first_eq_node, but skipping nodes only kept for snapshots. */
+static struct skiplist_node *get_first_live_node(struct skiplist *sl,
+        void *key) {
     struct skiplist_node *n = get_first_eq_node(sl, key);
+#if SKIPLIST_SNAPSHOTS
+    if (n && !IS_LIVE(n)) { n = live_eq(sl, n, key); }
+#endif
+    return n;
+}
+
+#if SKIPLIST_ADAPTIVE
+/* Move N up a level: replace it with a copy one level taller, linked
+ * in at the same place. The copy is a fresh node, rather than N
+ * resized in place, since readers (see skiplist_set_epoch) may still
+ * be on N. Does nothing if N is already as tall as the head, if N is
+ * not the first node with its key, or on alloc failure. */
+static void promote(struct skiplist *sl, struct skiplist_node *n) {
+    struct skiplist_node *head = sl->head;
+    if (n->h >= head->h) { return; }
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    init_prevs(sl, n->k, head, head->h, prevs);
+    if (prevs[0]->next[0] != n) { return; }
+
+    SEQ_WRITE_BEGIN(sl);
+    (void)raise_node(sl, prevs, n);
+    SEQ_WRITE_END(sl);
+}
+
+/* Count a hit on N, and promote it every SKIPLIST_ADAPTIVE_HITS.
+ * Not while frozen (other threads may be reading) or while snapshots
+ * are open (they may be iterating over N). */
+static void count_hit(struct skiplist *sl, struct skiplist_node *n) {
+    if (sl->frozen) { return; }
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) { return; }
+#endif
+    if (++n->hits >= SKIPLIST_ADAPTIVE_HITS) {
+        n->hits = 0;
+        promote(sl, n);
+    }
+}
+#endif
+
+bool skiplist_get(struct skiplist *sl, void *key, void **value) {
+    STAT_OP(sl, SKIPLIST_OP_GET);
+    LAT_BEGIN();
+    struct skiplist_node *n = get_first_live_node(sl, key);
     if (n) {
         if (value) { *value = n->v; }
-        return true;
-    } else {
-        return false;
+#if SKIPLIST_ADAPTIVE
+        count_hit(sl, n);
+#endif
     }
+    LAT_END(sl, SKIPLIST_OP_GET);
+    return n != NULL;
 }
 
 bool skiplist_member(struct skiplist *sl, void *key) {
     return skiplist_get(sl, key, NULL);
 }
 
+#if SKIPLIST_SWMR || SKIPLIST_SNAPSHOTS
+/* Find the first node with a key >= KEY, or &SENTINEL, for a reader
+ * racing the writer: links are loaded with acquire, and no stats are
+ * counted. */
+static struct skiplist_node *find_ge_acquire(struct skiplist *sl,
+        void *key) {
+    struct skiplist_node *cur = ATOMIC_LOAD(&sl->head);
+    int lvl = cur->h - 1;
+    for (;;) {
+        struct skiplist_node *next = ATOMIC_LOAD(&cur->next[lvl]);
+        int res = IS_SENTINEL(next) ? 1 : sl->cmp(next->k, key);
+        if (res < 0) {
+            cur = next;
+        } else if (lvl > 0) {
+            lvl--;
+        } else {
+            return next;
+        }
+    }
+}
+#endif
+
+#if SKIPLIST_SNAPSHOTS
+/* The first node with KEY, starting from N, that VERSION can see. */
+static struct skiplist_node *find_visible(struct skiplist *sl,
+        struct skiplist_node *n, void *key, uint64_t version) {
+    while (!IS_SENTINEL(n) && sl->cmp(n->k, key) == 0) {
+        if (visible_at(n, version)) { return n; }
+        n = ATOMIC_LOAD(&n->next[0]);
+    }
+    return NULL;
+}
+#endif
+
+#if SKIPLIST_SWMR
+static struct skiplist_node *get_first_eq_node_swmr(struct skiplist *sl,
+        void *key) {
+    struct skiplist_node *n = find_ge_acquire(sl, key);
+#if SKIPLIST_SNAPSHOTS
+    return find_visible(sl, n, key, NODE_ALIVE - 1);
+#else
+    return !IS_SENTINEL(n) && sl->cmp(n->k, key) == 0 ? n : NULL;
+#endif
+}
+
+bool skiplist_get_swmr(struct skiplist *sl, void *key, void **value) {
+    assert(sl);
+    struct skiplist_node *n = NULL;
+    void *v = NULL;
+    uint64_t seq = 0;
+    do {
+        /* Wait out a write in progress. */
+        while ((seq = ATOMIC_LOAD(&sl->seq)) & 1) { sched_yield(); }
+        n = get_first_eq_node_swmr(sl, key);
+        if (n) { v = ATOMIC_LOAD(&n->v); }
+        /* Order the reads above before re-checking seq. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq);
+
+    if (n == NULL) { return false; }
+    if (value) { *value = v; }
+    return true;
+}
+
+bool skiplist_member_swmr(struct skiplist *sl, void *key) {
+    return skiplist_get_swmr(sl, key, NULL);
+}
+#endif
+
+#if SKIPLIST_SNAPSHOTS
+struct skiplist_snapshot *skiplist_snapshot(struct skiplist *sl) {
+    assert(sl);
+    if (sl->frozen) { return NULL; }
+    struct skiplist_snapshot *snap = sl->alloc(NULL, 0,
+        sizeof(*snap), sl->alloc_udata);
+    if (snap == NULL) { return NULL; }
+    snap->sl = sl;
+    snap->version = sl->version;
+    snap->newer = NULL;
+    snap->older = sl->snapshots;
+    if (snap->older) { snap->older->newer = snap; }
+    sl->snapshots = snap;
+    return snap;
+}
+
+bool skiplist_snapshot_get(struct skiplist_snapshot *snap,
+        void *key, void **value) {
+    assert(snap);
+    struct skiplist *sl = snap->sl;
+    struct skiplist_node *n = find_visible(sl,
+        find_ge_acquire(sl, key), key, snap->version);
+    if (n == NULL) { return false; }
+    if (value) { *value = value_at(n, snap->version); }
+    return true;
+}
+
+bool skiplist_snapshot_member(struct skiplist_snapshot *snap, void *key) {
+    return skiplist_snapshot_get(snap, key, NULL);
+}
+
+uint64_t skiplist_snapshot_version(struct skiplist_snapshot *snap) {
+    assert(snap);
+    return snap->version;
+}
+
+uint64_t skiplist_version(struct skiplist *sl) {
+    assert(sl);
+    return ATOMIC_LOAD(&sl->version);
+}
+
+bool skiplist_get_at(struct skiplist *sl, void *key,
+        uint64_t version, void **value) {
+    assert(sl);
+    struct skiplist_node *n = find_visible(sl,
+        find_ge_acquire(sl, key), key, version);
+    if (n == NULL) { return false; }
+    if (value) { *value = value_at(n, version); }
+    return true;
+}
+
+static void walk_visible(struct skiplist_snapshot *snap,
+        struct skiplist_node *n, skiplist_iter_cb *cb, void *udata) {
+    while (!IS_SENTINEL(n)) {
+        if (visible_at(n, snap->version)) {
+            if (cb(n->k, value_at(n, snap->version), udata)
+                != SKIPLIST_ITER_CONTINUE) {
+                break;
+            }
+        }
+        n = ATOMIC_LOAD(&n->next[0]);
+    }
+}
+
+void skiplist_snapshot_iter(struct skiplist_snapshot *snap,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(snap);
+    assert(cb);
+    struct skiplist_node *head = ATOMIC_LOAD(&snap->sl->head);
+    walk_visible(snap, ATOMIC_LOAD(&head->next[0]), cb, udata);
+}
+
+void skiplist_snapshot_iter_from(struct skiplist_snapshot *snap,
+        void *key, skiplist_iter_cb *cb, void *udata) {
+    assert(snap);
+    assert(cb);
+    struct skiplist *sl = snap->sl;
+    struct skiplist_node *n = find_visible(sl,
+        find_ge_acquire(sl, key), key, snap->version);
+    if (n != NULL) { walk_visible(snap, n, cb, udata); }
+}
+
+void skiplist_snapshot_release(struct skiplist_snapshot *snap) {
+    assert(snap);
+    struct skiplist *sl = snap->sl;
+    if (snap->newer) {
+        snap->newer->older = snap->older;
+    } else {
+        sl->snapshots = snap->older;
+    }
+    if (snap->older) { snap->older->newer = snap->newer; }
+    sl->alloc(snap, sizeof(*snap), 0, sl->alloc_udata);
+    if (sl->history) { (void)sweep(sl, false, NULL, NULL); }
+}
+#endif
+
 bool skiplist_first(struct skiplist *sl, void **key, void **value) {
     assert(sl);
+    STAT_OP(sl, SKIPLIST_OP_FIRST);
     struct skiplist_node *first = sl->head->next[0];
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) { first = first_live(sl); }
+    if (first == NULL) { return false; }
+#endif
     if (IS_SENTINEL(first)) { return false; }
     if (key) { *key = first->k; }
     if (value) { *value = first->v; }
@@ -372,18 +1484,31 @@ bool skiplist_first(struct skiplist *sl, void **key, void **value) {
 
 bool skiplist_last(struct skiplist *sl, void **key, void **value) {
     assert(sl);
+    STAT_OP(sl, SKIPLIST_OP_LAST);
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        struct skiplist_node *last = last_live(sl);
+        if (last == NULL) { return false; }
+        if (key) { *key = last->k; }
+        if (value) { *value = last->v; }
+        return true;
+    }
+#endif
     struct skiplist_node *head = sl->head;
     int lvl = head->h - 1;
     struct skiplist_node *cur = head->next[lvl];
     if (IS_SENTINEL(cur)) { return false; }
+    STAT_PATH_BEGIN();
     do {
         struct skiplist_node *next = cur->next[lvl];
+        STAT_VISIT(sl, lvl);
         if (IS_SENTINEL(next)) {
             lvl--;
         } else {
             cur = next;
         }
     } while (lvl >= 0);
+    STAT_PATH_END(sl);
 
     assert(!IS_SENTINEL(cur));
     assert(IS_SENTINEL(cur->next[0]));
@@ -392,9 +1517,14 @@ bool skiplist_last(struct skiplist *sl, void **key, void **value) {
     return true;
 }
 
-bool skiplist_pop_first(struct skiplist *sl, void **key, void **value) {
+static bool pop_first(struct skiplist *sl, void **key, void **value) {
     int height = 0;
     assert(sl);
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        return pop_snapshot(sl, first_live(sl), key, value);
+    }
+#endif
     struct skiplist_node *head = sl->head;
     struct skiplist_node *first = head->next[0];
     assert(first);
@@ -404,22 +1534,40 @@ bool skiplist_pop_first(struct skiplist *sl, void **key, void **value) {
     if (value) { *value = first->v; }
     sl->count--;
 
-    DO(height, head->next[i] = first->next[i]);
-    node_free(sl, first);
+    SEQ_WRITE_BEGIN(sl);
+    DO(height, PUBLISH(head->next[i], first->next[i]));
+    skiplist_node_free(sl, first);
+    SEQ_WRITE_END(sl);
     return true;
 }
 
-bool skiplist_pop_last(struct skiplist *sl, void **key, void **value) {
+bool skiplist_pop_first(struct skiplist *sl, void **key, void **value) {
+    if (sl->frozen) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_POP_FIRST);
+    LAT_BEGIN();
+    bool res = pop_first(sl, key, value);
+    LAT_END(sl, SKIPLIST_OP_POP_FIRST);
+    return res;
+}
+
+static bool pop_last(struct skiplist *sl, void **key, void **value) {
     assert(sl);
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        return pop_snapshot(sl, last_live(sl), key, value);
+    }
+#endif
     struct skiplist_node *head = sl->head;
     struct skiplist_node *prevs[head->h];
     int lvl = head->h - 1;
     struct skiplist_node *cur = head;
     if (sl->count == 0) { return false; }
+    STAT_PATH_BEGIN();
 
     /* Get all the nodes that are (node -> last -> &SENTINEL) so
      * node can skip directly to the sentinel. */
     do {
+        STAT_VISIT(sl, lvl);
         if (IS_SENTINEL(cur->next[lvl])) {
             prevs[lvl--] = cur;
         } else {
@@ -431,6 +1579,7 @@ bool skiplist_pop_last(struct skiplist *sl, void **key, void **value) {
             }
         }
     } while (lvl >= 0);
+    STAT_PATH_END(sl);
 
     cur = cur->next[0];
     assert(!IS_SENTINEL(cur));
@@ -438,17 +1587,28 @@ bool skiplist_pop_last(struct skiplist *sl, void **key, void **value) {
 
     /* skip over the last non-SENTINEL nodes. */
     DO(cur->h, assert(prevs[i]->next[i] == cur));
-    DO(cur->h, prevs[i]->next[i] = &SENTINEL);
+    SEQ_WRITE_BEGIN(sl);
+    DO(cur->h, PUBLISH(prevs[i]->next[i], &SENTINEL));
 
     if (key) { *key = cur->k; }
     if (value) { *value = cur->v; }
     sl->count--;
 
     assert(!IS_SENTINEL(cur));
-    node_free(sl, cur);
+    skiplist_node_free(sl, cur);
+    SEQ_WRITE_END(sl);
     return true;
 }
 
+bool skiplist_pop_last(struct skiplist *sl, void **key, void **value) {
+    if (sl->frozen) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_POP_LAST);
+    LAT_BEGIN();
+    bool res = pop_last(sl, key, value);
+    LAT_END(sl, SKIPLIST_OP_POP_LAST);
+    return res;
+}
+
 size_t skiplist_count(struct skiplist *sl) {
     assert(sl);
     return sl->count;
@@ -458,12 +1618,27 @@ bool skiplist_empty(struct skiplist *sl) {
     return (skiplist_count(sl) == 0);
 }
 
+void skiplist_freeze(struct skiplist *sl) {
+    assert(sl);
+#if SKIPLIST_SNAPSHOTS
+    assert(sl->snapshots == NULL);
+#endif
+    sl->frozen = true;
+}
+
+bool skiplist_frozen(struct skiplist *sl) {
+    assert(sl);
+    return sl->frozen;
+}
+
 static void walk_and_apply(struct skiplist_node *cur,
         skiplist_iter_cb *cb, void *udata) {
     while (!IS_SENTINEL(cur)) {
-        enum skiplist_iter_res res;
-        res = cb(cur->k, cur->v, udata);
-        if (res != SKIPLIST_ITER_CONTINUE) { break; }
+        if (IS_LIVE(cur)) {
+            enum skiplist_iter_res res;
+            res = cb(cur->k, cur->v, udata);
+            if (res != SKIPLIST_ITER_CONTINUE) { break; }
+        }
         cur = cur->next[0];
     }
 }
@@ -471,44 +1646,311 @@ static void walk_and_apply(struct skiplist_node *cur,
 void skiplist_iter(struct skiplist *sl, skiplist_iter_cb *cb, void *udata) {
     assert(sl);
     assert(cb);
+    STAT_OP(sl, SKIPLIST_OP_ITER);
+    LAT_BEGIN();
     walk_and_apply(sl->head->next[0], cb, udata);
+    LAT_END(sl, SKIPLIST_OP_ITER);
 }
 
 void skiplist_iter_from(struct skiplist *sl, void *key,
         skiplist_iter_cb *cb, void *udata) {
     assert(sl);
     assert(cb);
-    struct skiplist_node *cur = get_first_eq_node(sl, key);
+    STAT_OP(sl, SKIPLIST_OP_ITER);
+    LAT_BEGIN();
+    struct skiplist_node *cur = get_first_live_node(sl, key);
     LOG2("first node is %p\n", (void *)cur);
-    if (cur == NULL) { return; }
-    walk_and_apply(cur, cb, udata);
+    if (cur != NULL) { walk_and_apply(cur, cb, udata); }
+    LAT_END(sl, SKIPLIST_OP_ITER);
+}
+
+/* First node with a key > KEY, or the sentinel. */
+static struct skiplist_node *find_gt(struct skiplist *sl, void *key) {
+    struct skiplist_node *cur = sl->head;
+    for (int lvl = cur->h - 1; lvl >= 0; lvl--) {
+        struct skiplist_node *next = cur->next[lvl];
+        while (!IS_SENTINEL(next) && CMP(sl, next->k, key) <= 0) {
+            cur = next;
+            next = cur->next[lvl];
+        }
+    }
+    return cur->next[0];
+}
+
+size_t skiplist_iter_batch(struct skiplist *sl,
+        struct skiplist_cursor *cursor, void **keys, void **values,
+        size_t max) {
+    assert(sl);
+    assert(cursor);
+    assert(keys || max == 0);
+    if (cursor->done || max == 0) { return 0; }
+    STAT_OP(sl, SKIPLIST_OP_ITER);
+    LAT_BEGIN();
+
+    struct skiplist_node *cur;
+    if (cursor->node == NULL) {
+        cur = sl->head->next[0];
+    } else if (cursor->gen == sl->gen) {
+        cur = ((struct skiplist_node *)cursor->node)->next[0];
+    } else {                    /* it may have been freed */
+        cur = find_gt(sl, cursor->key);
+    }
+
+    size_t n = 0;
+    struct skiplist_node *last = NULL;
+    while (!IS_SENTINEL(cur) && n < max) {
+        struct skiplist_node *next = cur->next[0];
+        if (!IS_SENTINEL(next)) { PREFETCH(next->next[0]); }
+        if (IS_LIVE(cur)) {
+            keys[n] = cur->k;
+            if (values) { values[n] = cur->v; }
+            n++;
+            last = cur;
+        }
+        cur = next;
+    }
+
+    if (last != NULL) {
+        cursor->node = last;
+        cursor->key = last->k;
+        cursor->gen = sl->gen;
+    }
+    if (IS_SENTINEL(cur)) { cursor->done = true; }
+    LAT_END(sl, SKIPLIST_OP_ITER);
+    return n;
+}
+
+/* Set PREVS to the last node on each level up to CURSOR's position,
+ * and return the node after it. If nodes were freed since the cursor
+ * was saved, it resumes after CURSOR's key instead, like iter_batch. */
+static struct skiplist_node *resume_prevs(struct skiplist *sl,
+        struct skiplist_cursor *cursor, struct skiplist_node **prevs) {
+    struct skiplist_node *head = sl->head;
+    if (cursor->node == NULL) {
+        DO(head->h, prevs[i] = head);
+        return head->next[0];
+    }
+    init_prevs(sl, cursor->key, head, head->h, prevs);
+    bool valid = cursor->gen == sl->gen;
+    struct skiplist_node *cur = prevs[0]->next[0];
+    while (!IS_SENTINEL(cur) && CMP(sl, cur->k, cursor->key) == 0) {
+        DO(cur->h, prevs[i] = cur);
+        if (valid && cur == cursor->node) { return cur->next[0]; }
+        cur = cur->next[0];
+    }
+    return cur;
+}
+
+size_t skiplist_compact(struct skiplist *sl,
+        struct skiplist_cursor *cursor, size_t budget) {
+    assert(sl);
+    assert(cursor);
+    if (cursor->done || budget == 0 || sl->frozen) { return 0; }
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) { return 0; }
+#endif
+
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_node *cur = resume_prevs(sl, cursor, prevs);
+    size_t moved = 0;
+    SEQ_WRITE_BEGIN(sl);
+    while (!IS_SENTINEL(cur) && moved < budget) {
+        struct skiplist_node *next = cur->next[0];
+        if (!IS_SENTINEL(next)) { PREFETCH(next->next[0]); }
+        struct skiplist_node *nn = node_copy(sl, cur, cur->h);
+        if (nn == NULL) { break; }
+        for (int i = 0; i < nn->h; i++) {
+            assert(prevs[i]->next[i] == cur);
+            PUBLISH(prevs[i]->next[i], nn);
+            prevs[i] = nn;
+        }
+        skiplist_node_free(sl, cur);
+        cursor->node = nn;
+        cursor->key = nn->k;
+        moved++;
+        cur = next;
+    }
+    SEQ_WRITE_END(sl);
+
+    /* Only this call freed nodes, and it kept track. */
+    cursor->gen = sl->gen;
+    if (IS_SENTINEL(cur)) { cursor->done = true; }
+    return moved;
+}
+
+size_t skiplist_rebalance(struct skiplist *sl,
+        struct skiplist_cursor *cursor, size_t budget) {
+    assert(sl);
+    assert(cursor);
+    if (cursor->done || budget == 0 || sl->frozen) { return 0; }
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) { return 0; }
+#endif
+
+    /* runs[i]: nodes on level i since the last one on level i+1. */
+    int runs[SKIPLIST_MAX_HEIGHT];
+    memset(runs, 0, sizeof(runs));
+    struct skiplist_node *prevs[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_node *cur = resume_prevs(sl, cursor, prevs);
+    int top = sl->head->h;
+    size_t visited = 0;
+    SEQ_WRITE_BEGIN(sl);
+    while (!IS_SENTINEL(cur) && visited < budget) {
+        struct skiplist_node *next = cur->next[0];
+        if (!IS_SENTINEL(next)) { PREFETCH(next->next[0]); }
+        DO(cur->h - 1, runs[i] = 0);
+        /* Raising a node ends the run below and may end the one above. */
+        while (++runs[cur->h - 1] >= SKIPLIST_REBALANCE_GAP
+            && cur->h < top) {
+            struct skiplist_node *nn = raise_node(sl, prevs, cur);
+            if (nn == NULL) { break; }
+            cur = nn;
+            runs[cur->h - 2] = 0;
+        }
+        DO(cur->h, prevs[i] = cur);
+        cursor->node = cur;
+        cursor->key = cur->k;
+        visited++;
+        cur = next;
+    }
+    SEQ_WRITE_END(sl);
+
+    cursor->gen = sl->gen;
+    if (IS_SENTINEL(cur)) { cursor->done = true; }
+    return visited;
 }
 
 size_t skiplist_clear(struct skiplist *sl,
         skiplist_free_cb *cb, void *udata) {
     assert(sl);
+    if (sl->frozen) { return 0; }
+    STAT_OP(sl, SKIPLIST_OP_CLEAR);
+    LAT_BEGIN();
+#if SKIPLIST_SNAPSHOTS
+    if (sl->snapshots) {
+        size_t cleared = sweep(sl, true, cb, udata);
+        LAT_END(sl, SKIPLIST_OP_CLEAR);
+        return cleared;
+    }
+#endif
     struct skiplist_node *cur = sl->head->next[0];
     size_t ct = 0;
+    SEQ_WRITE_BEGIN(sl);
+    DO(sl->head->h, PUBLISH(sl->head->next[i], &SENTINEL));
     while (!IS_SENTINEL(cur)) {
         struct skiplist_node *doomed = cur;
         if (cb) { cb(doomed->k, doomed->v, udata); }
         cur = doomed->next[0];
-        node_free(sl, doomed);
+        skiplist_node_free(sl, doomed);
         ct++;
     }
-    DO(sl->head->h, sl->head->next[i] = &SENTINEL);
+    sl->count = 0;
+    SEQ_WRITE_END(sl);
+    LAT_END(sl, SKIPLIST_OP_CLEAR);
     return ct;
 }
 
 size_t skiplist_free(struct skiplist *sl,
         skiplist_free_cb *cb, void *udata) {
     assert(sl);
+#if SKIPLIST_SNAPSHOTS
+    assert(sl->snapshots == NULL);
+#endif
+    sl->frozen = false;         /* freeing is allowed */
     size_t ct = skiplist_clear(sl, cb, udata);
-    node_free(sl, sl->head);
+    skiplist_node_free(sl, sl->head);
     sl->alloc(sl, sizeof(*sl), 0, sl->alloc_udata);
     return ct;
 }
 
+#if SKIPLIST_STATS
+void skiplist_get_stats(struct skiplist *sl, struct skiplist_stats *stats) {
+    assert(sl);
+    assert(stats);
+    *stats = sl->stats;
+}
+
+void skiplist_reset_stats(struct skiplist *sl) {
+    assert(sl);
+    memset(&sl->stats, 0, sizeof(sl->stats));
+}
+#endif
+
+#if SKIPLIST_LATENCY
+/* Latency histogram buckets are logarithmic, with 2^LATENCY_SUB_BITS
+ * linear sub-buckets per power of two, so a reported percentile is
+ * at most ~25% above the real value. Values under 2^LATENCY_SUB_BITS
+ * nsec get a bucket each, anything beyond LATENCY_MAX_BIT is clamped
+ * into the last bucket. */
+static uint64_t latency_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int latency_bucket(uint64_t nsec) {
+    const uint64_t sub_count = 1 << LATENCY_SUB_BITS;
+    if (nsec < sub_count) { return (int)nsec; }
+    int msb = 63 - __builtin_clzll(nsec);
+    if (msb > LATENCY_MAX_BIT) { return LATENCY_BUCKETS - 1; }
+    int shift = msb - LATENCY_SUB_BITS;
+    int sub = (int)((nsec >> shift) & (sub_count - 1));
+    return (int)sub_count + shift * (int)sub_count + sub;
+}
+
+/* Largest value that falls into bucket B. */
+static uint64_t latency_bucket_limit(int b) {
+    const int sub_count = 1 << LATENCY_SUB_BITS;
+    if (b < sub_count) { return (uint64_t)b; }
+    int shift = (b - sub_count) / sub_count;
+    uint64_t sub = (uint64_t)((b - sub_count) % sub_count);
+    return (((uint64_t)sub_count + sub + 1) << shift) - 1;
+}
+
+static void latency_record(struct skiplist *sl,
+        enum skiplist_op op, uint64_t nsec) {
+    if (sl->frozen) { return; }
+    struct latency_hist *h = &sl->latency[op];
+    h->count++;
+    if (nsec > h->max) { h->max = nsec; }
+    h->buckets[latency_bucket(nsec)]++;
+}
+
+/* Smallest bucket limit at or above which lie at most
+ * (1 - PERMILLE/1000) of the samples. */
+static uint64_t latency_percentile(struct latency_hist *h, unsigned permille) {
+    uint64_t want = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want && seen > 0) {
+            uint64_t limit = latency_bucket_limit(b);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+bool skiplist_get_latency(struct skiplist *sl, enum skiplist_op op,
+        struct skiplist_latency *lat) {
+    assert(sl);
+    assert(lat);
+    if (op >= SKIPLIST_OP_TYPE_COUNT) { return false; }
+    struct latency_hist *h = &sl->latency[op];
+    lat->count = h->count;
+    lat->max = h->max;
+    lat->p50 = latency_percentile(h, 500);
+    lat->p99 = latency_percentile(h, 990);
+    lat->p999 = latency_percentile(h, 999);
+    return h->count > 0;
+}
+
+void skiplist_reset_latency(struct skiplist *sl) {
+    assert(sl);
+    memset(sl->latency, 0, sizeof(sl->latency));
+}
+#endif
+
 #if SKIPLIST_DEBUG
 void skiplist_debug(struct skiplist *sl, FILE *f,
         skiplist_fprintf_kv_cb *cb, void *udata) {
@@ -83,13 +83,48 @@ uint8_t SKIPLIST_GEN_HEIGHT(void);
  * Returns whether the value was successfully added. */
 bool skiplist_add(struct skiplist *sl, void *key, void *value);
 
+/* Add COUNT key/value pairs, from KEYS[i] and VALUES[i], in one pass.
+ * The keys must already be in ascending order. Each insert continues
+ * the search from where the previous one stopped, so a sorted batch
+ * costs much less than COUNT separate calls to skiplist_add.
+ *
+ * Returns how many pairs were added, which is less than COUNT only
+ * on allocation failure. */
+size_t skiplist_add_sorted(struct skiplist *sl, size_t count,
+    void **keys, void **values);
+
 /* Set a key/value pair in the skiplist, replacing an existing
  * value if present. If OLD is non-NULL, then *old will be set
- * to the previous value, or NULL if it was not present.
+ * to the previous value, or NULL if it was not present. While
+ * snapshots are open, they can still read *OLD, so it must not be
+ * freed until they are released (see skiplist_snapshot).
  * Otherwise behaves the same as skiplist_add. */
 bool skiplist_set(struct skiplist *sl,
     void *key, void *value, void **old);
 
+/* Callback for skiplist_upsert. If KEY is present, VALUE points to its
+ * value, which the callback can change, and the return value is
+ * ignored. Otherwise VALUE is NULL, and the callback returns the value
+ * to add. */
+typedef void *skiplist_upsert_cb(void *key, void **value, void *udata);
+
+/* Read, modify and write KEY's value with one search, by calling CB
+ * as described above. If there are several values for KEY, only one
+ * is updated. Returns false on alloc failure. */
+bool skiplist_upsert(struct skiplist *sl, void *key,
+    skiplist_upsert_cb *cb, void *udata);
+
+/* Get a pointer to KEY's value, adding KEY with a NULL value first if
+ * it isn't present, with one search. *INSERTED (if non-NULL) is set to
+ * whether it was added. The pointer is valid until the skiplist is
+ * next changed. With SKIPLIST_ADAPTIVE, a plain skiplist_get counts as
+ * a change too: it can promote a hot key's node by replacing it with
+ * a taller copy, which invalidates the pointer. Stores through it are
+ * plain stores, unseen by snapshots and unordered for SWMR readers, so
+ * this returns NULL while any snapshot is open, as well as on alloc
+ * failure. */
+void **skiplist_emplace(struct skiplist *sl, void *key, bool *inserted);
+
 /* Get the value associated with KEY. If the key is found and VALUE is
  * non-NULL, it will be written into *VALUE.
  * Returns whether the key was found. */
@@ -115,6 +150,38 @@ typedef void skiplist_free_cb(void *key, void *value, void *udata);
 void skiplist_delete_all(struct skiplist *sl, void *key,
     skiplist_free_cb *cb, void *udata);
 
+/* Opaque write batch type. */
+struct skiplist_write_batch;
+
+/* Create a batch of changes to SL, using SL's allocator.
+ * Returns NULL on error. */
+struct skiplist_write_batch *skiplist_write_batch_new(struct skiplist *sl);
+
+/* Queue an add, set or delete, as with skiplist_add, skiplist_set and
+ * skiplist_delete. Returns false on alloc failure. */
+bool skiplist_write_batch_add(struct skiplist_write_batch *b,
+    void *key, void *value);
+bool skiplist_write_batch_set(struct skiplist_write_batch *b,
+    void *key, void *value);
+bool skiplist_write_batch_delete(struct skiplist_write_batch *b,
+    void *key);
+
+/* How many changes are queued? */
+size_t skiplist_write_batch_count(struct skiplist_write_batch *b);
+
+/* Apply the queued changes, sorted by key (changes to the same key are
+ * applied in the order queued), in one pass over the skiplist, and
+ * empty the batch. CB (if non-NULL) is called on each value replaced
+ * by a set, and each pair removed by a delete. Returns false on alloc
+ * failure, in which case nothing was changed, unless snapshots are
+ * open: then the changes are applied one at a time, and the batch
+ * is left as is if one fails. */
+bool skiplist_write_batch_apply(struct skiplist_write_batch *b,
+    skiplist_free_cb *cb, void *udata);
+
+/* Free the batch, and anything still queued in it. */
+void skiplist_write_batch_free(struct skiplist_write_batch *b);
+
 /* Get the first or last pair from the skiplist.
  * If key or value are non-NULL, the pair is returned in them.
  * Passing in a NULL key is legal, it will be ignored.
@@ -135,6 +202,16 @@ size_t skiplist_count(struct skiplist *sl);
 /* Is the skiplist empty? */
 bool skiplist_empty(struct skiplist *sl);
 
+/* Make the skiplist read-only. From then on, anything that would change
+ * it fails (returning false, 0 or NULL), and it can be read by any
+ * number of threads at once without locking; operation counters and
+ * latencies are no longer recorded. It can still be freed. There must
+ * be no open snapshots. */
+void skiplist_freeze(struct skiplist *sl);
+
+/* Has the skiplist been frozen? */
+bool skiplist_frozen(struct skiplist *sl);
+
 /* Callback when iterating over the contents of the skiplist.
  * The return value determines whether to keep iterating.
  * UDATA is an extra void * for the callback's closure/enironment. */
@@ -154,6 +231,58 @@ void skiplist_iter(struct skiplist *sl,
 void skiplist_iter_from(struct skiplist *sl, void *key,
     skiplist_iter_cb *cb, void *udata);
 
+/* Position in a skiplist for skiplist_iter_batch, skiplist_compact and
+ * skiplist_rebalance. Initialize it with SKIPLIST_CURSOR_INIT; the
+ * fields are private. */
+struct skiplist_cursor {
+    void *node;
+    void *key;
+    uint64_t gen;
+    bool done;
+};
+#define SKIPLIST_CURSOR_INIT { NULL, NULL, 0, false }
+
+/* Copy up to MAX pairs, starting from CURSOR, into KEYS[i] and
+ * VALUES[i] (VALUES can be NULL), and advance CURSOR past them. This
+ * avoids a callback per pair. Returns how many were copied, and 0 once
+ * the end is reached.
+ *
+ * The skiplist can be changed between calls. If a node has been freed
+ * since the last call, the cursor resumes after the last key returned,
+ * so with duplicate keys the rest of that key's values are skipped. */
+size_t skiplist_iter_batch(struct skiplist *sl,
+    struct skiplist_cursor *cursor, void **keys, void **values,
+    size_t max);
+
+/* Move up to BUDGET nodes, starting from CURSOR (initialized with
+ * SKIPLIST_CURSOR_INIT), to fresh allocations in key order, and
+ * advance CURSOR past them. Call it repeatedly, e.g. when idle, until
+ * it returns 0. After a long run of adds and deletes, this puts nodes
+ * that are next to each other in the list close together in memory
+ * again, when the allocator hands out consecutive allocations from
+ * fresh memory (as arena and most malloc allocators do), and lets it
+ * release the emptied memory. Returns how many nodes were moved.
+ *
+ * The skiplist can be changed between calls, as for skiplist_iter_batch.
+ * Pointers from skiplist_emplace are invalidated. Does nothing while
+ * the skiplist is frozen or any snapshot is open. */
+size_t skiplist_compact(struct skiplist *sl,
+    struct skiplist_cursor *cursor, size_t budget);
+
+/* Walk up to BUDGET nodes from CURSOR (initialized with
+ * SKIPLIST_CURSOR_INIT), and advance CURSOR past them. Wherever too
+ * many nodes in a row stop at the same level (see
+ * SKIPLIST_REBALANCE_GAP), as can happen after deleting most of a
+ * range, raise one to the next level, so searches don't degrade into
+ * walking along the lower levels. Call it repeatedly, e.g. when idle,
+ * until it returns 0. Returns how many nodes were visited.
+ *
+ * The skiplist can be changed between calls, as for skiplist_compact.
+ * Runs are counted from the start of each call. Does nothing while
+ * the skiplist is frozen or any snapshot is open. */
+size_t skiplist_rebalance(struct skiplist *sl,
+    struct skiplist_cursor *cursor, size_t budget);
+
 /* Clear the skiplist. Returns the number of pairs removed,
  * or 0 on error. */
 size_t skiplist_clear(struct skiplist *sl,
@@ -164,6 +293,141 @@ size_t skiplist_clear(struct skiplist *sl,
 size_t skiplist_free(struct skiplist *sl,
     skiplist_free_cb *cb, void *udata);
 
+/* Epoch-based reclamation domain, see skiplist_epoch.h. */
+struct skiplist_epoch;
+
+/* Retire deleted nodes through epoch domain E (or free them
+ * immediately, if NULL, which is the default), so that readers in
+ * an epoch critical section can still safely look at them. */
+void skiplist_set_epoch(struct skiplist *sl, struct skiplist_epoch *e);
+
+#if SKIPLIST_SWMR
+/* Lookups for single-writer/multi-reader use. One thread may call the
+ * ordinary skiplist_* functions while any number of others call these,
+ * with no lock. They write no shared memory: they retry if the
+ * writer's sequence number changed underneath them.
+ *
+ * Since the writer may unlink and free a node a reader is looking at,
+ * the skiplist needs an epoch domain (skiplist_set_epoch), and readers
+ * must call these from inside an epoch critical section. */
+bool skiplist_get_swmr(struct skiplist *sl, void *key, void **value);
+bool skiplist_member_swmr(struct skiplist *sl, void *key);
+#endif
+
+#if SKIPLIST_SNAPSHOTS
+/* Opaque snapshot type: a read-only view of a skiplist's contents at
+ * the time it was taken. */
+struct skiplist_snapshot;
+
+/* Take a snapshot of SL, returns NULL on error. This is O(1), and
+ * copies nothing: every write is stamped with a version number, and a
+ * snapshot just records the current one. While any snapshot is open,
+ * deleted pairs are only marked as deleted, and skiplist_set keeps the
+ * old value in a per-pair version chain, back to the oldest snapshot.
+ *
+ * So that snapshots never read freed memory, the free callbacks given
+ * to skiplist_delete_all, skiplist_clear and skiplist_write_batch_apply
+ * are held back until the last snapshot that can see the pair (or old
+ * value) they are called on is released. Holding one back allocates,
+ * and on alloc failure those calls change nothing. Likewise, keys and
+ * values handed back by skiplist_set, skiplist_delete and
+ * skiplist_pop_first/last stay owned by the skiplist until then: a
+ * caller that frees them must wait for the snapshots taken before the
+ * change to be released. Everything else keeps working as usual.
+ *
+ * Only the thread that modifies SL may take or release snapshots, and
+ * they must all be released before SL is freed. */
+struct skiplist_snapshot *skiplist_snapshot(struct skiplist *sl);
+
+/* Lookups and iteration, as with the skiplist_* versions, but seeing
+ * the skiplist as it was when SNAP was taken. They write no shared
+ * memory, so any number of threads can read one snapshot at once.
+ * Reading while another thread modifies the skiplist has the same
+ * requirements as skiplist_get_swmr: SKIPLIST_SWMR, an epoch domain,
+ * and an epoch critical section around each call. */
+bool skiplist_snapshot_get(struct skiplist_snapshot *snap,
+    void *key, void **value);
+bool skiplist_snapshot_member(struct skiplist_snapshot *snap, void *key);
+void skiplist_snapshot_iter(struct skiplist_snapshot *snap,
+    skiplist_iter_cb *cb, void *udata);
+void skiplist_snapshot_iter_from(struct skiplist_snapshot *snap,
+    void *key, skiplist_iter_cb *cb, void *udata);
+
+/* Release a snapshot. Deleted pairs and old values that no remaining
+ * snapshot can see are freed, which takes one pass over the skiplist. */
+void skiplist_snapshot_release(struct skiplist_snapshot *snap);
+
+/* The version of SL's latest write, or the version SNAP was taken at. */
+uint64_t skiplist_version(struct skiplist *sl);
+uint64_t skiplist_snapshot_version(struct skiplist_snapshot *snap);
+
+/* Get the value KEY had as of VERSION, as for skiplist_get. History is
+ * only kept back to the oldest open snapshot, so VERSION must be no
+ * older than that (or the latest version, with none open). Same
+ * threading rules as skiplist_snapshot_get. */
+bool skiplist_get_at(struct skiplist *sl, void *key,
+    uint64_t version, void **value);
+#endif
+
+/* Operation types, used to index per-operation statistics. */
+enum skiplist_op {
+    SKIPLIST_OP_ADD,
+    SKIPLIST_OP_SET,
+    SKIPLIST_OP_GET,            /* also skiplist_member */
+    SKIPLIST_OP_DELETE,
+    SKIPLIST_OP_DELETE_ALL,
+    SKIPLIST_OP_FIRST,
+    SKIPLIST_OP_LAST,
+    SKIPLIST_OP_POP_FIRST,
+    SKIPLIST_OP_POP_LAST,
+    SKIPLIST_OP_ITER,           /* also skiplist_iter_from */
+    SKIPLIST_OP_CLEAR,
+    SKIPLIST_OP_TYPE_COUNT
+};
+
+#if SKIPLIST_STATS
+/* Upper bound for SKIPLIST_MAX_HEIGHT when statistics are enabled. */
+#define SKIPLIST_STATS_LEVELS 32
+
+/* Operation counters, only available when compiled with
+ * SKIPLIST_STATS. A search's path length is the number of
+ * nodes it looked at, summed over all levels. */
+struct skiplist_stats {
+    uint64_t ops[SKIPLIST_OP_TYPE_COUNT];   /* calls, by operation */
+    uint64_t cmps;                          /* comparison callbacks */
+    uint64_t hops[SKIPLIST_STATS_LEVELS];   /* nodes visited, by level */
+    uint64_t max_path;                      /* longest search path */
+};
+
+/* Copy the skiplist's current counters into *STATS. */
+void skiplist_get_stats(struct skiplist *sl, struct skiplist_stats *stats);
+
+/* Reset all of the skiplist's counters to 0. */
+void skiplist_reset_stats(struct skiplist *sl);
+#endif
+
+#if SKIPLIST_LATENCY
+/* Latency summary for one operation type, in nanoseconds. Only
+ * available when compiled with SKIPLIST_LATENCY. Percentiles come
+ * from a log-bucketed histogram, and may overestimate by up to 25%;
+ * MAX is exact. */
+struct skiplist_latency {
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+/* Get the latency summary for operation type OP.
+ * Returns whether any operations of that type have been recorded. */
+bool skiplist_get_latency(struct skiplist *sl, enum skiplist_op op,
+    struct skiplist_latency *lat);
+
+/* Clear all of the skiplist's latency histograms. */
+void skiplist_reset_latency(struct skiplist *sl);
+#endif
+
 #if SKIPLIST_DEBUG
 #include <stdio.h>
 
@@ -25,6 +25,73 @@
 #define SKIPLIST_DEBUG 0
 #endif
 
+/* Keep per-skiplist operation counters (comparisons, nodes visited
+ * per level, longest search path), readable via skiplist_get_stats.
+ * When 0, the counting compiles away entirely. */
+#ifndef SKIPLIST_STATS
+#define SKIPLIST_STATS 0
+#endif
+
+/* Record per-operation latency histograms (via clock_gettime),
+ * readable via skiplist_get_latency. Adds two clock reads to each
+ * operation, so it is off by default. */
+#ifndef SKIPLIST_LATENCY
+#define SKIPLIST_LATENCY 0
+#endif
+
+/* How many retirements between attempts to advance the epoch and
+ * free retired memory, in skiplist_epoch.c. */
+#ifndef SKIPLIST_EPOCH_INTERVAL
+#define SKIPLIST_EPOCH_INTERVAL 64
+#endif
+
+/* Single-writer/multi-reader mode: writers publish links with release
+ * stores and bump a per-list sequence counter, so other threads can
+ * call skiplist_get_swmr and skiplist_member_swmr without a lock. */
+#ifndef SKIPLIST_SWMR
+#define SKIPLIST_SWMR 0
+#endif
+
+/* Snapshots: skiplist_snapshot returns a read-only view of the list as
+ * it was, which stays the same while the list changes. Adds a pair of
+ * version numbers to every node. */
+#ifndef SKIPLIST_SNAPSHOTS
+#define SKIPLIST_SNAPSHOTS 0
+#endif
+
+/* Access-biased heights: skiplist_get counts hits per node, and every
+ * SKIPLIST_ADAPTIVE_HITS hits on a node moves it up a level (up to the
+ * head's height), so frequently read keys are found in fewer hops.
+ * skiplist_get then changes the list: it must be locked as a write,
+ * and must not be called on the same list from an iteration callback.
+ * Adds a counter to every node. */
+#ifndef SKIPLIST_ADAPTIVE
+#define SKIPLIST_ADAPTIVE 0
+#endif
+
+#ifndef SKIPLIST_ADAPTIVE_HITS
+#define SKIPLIST_ADAPTIVE_HITS 16
+#endif
+
+/* skiplist_rebalance raises a node a level whenever it is the Nth in a
+ * row on its top level, with no taller node in between. With heights
+ * chosen with P = 0.5, a run of 4 happens once per 8 nodes. */
+#ifndef SKIPLIST_REBALANCE_GAP
+#define SKIPLIST_REBALANCE_GAP 4
+#endif
+
+/* A shard of a skiplist_sharded is rebalanced when it holds more than
+ * SKIPLIST_SHARD_SKEW times as many pairs as the smallest shard (and
+ * more than SKIPLIST_SHARD_CHECK_INTERVAL). This is checked every
+ * SKIPLIST_SHARD_CHECK_INTERVAL adds to the shard. */
+#ifndef SKIPLIST_SHARD_SKEW
+#define SKIPLIST_SHARD_SKEW 4
+#endif
+
+#ifndef SKIPLIST_SHARD_CHECK_INTERVAL
+#define SKIPLIST_SHARD_CHECK_INTERVAL 1024
+#endif
+
 /* Define a custom random-height-calculation function.
  * 
  * To keep expected skiplist behavior, the probability of a
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sched.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist_epoch.h"
+#include "skiplist_macros_internal.h"
+
+/* Something retired, waiting for its epoch to become safe. */
+struct retired {
+    struct retired *next;
+    void *p;
+    size_t size;
+    skiplist_alloc_cb *alloc;
+    void *udata;
+};
+
+struct skiplist_epoch_reader {
+    /* (epoch << 1) | 1 while in a critical section, 0 otherwise. */
+    uint64_t state;
+    int nesting;            /* only used by the owning thread */
+    int in_use;
+    struct skiplist_epoch *e;
+    struct skiplist_epoch_reader *next;
+    void *block;            /* as allocated, for freeing */
+} CACHE_ALIGNED;
+
+#define READER_ALLOC_SIZE                                               \
+        CACHE_ALLOC_SIZE(sizeof(struct skiplist_epoch_reader))
+
+struct skiplist_epoch {
+    uint64_t global;        /* current epoch */
+    int reclaiming;         /* held while advancing the epoch */
+    unsigned retire_count;
+    /* Retired in epoch N, freed once the epoch reaches N + 2. */
+    struct retired *limbo[3];
+    struct skiplist_epoch_reader *readers;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+#define ACTIVE ((uint64_t)1)
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+struct skiplist_epoch *skiplist_epoch_new(skiplist_alloc_cb *alloc,
+        void *alloc_udata) {
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_epoch *e = alloc(NULL, 0, sizeof(*e), alloc_udata);
+    if (e) {
+        e->global = 1;
+        e->reclaiming = 0;
+        e->retire_count = 0;
+        DO(3, e->limbo[i] = NULL);
+        e->readers = NULL;
+        e->alloc = alloc;
+        e->alloc_udata = alloc_udata;
+    }
+    return e;
+}
+
+/* Free everything on a limbo list. Returns how many were freed. */
+static size_t free_retired(struct skiplist_epoch *e, struct retired *r) {
+    size_t ct = 0;
+    while (r != NULL) {
+        struct retired *next = r->next;
+        r->alloc(r->p, r->size, 0, r->udata);
+        e->alloc(r, sizeof(*r), 0, e->alloc_udata);
+        r = next;
+        ct++;
+    }
+    return ct;
+}
+
+void skiplist_epoch_free(struct skiplist_epoch *e) {
+    assert(e);
+    DO(3, free_retired(e, e->limbo[i]));
+    struct skiplist_epoch_reader *r = e->readers;
+    while (r != NULL) {
+        struct skiplist_epoch_reader *next = r->next;
+        assert(r->state == 0);
+        e->alloc(r->block, READER_ALLOC_SIZE, 0, e->alloc_udata);
+        r = next;
+    }
+    e->alloc(e, sizeof(*e), 0, e->alloc_udata);
+}
+
+struct skiplist_epoch_reader *skiplist_epoch_register(
+        struct skiplist_epoch *e) {
+    assert(e);
+    /* Reuse a record, if one is free. */
+    for (struct skiplist_epoch_reader *r = ATOMIC_LOAD(&e->readers);
+         r != NULL; r = r->next) {
+        int free_record = 0;
+        if (ATOMIC_CAS(&r->in_use, &free_record, 1)) { return r; }
+    }
+
+    void *block = e->alloc(NULL, 0, READER_ALLOC_SIZE, e->alloc_udata);
+    if (block == NULL) { return NULL; }
+    struct skiplist_epoch_reader *r = CACHE_ALIGN_PTR(block);
+    r->block = block;
+    r->state = 0;
+    r->nesting = 0;
+    r->in_use = 1;
+    r->e = e;
+    r->next = ATOMIC_LOAD(&e->readers);
+    while (!ATOMIC_CAS(&e->readers, &r->next, r)) {}
+    return r;
+}
+
+void skiplist_epoch_unregister(struct skiplist_epoch_reader *r) {
+    assert(r);
+    assert(r->nesting == 0);
+    ATOMIC_STORE(&r->in_use, 0);
+}
+
+void skiplist_epoch_enter(struct skiplist_epoch_reader *r) {
+    if (r->nesting++ > 0) { return; }
+    uint64_t g = ATOMIC_LOAD(&r->e->global);
+    __atomic_store_n(&r->state, (g << 1) | ACTIVE, __ATOMIC_SEQ_CST);
+    /* The state must be visible before any shared pointer is read. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void skiplist_epoch_exit(struct skiplist_epoch_reader *r) {
+    assert(r->nesting > 0);
+    if (--r->nesting > 0) { return; }
+    ATOMIC_STORE(&r->state, 0);
+}
+
+bool skiplist_epoch_retire(struct skiplist_epoch *e, void *p, size_t size,
+        skiplist_alloc_cb *alloc, void *udata) {
+    assert(e);
+    assert(alloc);
+    struct retired *r = e->alloc(NULL, 0, sizeof(*r), e->alloc_udata);
+    if (r == NULL) { return false; }
+    r->p = p;
+    r->size = size;
+    r->alloc = alloc;
+    r->udata = udata;
+
+    /* Retiring under an epoch that is already stale is safe: the
+     * list is freed two advances after *that* epoch at the
+     * earliest, and possibly three advances later. */
+    uint64_t g = ATOMIC_LOAD(&e->global);
+    struct retired **limbo = &e->limbo[g % 3];
+    r->next = ATOMIC_LOAD(limbo);
+    while (!ATOMIC_CAS(limbo, &r->next, r)) {}
+
+    if (ATOMIC_ADD(&e->retire_count, 1) % SKIPLIST_EPOCH_INTERVAL == 0) {
+        (void)skiplist_epoch_reclaim(e);
+    }
+    return true;
+}
+
+size_t skiplist_epoch_reclaim(struct skiplist_epoch *e) {
+    assert(e);
+    if (ATOMIC_XCHG(&e->reclaiming, 1)) { return 0; }
+
+    /* The epoch can only advance once every active reader has
+     * seen the current one. */
+    uint64_t g = ATOMIC_LOAD(&e->global);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (struct skiplist_epoch_reader *r = ATOMIC_LOAD(&e->readers);
+         r != NULL; r = r->next) {
+        uint64_t state = ATOMIC_LOAD(&r->state);
+        if ((state & ACTIVE) && (state >> 1) != g) {
+            ATOMIC_STORE(&e->reclaiming, 0);
+            return 0;
+        }
+    }
+
+    /* Now at epoch g + 1, nobody can see what was retired in g - 1. */
+    ATOMIC_STORE(&e->global, g + 1);
+    struct retired *safe = ATOMIC_XCHG(&e->limbo[(g + 2) % 3], NULL);
+    ATOMIC_STORE(&e->reclaiming, 0);
+    return free_retired(e, safe);
+}
+
+void skiplist_epoch_synchronize(struct skiplist_epoch *e) {
+    assert(e);
+    uint64_t target = ATOMIC_LOAD(&e->global) + 2;
+    while (ATOMIC_LOAD(&e->global) < target) {
+        (void)skiplist_epoch_reclaim(e);
+        if (ATOMIC_LOAD(&e->global) < target) { sched_yield(); }
+    }
+}
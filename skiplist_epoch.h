@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Epoch-based memory reclamation.
+ *
+ * Threads that read a skiplist without holding its lock register as
+ * readers, and wrap each operation in skiplist_epoch_enter/exit.
+ * Memory unlinked by a writer is retired rather than freed, and only
+ * handed back to its allocation callback once every reader that
+ * might still see it has left its critical section.
+ *
+ * Attach an epoch domain to a skiplist with skiplist_set_epoch (or
+ * skiplist_lf_set_epoch), and deleted nodes are retired through it.
+ * One domain can be shared by several skiplists.
+ *
+ * See Fraser, "Practical lock-freedom", section 5.2.3.
+ */
+
+#ifndef SKIPLIST_EPOCH_H
+#define SKIPLIST_EPOCH_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque epoch domain and per-thread reader types. */
+struct skiplist_epoch;
+struct skiplist_epoch_reader;
+
+/* Create a new epoch domain, returns NULL on error. ALLOC is used
+ * for reader and bookkeeping records, must be thread-safe, and
+ * can be NULL to use malloc & free. */
+struct skiplist_epoch *skiplist_epoch_new(skiplist_alloc_cb *alloc,
+    void *alloc_udata);
+
+/* Free the domain, first freeing everything still retired.
+ * No reader may be in a critical section. */
+void skiplist_epoch_free(struct skiplist_epoch *e);
+
+/* Get a reader record for the calling thread, returns NULL on error.
+ * Records are reused after skiplist_epoch_unregister. */
+struct skiplist_epoch_reader *skiplist_epoch_register(
+    struct skiplist_epoch *e);
+void skiplist_epoch_unregister(struct skiplist_epoch_reader *r);
+
+/* Enter and exit a read-side critical section. These only write to
+ * the reader's own record, and can be nested. */
+void skiplist_epoch_enter(struct skiplist_epoch_reader *r);
+void skiplist_epoch_exit(struct skiplist_epoch_reader *r);
+
+/* Retire P, which was allocated with ALLOC and is no longer reachable
+ * by new readers. It will be freed, as ALLOC(P, SIZE, 0, UDATA), once
+ * no reader can still see it. Returns false if the bookkeeping record
+ * could not be allocated, in which case the caller still owns P. */
+bool skiplist_epoch_retire(struct skiplist_epoch *e, void *p, size_t size,
+    skiplist_alloc_cb *alloc, void *udata);
+
+/* Try to advance the epoch and free whatever became safe to free.
+ * Retiring calls this periodically (every SKIPLIST_EPOCH_INTERVAL
+ * retirements), so it is rarely needed directly.
+ * Returns how many retired allocations were freed. */
+size_t skiplist_epoch_reclaim(struct skiplist_epoch *e);
+
+/* Wait until every critical section in progress has ended. Must not
+ * be called from within the calling thread's own critical section. */
+void skiplist_epoch_synchronize(struct skiplist_epoch *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist_fc.h"
+#include "skiplist_macros_internal.h"
+#include "skiplist_internal.h"
+
+/* Most requests the combiner sorts and runs at once. */
+#define COMBINE_BATCH 64
+
+enum fc_op {
+    FC_ADD,
+    FC_SET,
+    FC_GET,
+    FC_DELETE,
+    FC_POP_FIRST,
+};
+
+struct skiplist_fc_slot {
+    int pending;            /* set by the owner, cleared by the combiner */
+    int in_use;
+    enum fc_op op;
+    void *k;                /* request key, or popped key */
+    void *v;                /* request value, or result value */
+    bool res;
+    struct skiplist_fc *fc;
+    struct skiplist_fc_slot *next;
+    void *block;            /* as allocated, for freeing */
+} CACHE_ALIGNED;
+
+#define SLOT_ALLOC_SIZE CACHE_ALLOC_SIZE(sizeof(struct skiplist_fc_slot))
+
+struct skiplist_fc {
+    pthread_mutex_t lock;   /* held by the combiner */
+    struct skiplist *sl;
+    struct skiplist_fc_slot *slots;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+struct skiplist_fc *skiplist_fc_new(struct skiplist *sl,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (sl == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_fc *fc = alloc(NULL, 0, sizeof(*fc), alloc_udata);
+    if (fc) {
+        pthread_mutex_init(&fc->lock, NULL);
+        fc->sl = sl;
+        fc->slots = NULL;
+        fc->alloc = alloc;
+        fc->alloc_udata = alloc_udata;
+    }
+    return fc;
+}
+
+struct skiplist_fc_slot *skiplist_fc_register(struct skiplist_fc *fc) {
+    assert(fc);
+    /* Reuse a slot, if one is free. */
+    for (struct skiplist_fc_slot *s = ATOMIC_LOAD(&fc->slots);
+         s != NULL; s = s->next) {
+        int free_slot = 0;
+        if (ATOMIC_CAS(&s->in_use, &free_slot, 1)) { return s; }
+    }
+
+    void *block = fc->alloc(NULL, 0, SLOT_ALLOC_SIZE, fc->alloc_udata);
+    if (block == NULL) { return NULL; }
+    struct skiplist_fc_slot *s = CACHE_ALIGN_PTR(block);
+    s->block = block;
+    s->pending = 0;
+    s->in_use = 1;
+    s->fc = fc;
+    s->next = ATOMIC_LOAD(&fc->slots);
+    while (!ATOMIC_CAS(&fc->slots, &s->next, s)) {}
+    return s;
+}
+
+void skiplist_fc_unregister(struct skiplist_fc_slot *slot) {
+    assert(slot);
+    assert(slot->pending == 0);
+    ATOMIC_STORE(&slot->in_use, 0);
+}
+
+/* Run one request against the skiplist. Adds are handled in runs by
+ * run_batch instead. */
+static void run_one(struct skiplist *sl, struct skiplist_fc_slot *s) {
+    switch (s->op) {
+    case FC_SET:
+        s->res = skiplist_set(sl, s->k, s->v, &s->v);
+        break;
+    case FC_GET:
+        s->res = skiplist_get(sl, s->k, &s->v);
+        break;
+    case FC_DELETE:
+        s->res = skiplist_delete(sl, s->k, &s->v);
+        break;
+    case FC_POP_FIRST:
+        s->res = skiplist_pop_first(sl, &s->k, &s->v);
+        break;
+    case FC_ADD:
+        s->res = skiplist_add(sl, s->k, s->v);
+        break;
+    }
+}
+
+/* Does request A sort before B? Pops go first, the rest by key. */
+static bool before(skiplist_cmp_cb *cmp,
+        struct skiplist_fc_slot *a, struct skiplist_fc_slot *b) {
+    if (b->op == FC_POP_FIRST) { return false; }
+    if (a->op == FC_POP_FIRST) { return true; }
+    return cmp(a->k, b->k) < 0;
+}
+
+/* Sort a batch. Batches are small, so insertion sort is fine. */
+static void sort_batch(skiplist_cmp_cb *cmp,
+        struct skiplist_fc_slot **batch, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        struct skiplist_fc_slot *s = batch[i];
+        size_t j = i;
+        while (j > 0 && before(cmp, s, batch[j - 1])) {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+        batch[j] = s;
+    }
+}
+
+/* Run a sorted batch. Consecutive adds go through skiplist_add_sorted,
+ * so each continues from the previous one's search path. */
+static void run_batch(struct skiplist_fc *fc,
+        struct skiplist_fc_slot **batch, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (batch[i]->op != FC_ADD) {
+            run_one(fc->sl, batch[i]);
+            i++;
+            continue;
+        }
+        void *keys[COMBINE_BATCH], *values[COMBINE_BATCH];
+        size_t run = 0;
+        while (i + run < n && batch[i + run]->op == FC_ADD) {
+            keys[run] = batch[i + run]->k;
+            values[run] = batch[i + run]->v;
+            run++;
+        }
+        size_t added = skiplist_add_sorted(fc->sl, run, keys, values);
+        for (size_t j = 0; j < run; j++) {
+            batch[i + j]->res = j < added;
+        }
+        i += run;
+    }
+}
+
+/* As the combiner, run every pending request. */
+static void combine(struct skiplist_fc *fc) {
+    struct skiplist_fc_slot *batch[COMBINE_BATCH];
+    struct skiplist_fc_slot *s = ATOMIC_LOAD(&fc->slots);
+    while (s != NULL) {
+        size_t n = 0;
+        for (; s != NULL && n < COMBINE_BATCH; s = s->next) {
+            if (ATOMIC_LOAD(&s->pending)) { batch[n++] = s; }
+        }
+        sort_batch(fc->sl->cmp, batch, n);
+        run_batch(fc, batch, n);
+        for (size_t i = 0; i < n; i++) {
+            ATOMIC_STORE(&batch[i]->pending, 0);
+        }
+    }
+}
+
+/* Post the request in SLOT, and wait until some combiner (possibly
+ * this thread) has run it. */
+static void run(struct skiplist_fc_slot *slot) {
+    struct skiplist_fc *fc = slot->fc;
+    ATOMIC_STORE(&slot->pending, 1);
+    while (ATOMIC_LOAD(&slot->pending)) {
+        if (pthread_mutex_trylock(&fc->lock) == 0) {
+            combine(fc);
+            pthread_mutex_unlock(&fc->lock);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+bool skiplist_fc_add(struct skiplist_fc_slot *slot, void *key, void *value) {
+    assert(slot);
+    slot->op = FC_ADD;
+    slot->k = key;
+    slot->v = value;
+    run(slot);
+    return slot->res;
+}
+
+bool skiplist_fc_set(struct skiplist_fc_slot *slot,
+        void *key, void *value, void **old) {
+    assert(slot);
+    slot->op = FC_SET;
+    slot->k = key;
+    slot->v = value;
+    run(slot);
+    if (old) { *old = slot->v; }
+    return slot->res;
+}
+
+bool skiplist_fc_get(struct skiplist_fc_slot *slot, void *key, void **value) {
+    assert(slot);
+    slot->op = FC_GET;
+    slot->k = key;
+    run(slot);
+    if (slot->res && value) { *value = slot->v; }
+    return slot->res;
+}
+
+bool skiplist_fc_delete(struct skiplist_fc_slot *slot,
+        void *key, void **value) {
+    assert(slot);
+    slot->op = FC_DELETE;
+    slot->k = key;
+    run(slot);
+    if (slot->res && value) { *value = slot->v; }
+    return slot->res;
+}
+
+bool skiplist_fc_pop_first(struct skiplist_fc_slot *slot,
+        void **key, void **value) {
+    assert(slot);
+    slot->op = FC_POP_FIRST;
+    run(slot);
+    if (slot->res) {
+        if (key) { *key = slot->k; }
+        if (value) { *value = slot->v; }
+    }
+    return slot->res;
+}
+
+void skiplist_fc_free(struct skiplist_fc *fc) {
+    assert(fc);
+    struct skiplist_fc_slot *s = fc->slots;
+    while (s != NULL) {
+        struct skiplist_fc_slot *next = s->next;
+        assert(s->pending == 0);
+        fc->alloc(s->block, SLOT_ALLOC_SIZE, 0, fc->alloc_udata);
+        s = next;
+    }
+    pthread_mutex_destroy(&fc->lock);
+    fc->alloc(fc, sizeof(*fc), 0, fc->alloc_udata);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Flat-combining front end for a skiplist shared between threads.
+ *
+ * Rather than each thread taking a lock for its own operation, a
+ * thread posts its request in its publication slot and tries to take
+ * the lock. Whoever gets it (the combiner) runs every pending request
+ * in one pass, sorted by key so that consecutive adds share a search
+ * (see skiplist_add_sorted), while the other threads wait on their
+ * own slots. Under contention, this trades one lock handoff per
+ * operation for one per batch.
+ *
+ * See Hendler, Incze, Shavit & Tzafrir, "Flat Combining and the
+ * Synchronization-Parallelism Tradeoff".
+ */
+
+#ifndef SKIPLIST_FC_H
+#define SKIPLIST_FC_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque flat-combining wrapper and per-thread slot types. */
+struct skiplist_fc;
+struct skiplist_fc_slot;
+
+/* Wrap SL, returns NULL on error. From then on SL must only be used
+ * through the wrapper. ALLOC is used for the wrapper and its slots,
+ * must be thread-safe, and can be NULL to use malloc & free. */
+struct skiplist_fc *skiplist_fc_new(struct skiplist *sl,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Get a publication slot for the calling thread, returns NULL on
+ * error. Slots are reused after skiplist_fc_unregister. */
+struct skiplist_fc_slot *skiplist_fc_register(struct skiplist_fc *fc);
+void skiplist_fc_unregister(struct skiplist_fc_slot *slot);
+
+/* Same as the corresponding skiplist_* functions, run through the
+ * calling thread's slot. */
+bool skiplist_fc_add(struct skiplist_fc_slot *slot, void *key, void *value);
+bool skiplist_fc_set(struct skiplist_fc_slot *slot,
+    void *key, void *value, void **old);
+bool skiplist_fc_get(struct skiplist_fc_slot *slot, void *key, void **value);
+bool skiplist_fc_delete(struct skiplist_fc_slot *slot,
+    void *key, void **value);
+bool skiplist_fc_pop_first(struct skiplist_fc_slot *slot,
+    void **key, void **value);
+
+/* Free the wrapper and its slots, but not the skiplist.
+ * No thread may be using it. */
+void skiplist_fc_free(struct skiplist_fc *fc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+#include "skiplist_file.h"
+#include "skiplist_macros_internal.h"
+
+/* File layout: a header, then blocks allocated by bumping USED. Every
+ * block is a power of two in size, so a freed block goes on the free
+ * list for its size class and is reused as-is. Nodes refer to each
+ * other by offset from the start of the file, with 0 for the end of a
+ * level, so nothing depends on where the file is mapped. */
+#define MAGIC "skipfil1"
+
+#define PAD8(n) (((n) + 7) & ~(size_t)7)
+
+/* Size of a newly created file. */
+#define INITIAL_SIZE (64 * 1024)
+
+/* Smallest block size class (32 bytes). */
+#define MIN_CLASS 5
+#define CLASSES 64
+
+struct header {
+    char magic[8];
+    uint64_t size;              /* file size */
+    uint64_t used;              /* end of the allocated blocks */
+    uint64_t head;              /* offset of the head node */
+    uint64_t count;
+    uint64_t height;            /* levels currently in use */
+    uint64_t max_height;        /* head node's height */
+    uint64_t free[CLASSES];     /* free list per size class */
+};
+
+/* A node is followed by its key, then its value. A free block's first
+ * 8 bytes hold the offset of the next free block in its class. */
+struct node {
+    uint32_t klen;
+    uint32_t vlen;
+    uint8_t h;
+    uint8_t class;
+    uint8_t pad[6];
+    uint64_t next[];
+};
+
+struct skiplist_file {
+    int fd;
+    unsigned char *base;
+    size_t size;
+    skiplist_file_cmp_cb *cmp;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+#define HDR(F) ((struct header *)(F)->base)
+#define NODE(F, OFF) ((struct node *)((F)->base + (OFF)))
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+static int def_cmp(const void *a, size_t alen,
+        const void *b, size_t blen) {
+    int res = memcmp(a, b, alen < blen ? alen : blen);
+    if (res != 0) { return res; }
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+}
+
+static unsigned char *node_key(struct node *n) {
+    return (unsigned char *)&n->next[n->h];
+}
+
+static size_t node_size(uint8_t h, size_t klen, size_t vlen) {
+    return sizeof(struct node) + h * sizeof(uint64_t) + klen + vlen;
+}
+
+static uint8_t size_class(size_t size) {
+    uint8_t c = MIN_CLASS;
+    while (((size_t)1 << c) < size) { c++; }
+    return c;
+}
+
+/* Extend the file to at least NEED bytes and map it again. The header
+ * only records the new size once the new mapping is in place. */
+static bool grow(struct skiplist_file *f, size_t need) {
+    size_t size = f->size;
+    while (size < need) { size *= 2; }
+    if (ftruncate(f->fd, (off_t)size) == -1) { return false; }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, f->fd, 0);
+    if (base == MAP_FAILED) { return false; }
+    munmap(f->base, f->size);
+    f->base = base;
+    f->size = size;
+    HDR(f)->size = size;
+    return true;
+}
+
+/* Allocate a block of size class C. This may remap the file, so
+ * pointers into it must be recomputed afterward. Returns 0 on error. */
+static uint64_t block_alloc(struct skiplist_file *f, uint8_t c) {
+    struct header *hdr = HDR(f);
+    uint64_t off = hdr->free[c];
+    if (off != 0) {
+        memcpy(&hdr->free[c], f->base + off, sizeof(uint64_t));
+        return off;
+    }
+    uint64_t bsize = (uint64_t)1 << c;
+    if (hdr->used + bsize > f->size) {
+        if (!grow(f, hdr->used + bsize)) { return 0; }
+        hdr = HDR(f);
+    }
+    off = hdr->used;
+    hdr->used += bsize;
+    return off;
+}
+
+static void block_free(struct skiplist_file *f, uint64_t off, uint8_t c) {
+    struct header *hdr = HDR(f);
+    memcpy(f->base + off, &hdr->free[c], sizeof(uint64_t));
+    hdr->free[c] = off;
+}
+
+/* Initialize an empty file. */
+static bool format(struct skiplist_file *f) {
+    if (ftruncate(f->fd, INITIAL_SIZE) == -1) { return false; }
+    f->size = INITIAL_SIZE;
+    f->base = mmap(NULL, f->size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, f->fd, 0);
+    if (f->base == MAP_FAILED) { return false; }
+
+    struct header *hdr = HDR(f);
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->size = f->size;
+    hdr->used = PAD8(sizeof(*hdr));
+    hdr->height = 1;
+    hdr->max_height = SKIPLIST_MAX_HEIGHT;
+
+    uint8_t c = size_class(node_size(SKIPLIST_MAX_HEIGHT, 0, 0));
+    uint64_t head = block_alloc(f, c);
+    if (head == 0) { return false; }
+    hdr = HDR(f);
+    struct node *n = NODE(f, head);
+    memset(n, 0, node_size(SKIPLIST_MAX_HEIGHT, 0, 0));
+    n->h = SKIPLIST_MAX_HEIGHT;
+    n->class = c;
+    hdr->head = head;
+    /* Write the magic last, so a partly formatted file is rejected. */
+    memcpy(hdr->magic, MAGIC, sizeof(hdr->magic));
+    return true;
+}
+
+/* Check the header only; the nodes are trusted, so opening is O(1).
+ * The file may be longer than the header says: grow extends it before
+ * recording the new size, and can fail (or crash) in between. */
+static bool check_header(struct skiplist_file *f) {
+    if (f->size < sizeof(struct header)) { return false; }
+    struct header *hdr = HDR(f);
+    return memcmp(hdr->magic, MAGIC, sizeof(hdr->magic)) == 0
+        && hdr->size <= f->size
+        && hdr->used <= f->size
+        && hdr->max_height >= 1
+        && hdr->max_height <= SKIPLIST_MAX_HEIGHT
+        && hdr->height <= hdr->max_height
+        && hdr->head != 0
+        && hdr->head + node_size((uint8_t)hdr->max_height, 0, 0)
+            <= hdr->used;
+}
+
+struct skiplist_file *skiplist_file_open(const char *path,
+        skiplist_file_cmp_cb *cmp, skiplist_alloc_cb *alloc,
+        void *alloc_udata) {
+    if (path == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_file *f = alloc(NULL, 0, sizeof(*f), alloc_udata);
+    if (f == NULL) { return NULL; }
+    f->base = MAP_FAILED;
+    f->size = 0;
+    f->cmp = cmp ? cmp : def_cmp;
+    f->alloc = alloc;
+    f->alloc_udata = alloc_udata;
+
+    f->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (f->fd == -1) { goto fail; }
+    struct stat st;
+    if (fstat(f->fd, &st) == -1) { goto fail; }
+
+    if (st.st_size == 0) {
+        if (!format(f)) { goto fail; }
+    } else {
+        f->size = (size_t)st.st_size;
+        f->base = mmap(NULL, f->size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, f->fd, 0);
+        if (f->base == MAP_FAILED) { goto fail; }
+        if (!check_header(f)) { goto fail; }
+        posix_madvise(f->base, f->size, POSIX_MADV_RANDOM);
+    }
+    return f;
+
+fail:
+    if (f->base != MAP_FAILED) { munmap(f->base, f->size); }
+    if (f->fd != -1) { close(f->fd); }
+    alloc(f, sizeof(*f), 0, alloc_udata);
+    return NULL;
+}
+
+static int cmp_node(struct skiplist_file *f, uint64_t off,
+        const void *key, size_t klen) {
+    struct node *n = NODE(f, off);
+    return f->cmp(node_key(n), n->klen, key, klen);
+}
+
+/* Set PREVS to the offset of the last node before KEY on each level
+ * in use, and return the offset of the first node >= KEY, or 0. */
+static uint64_t find_prevs(struct skiplist_file *f,
+        const void *key, size_t klen, uint64_t *prevs) {
+    struct header *hdr = HDR(f);
+    uint64_t cur = hdr->head;
+    uint64_t next = 0;
+    for (int lvl = (int)hdr->height - 1; lvl >= 0; lvl--) {
+        for (;;) {
+            next = NODE(f, cur)->next[lvl];
+            if (next == 0 || cmp_node(f, next, key, klen) >= 0) { break; }
+            cur = next;
+        }
+        if (prevs) { prevs[lvl] = cur; }
+    }
+    return next;
+}
+
+static uint64_t find(struct skiplist_file *f,
+        const void *key, size_t klen) {
+    uint64_t off = find_prevs(f, key, klen, NULL);
+    if (off != 0 && cmp_node(f, off, key, klen) == 0) { return off; }
+    return 0;
+}
+
+static void unlink_node(struct skiplist_file *f,
+        uint64_t *prevs, uint64_t off) {
+    struct node *n = NODE(f, off);
+    for (uint8_t lvl = 0; lvl < n->h; lvl++) {
+        NODE(f, prevs[lvl])->next[lvl] = n->next[lvl];
+    }
+    HDR(f)->count--;
+    block_free(f, off, n->class);
+}
+
+bool skiplist_file_set(struct skiplist_file *f, const void *key,
+        size_t key_len, const void *value, size_t value_len) {
+    assert(f);
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) { return false; }
+    uint64_t prevs[SKIPLIST_MAX_HEIGHT];
+    uint64_t off = find_prevs(f, key, key_len, prevs);
+    uint64_t old = 0;
+    if (off != 0 && cmp_node(f, off, key, key_len) == 0) {
+        struct node *n = NODE(f, off);
+        if (node_size(n->h, key_len, value_len)
+            <= ((size_t)1 << n->class)) {
+            /* The new value fits in the existing block. */
+            memcpy(node_key(n) + key_len, value, value_len);
+            n->vlen = (uint32_t)value_len;
+            return true;
+        }
+        old = off;
+    }
+
+    struct header *hdr = HDR(f);
+    uint8_t h = SKIPLIST_GEN_HEIGHT();
+    if (h > hdr->max_height) { h = (uint8_t)hdr->max_height; }
+    uint8_t c = size_class(node_size(h, key_len, value_len));
+    uint64_t noff = block_alloc(f, c);
+    if (noff == 0) { return false; }
+    hdr = HDR(f);
+    /* Drop the old record only now, so failing to grow the file
+     * leaves the key as it was. */
+    if (old != 0) { unlink_node(f, prevs, old); }
+
+    while (hdr->height < h) {
+        prevs[hdr->height] = hdr->head;
+        hdr->height++;
+    }
+
+    struct node *n = NODE(f, noff);
+    n->klen = (uint32_t)key_len;
+    n->vlen = (uint32_t)value_len;
+    n->h = h;
+    n->class = c;
+    memset(n->pad, 0, sizeof(n->pad));
+    memcpy(node_key(n), key, key_len);
+    memcpy(node_key(n) + key_len, value, value_len);
+    for (uint8_t lvl = 0; lvl < h; lvl++) {
+        struct node *prev = NODE(f, prevs[lvl]);
+        n->next[lvl] = prev->next[lvl];
+        prev->next[lvl] = noff;
+    }
+    hdr->count++;
+    return true;
+}
+
+bool skiplist_file_get(struct skiplist_file *f, const void *key,
+        size_t key_len, const void **value, size_t *value_len) {
+    assert(f);
+    uint64_t off = find(f, key, key_len);
+    if (off == 0) { return false; }
+    struct node *n = NODE(f, off);
+    if (value) { *value = node_key(n) + n->klen; }
+    if (value_len) { *value_len = n->vlen; }
+    return true;
+}
+
+bool skiplist_file_delete(struct skiplist_file *f, const void *key,
+        size_t key_len) {
+    assert(f);
+    uint64_t prevs[SKIPLIST_MAX_HEIGHT];
+    uint64_t off = find_prevs(f, key, key_len, prevs);
+    if (off == 0 || cmp_node(f, off, key, key_len) != 0) { return false; }
+    unlink_node(f, prevs, off);
+    return true;
+}
+
+size_t skiplist_file_count(struct skiplist_file *f) {
+    assert(f);
+    return (size_t)HDR(f)->count;
+}
+
+void skiplist_file_iter(struct skiplist_file *f,
+        skiplist_file_iter_cb *cb, void *udata) {
+    assert(f);
+    assert(cb);
+    uint64_t off = NODE(f, HDR(f)->head)->next[0];
+    while (off != 0) {
+        struct node *n = NODE(f, off);
+        unsigned char *k = node_key(n);
+        if (cb(k, n->klen, k + n->klen, n->vlen, udata)
+            == SKIPLIST_ITER_HALT) {
+            break;
+        }
+        off = n->next[0];
+    }
+}
+
+bool skiplist_file_sync(struct skiplist_file *f) {
+    assert(f);
+    return msync(f->base, f->size, MS_SYNC) == 0;
+}
+
+void skiplist_file_close(struct skiplist_file *f) {
+    assert(f);
+    munmap(f->base, f->size);
+    close(f->fd);
+    f->alloc(f, sizeof(*f), 0, f->alloc_udata);
+}
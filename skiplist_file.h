@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A skiplist that lives entirely inside a memory-mapped file.
+ *
+ * The header, nodes, keys and values are all allocated from the file,
+ * and nodes link to each other by offset rather than by pointer, so
+ * the file can be mapped at any address. Opening an existing file only
+ * maps it: nothing is rebuilt, and pages are read in as searches touch
+ * them. The file grows (and is remapped) as needed, and blocks freed
+ * by deletes are reused.
+ *
+ * Keys and values are byte strings, copied into the file. Keys are
+ * unique. Changes reach the file whenever the kernel writes back the
+ * pages, or at once with skiplist_file_sync; there is no journal, so a
+ * crash between syncs can leave the file inconsistent. Not
+ * thread-safe.
+ */
+
+#ifndef SKIPLIST_FILE_H
+#define SKIPLIST_FILE_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque file-backed skiplist type. */
+struct skiplist_file;
+
+/* Comparison callback for byte string keys, with the same results as
+ * skiplist_cmp_cb. */
+typedef int skiplist_file_cmp_cb(const void *key_a, size_t len_a,
+    const void *key_b, size_t len_b);
+
+/* Open the skiplist in the file at PATH, creating it if it doesn't
+ * exist. CMP can be NULL, to compare keys with memcmp (then shorter
+ * first); otherwise it must agree with whatever built the file. ALLOC
+ * is used for the handle only, and can be NULL to use malloc & free.
+ * Returns NULL on error, or if the file isn't a skiplist_file. */
+struct skiplist_file *skiplist_file_open(const char *path,
+    skiplist_file_cmp_cb *cmp, skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Set KEY's value, adding KEY if it isn't present.
+ * Returns false if the file could not be grown. */
+bool skiplist_file_set(struct skiplist_file *f, const void *key,
+    size_t key_len, const void *value, size_t value_len);
+
+/* Get KEY's value. If found, *VALUE and *VALUE_LEN (if non-NULL) are
+ * set to point to it inside the mapping, which stays valid until the
+ * next set or delete. Returns whether KEY was found. */
+bool skiplist_file_get(struct skiplist_file *f, const void *key,
+    size_t key_len, const void **value, size_t *value_len);
+
+/* Delete KEY. Returns whether it was found. */
+bool skiplist_file_delete(struct skiplist_file *f, const void *key,
+    size_t key_len);
+
+/* How many pairs are in the file? */
+size_t skiplist_file_count(struct skiplist_file *f);
+
+/* Callback for skiplist_file_iter, as with skiplist_iter_cb. The
+ * pointers are into the mapping, and the callback must not modify
+ * the skiplist. */
+typedef enum skiplist_iter_res
+skiplist_file_iter_cb(const void *key, size_t key_len,
+    const void *value, size_t value_len, void *udata);
+
+/* Iterate over the pairs in key order. */
+void skiplist_file_iter(struct skiplist_file *f,
+    skiplist_file_iter_cb *cb, void *udata);
+
+/* Flush all changes to disk (msync). Returns false on error. */
+bool skiplist_file_sync(struct skiplist_file *f);
+
+/* Unmap and close the file. Changes not yet synced are still written
+ * back by the kernel eventually. */
+void skiplist_file_close(struct skiplist_file *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist_ingest.h"
+#include "skiplist_macros_internal.h"
+#include "skiplist_internal.h"
+
+/* How many pairs to hand to skiplist_add_sorted at a time. */
+#define DRAIN_CHUNK 256
+
+struct pending {
+    struct pending *next;
+    void *k;
+    void *v;
+};
+
+struct skiplist_ingest {
+    struct pending *queue;  /* lock-free stack, newest first */
+    struct skiplist *sl;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+struct skiplist_ingest *skiplist_ingest_new(struct skiplist *sl,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (sl == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_ingest *in = alloc(NULL, 0, sizeof(*in), alloc_udata);
+    if (in) {
+        in->queue = NULL;
+        in->sl = sl;
+        in->alloc = alloc;
+        in->alloc_udata = alloc_udata;
+    }
+    return in;
+}
+
+/* Push the chain from FIRST to LAST onto the queue. */
+static void push_chain(struct skiplist_ingest *in,
+        struct pending *first, struct pending *last) {
+    struct pending *head = ATOMIC_LOAD(&in->queue);
+    do {
+        last->next = head;
+    } while (!ATOMIC_CAS(&in->queue, &head, first));
+}
+
+bool skiplist_ingest_add(struct skiplist_ingest *in, void *key, void *value) {
+    assert(in);
+    struct pending *p = in->alloc(NULL, 0, sizeof(*p), in->alloc_udata);
+    if (p == NULL) { return false; }
+    p->k = key;
+    p->v = value;
+    push_chain(in, p, p);
+    return true;
+}
+
+static struct pending *reverse(struct pending *p) {
+    struct pending *res = NULL;
+    while (p != NULL) {
+        struct pending *next = p->next;
+        p->next = res;
+        res = p;
+        p = next;
+    }
+    return res;
+}
+
+/* Stable merge sort of a pending list. */
+static struct pending *sort(skiplist_cmp_cb *cmp, struct pending *p) {
+    if (p == NULL || p->next == NULL) { return p; }
+
+    struct pending *slow = p, *fast = p->next;
+    while (fast != NULL && fast->next != NULL) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    struct pending *b = slow->next;
+    slow->next = NULL;
+    struct pending *a = sort(cmp, p);
+    b = sort(cmp, b);
+
+    struct pending *res = NULL, **tail = &res;
+    while (a != NULL && b != NULL) {
+        if (cmp(a->k, b->k) <= 0) {
+            *tail = a;
+            a = a->next;
+        } else {
+            *tail = b;
+            b = b->next;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = a != NULL ? a : b;
+    return res;
+}
+
+size_t skiplist_ingest_drain(struct skiplist_ingest *in) {
+    assert(in);
+    struct pending *batch = ATOMIC_XCHG(&in->queue, NULL);
+    batch = sort(in->sl->cmp, reverse(batch));
+
+    void *keys[DRAIN_CHUNK];
+    void *values[DRAIN_CHUNK];
+    size_t added = 0;
+    while (batch != NULL) {
+        size_t n = 0;
+        for (struct pending *p = batch; p != NULL && n < DRAIN_CHUNK;
+             p = p->next) {
+            keys[n] = p->k;
+            values[n] = p->v;
+            n++;
+        }
+
+        size_t done = skiplist_add_sorted(in->sl, n, keys, values);
+        added += done;
+        for (size_t i = 0; i < done; i++) {
+            struct pending *next = batch->next;
+            in->alloc(batch, sizeof(*batch), 0, in->alloc_udata);
+            batch = next;
+        }
+
+        if (done < n) {
+            /* Requeue the rest, newest first, as if never taken. */
+            struct pending *last = batch;
+            batch = reverse(batch);
+            push_chain(in, batch, last);
+            break;
+        }
+    }
+    return added;
+}
+
+size_t skiplist_ingest_free(struct skiplist_ingest *in,
+        skiplist_free_cb *cb, void *udata) {
+    assert(in);
+    size_t ct = 0;
+    struct pending *p = in->queue;
+    while (p != NULL) {
+        struct pending *next = p->next;
+        if (cb) { cb(p->k, p->v, udata); }
+        in->alloc(p, sizeof(*p), 0, in->alloc_udata);
+        p = next;
+        ct++;
+    }
+    in->alloc(in, sizeof(*in), 0, in->alloc_udata);
+    return ct;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Multi-producer insert buffer for a single-owner skiplist.
+ *
+ * Any number of producer threads queue pairs with skiplist_ingest_add,
+ * which never takes a lock: it pushes onto a lock-free stack. The
+ * thread that owns the skiplist periodically calls
+ * skiplist_ingest_drain, which takes everything queued so far, sorts
+ * it, and adds it with skiplist_add_sorted.
+ *
+ * The skiplist itself is only ever modified by the owner, so the
+ * owner's lookups (and, with SKIPLIST_SWMR, other threads' lookups)
+ * always see a consistent list. Queued pairs are not visible until
+ * they have been drained.
+ */
+
+#ifndef SKIPLIST_INGEST_H
+#define SKIPLIST_INGEST_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque insert buffer type. */
+struct skiplist_ingest;
+
+/* Create an insert buffer feeding SL, returns NULL on error. Each
+ * batch is sorted with SL's comparison callback. ALLOC is used for
+ * queued entries, must be thread-safe, and can be NULL to use malloc
+ * & free. */
+struct skiplist_ingest *skiplist_ingest_new(struct skiplist *sl,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Queue a key/value pair to be added. Lock-free, and safe to call
+ * from any thread. Returns false on alloc failure. */
+bool skiplist_ingest_add(struct skiplist_ingest *in, void *key, void *value);
+
+/* Add everything queued so far to the skiplist, in arrival order for
+ * equal keys. Only the skiplist's owner may call this. Returns how
+ * many pairs were added; if adding fails partway (alloc failure), the
+ * rest stay queued for the next drain. */
+size_t skiplist_ingest_drain(struct skiplist_ingest *in);
+
+/* Free the insert buffer, calling CB (if non-NULL) on every pair that
+ * is still queued. It does not drain first, and does not free the
+ * skiplist. No producer may be using it.
+ * Returns how many queued pairs were discarded. */
+size_t skiplist_ingest_free(struct skiplist_ingest *in,
+    skiplist_free_cb *cb, void *udata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SKIPLIST_INTERNAL_H
+#define SKIPLIST_INTERNAL_H
+
+/* Node and list layout, shared by skiplist.c and the modules that
+ * build or walk a struct skiplist directly. Not installed. */
+
+#if SKIPLIST_LATENCY
+/* Latency histogram for one operation type, in nanoseconds. */
+struct latency_hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+#endif
+
+struct skiplist {
+    size_t count;
+    struct skiplist_node *head;
+    skiplist_cmp_cb *cmp;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+    struct skiplist_epoch *epoch;   /* if non-NULL, retire nodes */
+    bool frozen;                    /* read-only, see skiplist_freeze */
+    uint64_t gen;                   /* bumped whenever a node is freed */
+#if SKIPLIST_SNAPSHOTS
+    uint64_t version;               /* of the latest write */
+    bool history;                   /* kept anything for snapshots? */
+    struct skiplist_snapshot *snapshots;    /* newest first */
+    struct skiplist_deferred *deferred;     /* held back free calls */
+#endif
+#if SKIPLIST_SWMR
+    uint64_t seq;                   /* odd while writing */
+#endif
+#if SKIPLIST_STATS
+    struct skiplist_stats stats;
+#endif
+#if SKIPLIST_LATENCY
+    struct latency_hist latency[SKIPLIST_OP_TYPE_COUNT];
+#endif
+};
+
+#if SKIPLIST_STATS && SKIPLIST_MAX_HEIGHT > SKIPLIST_STATS_LEVELS
+#error "SKIPLIST_MAX_HEIGHT is too large for SKIPLIST_STATS_LEVELS"
+#endif
+
+#if SKIPLIST_SNAPSHOTS
+/* A node's version chain, newest first. Once a node has one, its
+ * first entry is always the node's current value. */
+struct skiplist_value {
+    void *v;
+    uint64_t from;          /* version when set */
+    struct skiplist_value *older;
+};
+#endif
+
+struct skiplist_node {
+    int h;                  /* node height */
+    void *k;                /* key */
+    void *v;                /* value */
+#if SKIPLIST_SNAPSHOTS
+    uint64_t born;          /* version when added */
+    uint64_t died;          /* version when deleted, or NODE_ALIVE */
+    struct skiplist_value *vals;    /* older values, if any */
+#endif
+#if SKIPLIST_ADAPTIVE
+    uint32_t hits;          /* gets since last promoted */
+#endif
+
+    /* Forward pointers.
+     * allocated with (h)*sizeof(N*) extra bytes. */
+    struct skiplist_node *next[];
+};
+
+/* Sentinel. */
+extern struct skiplist_node skiplist_sentinel;
+#define SENTINEL skiplist_sentinel
+#define IS_SENTINEL(n) (n == &SENTINEL)
+
+/* Is the node still in the list, rather than kept for a snapshot? */
+#if SKIPLIST_SNAPSHOTS
+#define NODE_ALIVE UINT64_MAX
+#define IS_LIVE(n) ((n)->died == NODE_ALIVE)
+#else
+#define IS_LIVE(n) true
+#endif
+
+/* Allocate a node. The forward pointers are initialized to &SENTINEL.
+ * Returns NULL on failure. */
+struct skiplist_node *skiplist_node_alloc(struct skiplist *sl,
+    uint8_t height, void *key, void *value);
+
+/* Free a node, or retire it if the skiplist has an epoch domain. */
+void skiplist_node_free(struct skiplist *sl, struct skiplist_node *n);
+
+#endif
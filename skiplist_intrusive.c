@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist_intrusive.h"
+#include "skiplist_macros_internal.h"
+
+struct skiplist_intrusive {
+    struct skiplist_link *head; /* SKIPLIST_MAX_HEIGHT tall, no object */
+    int height;                 /* tallest link ever inserted */
+    size_t count;
+    size_t link_offset;
+    size_t key_offset;
+    skiplist_cmp_cb *cmp;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+/* Get from an object to its link, and back. */
+static struct skiplist_link *link_of(struct skiplist_intrusive *sl,
+        void *obj) {
+    return (struct skiplist_link *)((char *)obj + sl->link_offset);
+}
+
+static void *obj_of(struct skiplist_intrusive *sl,
+        struct skiplist_link *l) {
+    return l ? (char *)l - sl->link_offset : NULL;
+}
+
+static void *key_of(struct skiplist_intrusive *sl, struct skiplist_link *l) {
+    return (char *)l - sl->link_offset + sl->key_offset;
+}
+
+void skiplist_link_init(struct skiplist_link *link, uint8_t height) {
+    assert(link);
+    assert(height > 0);
+    assert(height <= SKIPLIST_MAX_HEIGHT);
+    link->h = height;
+    DO(height, link->next[i] = NULL);
+}
+
+struct skiplist_intrusive *skiplist_intrusive_new(size_t link_offset,
+        size_t key_offset, skiplist_cmp_cb *cmp,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (cmp == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+
+    struct skiplist_intrusive *sl = alloc(NULL, 0, sizeof(*sl), alloc_udata);
+    if (sl == NULL) { return NULL; }
+    struct skiplist_link *head = alloc(NULL, 0,
+        sizeof(*head) + SKIPLIST_TOWER_SIZE(SKIPLIST_MAX_HEIGHT),
+        alloc_udata);
+    if (head == NULL) {
+        alloc(sl, sizeof(*sl), 0, alloc_udata);
+        return NULL;
+    }
+    skiplist_link_init(head, SKIPLIST_MAX_HEIGHT);
+    sl->head = head;
+    sl->height = 1;
+    sl->count = 0;
+    sl->link_offset = link_offset;
+    sl->key_offset = key_offset;
+    sl->cmp = cmp;
+    sl->alloc = alloc;
+    sl->alloc_udata = alloc_udata;
+    return sl;
+}
+
+/* Get the last link before KEY at each level below the current height.
+ * Returns the first link >= KEY, or NULL. */
+static struct skiplist_link *find_prevs(struct skiplist_intrusive *sl,
+        void *key, struct skiplist_link **prevs) {
+    struct skiplist_link *cur = sl->head, *next = NULL;
+    for (int lvl = sl->height - 1; lvl >= 0; lvl--) {
+        for (;;) {
+            next = cur->next[lvl];
+            if (next == NULL) { break; }
+            PREFETCH(next->next[0]);
+            if (sl->cmp(key_of(sl, next), key) >= 0) { break; }
+            cur = next;
+        }
+        prevs[lvl] = cur;
+    }
+    return next;
+}
+
+void skiplist_intrusive_insert(struct skiplist_intrusive *sl, void *obj) {
+    assert(sl);
+    assert(obj);
+    struct skiplist_link *l = link_of(sl, obj);
+    assert(l->h > 0 && l->h <= SKIPLIST_MAX_HEIGHT);
+    struct skiplist_link *prevs[SKIPLIST_MAX_HEIGHT];
+    (void)find_prevs(sl, key_of(sl, l), prevs);
+    for (int i = sl->height; i < l->h; i++) { prevs[i] = sl->head; }
+    if (l->h > sl->height) { sl->height = l->h; }
+    for (int i = 0; i < l->h; i++) {
+        l->next[i] = prevs[i]->next[i];
+        prevs[i]->next[i] = l;
+    }
+    sl->count++;
+}
+
+void *skiplist_intrusive_find(struct skiplist_intrusive *sl, void *key) {
+    assert(sl);
+    struct skiplist_link *prevs[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_link *l = find_prevs(sl, key, prevs);
+    if (l == NULL || sl->cmp(key_of(sl, l), key) != 0) { return NULL; }
+    return obj_of(sl, l);
+}
+
+void *skiplist_intrusive_find_ge(struct skiplist_intrusive *sl, void *key) {
+    assert(sl);
+    struct skiplist_link *prevs[SKIPLIST_MAX_HEIGHT];
+    return obj_of(sl, find_prevs(sl, key, prevs));
+}
+
+/* Unlink L, which comes right after PREVS on each of its levels. */
+static void unlink_after(struct skiplist_intrusive *sl,
+        struct skiplist_link **prevs, struct skiplist_link *l) {
+    for (int i = 0; i < l->h; i++) {
+        assert(prevs[i]->next[i] == l);
+        prevs[i]->next[i] = l->next[i];
+        l->next[i] = NULL;
+    }
+    sl->count--;
+}
+
+bool skiplist_intrusive_remove(struct skiplist_intrusive *sl, void *obj) {
+    assert(sl);
+    assert(obj);
+    struct skiplist_link *l = link_of(sl, obj);
+    void *key = key_of(sl, l);
+    struct skiplist_link *prevs[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_link *cur = find_prevs(sl, key, prevs);
+
+    /* Step over any other objects with an equal key. Each is the next
+     * link after PREVS on each of its own levels. */
+    while (cur != NULL && cur != l) {
+        if (sl->cmp(key_of(sl, cur), key) != 0) { return false; }
+        DO(cur->h, prevs[i] = cur);
+        cur = cur->next[0];
+    }
+    if (cur == NULL) { return false; }
+    unlink_after(sl, prevs, l);
+    return true;
+}
+
+void *skiplist_intrusive_remove_key(struct skiplist_intrusive *sl,
+        void *key) {
+    assert(sl);
+    struct skiplist_link *prevs[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_link *l = find_prevs(sl, key, prevs);
+    if (l == NULL || sl->cmp(key_of(sl, l), key) != 0) { return NULL; }
+    unlink_after(sl, prevs, l);
+    return obj_of(sl, l);
+}
+
+void *skiplist_intrusive_first(struct skiplist_intrusive *sl) {
+    assert(sl);
+    return obj_of(sl, sl->head->next[0]);
+}
+
+void *skiplist_intrusive_next(struct skiplist_intrusive *sl, void *obj) {
+    assert(sl);
+    assert(obj);
+    return obj_of(sl, link_of(sl, obj)->next[0]);
+}
+
+void *skiplist_intrusive_pop_first(struct skiplist_intrusive *sl) {
+    assert(sl);
+    struct skiplist_link *l = sl->head->next[0];
+    if (l == NULL) { return NULL; }
+    struct skiplist_link *prevs[SKIPLIST_MAX_HEIGHT];
+    DO(l->h, prevs[i] = sl->head);
+    unlink_after(sl, prevs, l);
+    return obj_of(sl, l);
+}
+
+size_t skiplist_intrusive_count(struct skiplist_intrusive *sl) {
+    assert(sl);
+    return sl->count;
+}
+
+void skiplist_intrusive_free(struct skiplist_intrusive *sl) {
+    assert(sl);
+    sl->alloc(sl->head,
+        sizeof(*sl->head) + SKIPLIST_TOWER_SIZE(SKIPLIST_MAX_HEIGHT),
+        0, sl->alloc_udata);
+    sl->alloc(sl, sizeof(*sl), 0, sl->alloc_udata);
+}
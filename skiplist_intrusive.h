@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Intrusive skiplist.
+ *
+ * Rather than the skiplist allocating a node for each pair, the caller
+ * embeds a struct skiplist_link in its own objects, and the skiplist
+ * links those together. Inserting and removing never allocate, and a
+ * lookup lands directly on the object, with no pointer from a node to
+ * follow.
+ *
+ * The link's tower is a flexible array, so the link goes at the end of
+ * the object, and the object is allocated with room for the tower:
+ *
+ *     struct item {
+ *         long key;
+ *         ...
+ *         struct skiplist_link link;     (must be last)
+ *     };
+ *
+ *     uint8_t h = SKIPLIST_GEN_HEIGHT();
+ *     struct item *it = malloc(sizeof(*it) + SKIPLIST_TOWER_SIZE(h));
+ *     skiplist_link_init(&it->link, h);
+ *
+ * (Strict ISO C does not allow a struct with a flexible array member
+ * inside another struct, though GCC and Clang do. Otherwise, put the
+ * link right after the object, at a suitably aligned offset.)
+ *
+ * The skiplist finds the object from its link, and the key within the
+ * object, by the byte offsets given to skiplist_intrusive_new. The
+ * comparison callback is called with the addresses of two keys, so
+ * keys can be of any type. Keys passed to skiplist_intrusive_find etc.
+ * are also addresses of keys. As with skiplist.h, equal keys are kept.
+ *
+ * An object can only be in one intrusive skiplist at a time per link,
+ * and the skiplist never frees objects; that is up to the caller.
+ */
+
+#ifndef SKIPLIST_INTRUSIVE_H
+#define SKIPLIST_INTRUSIVE_H
+
+#include <stddef.h>
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A link embedded in a user object. */
+struct skiplist_link {
+    uint8_t h;                          /* tower height */
+    struct skiplist_link *next[];       /* tower, H levels */
+};
+
+/* Bytes needed for a tower of height H, beyond sizeof(the object). */
+#define SKIPLIST_TOWER_SIZE(H) ((size_t)(H) * sizeof(struct skiplist_link *))
+
+/* Set up LINK, with room for a tower of HEIGHT, which must be between
+ * 1 and SKIPLIST_MAX_HEIGHT (see SKIPLIST_GEN_HEIGHT). */
+void skiplist_link_init(struct skiplist_link *link, uint8_t height);
+
+/* Opaque intrusive skiplist type. */
+struct skiplist_intrusive;
+
+/* Create a new intrusive skiplist, returns NULL on error.
+ * LINK_OFFSET and KEY_OFFSET are the offsets of the link and the key
+ * within the objects, e.g. offsetof(struct item, link). CMP is called
+ * with the keys' addresses. ALLOC is only used for the skiplist
+ * itself, and can be NULL to use malloc & free. */
+struct skiplist_intrusive *skiplist_intrusive_new(size_t link_offset,
+    size_t key_offset, skiplist_cmp_cb *cmp,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Link OBJ in, before any other objects with an equal key.
+ * OBJ's link must have been set up with skiplist_link_init. */
+void skiplist_intrusive_insert(struct skiplist_intrusive *sl, void *obj);
+
+/* Get the first object with KEY, or NULL. */
+void *skiplist_intrusive_find(struct skiplist_intrusive *sl, void *key);
+
+/* Get the first object with a key >= KEY, or NULL. */
+void *skiplist_intrusive_find_ge(struct skiplist_intrusive *sl, void *key);
+
+/* Unlink OBJ, returns whether it was in the skiplist. */
+bool skiplist_intrusive_remove(struct skiplist_intrusive *sl, void *obj);
+
+/* Unlink and return the first object with KEY, or NULL. */
+void *skiplist_intrusive_remove_key(struct skiplist_intrusive *sl,
+    void *key);
+
+/* Get the first object, or the one after OBJ, or NULL at the end. */
+void *skiplist_intrusive_first(struct skiplist_intrusive *sl);
+void *skiplist_intrusive_next(struct skiplist_intrusive *sl, void *obj);
+
+/* Unlink and return the first object, or NULL if empty. */
+void *skiplist_intrusive_pop_first(struct skiplist_intrusive *sl);
+
+/* How many objects are in the skiplist? */
+size_t skiplist_intrusive_count(struct skiplist_intrusive *sl);
+
+/* Free the skiplist. Any objects still in it are left as they are. */
+void skiplist_intrusive_free(struct skiplist_intrusive *sl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
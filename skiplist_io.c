@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+#include "skiplist_io.h"
+#include "skiplist_macros_internal.h"
+#include "skiplist_internal.h"
+
+/* File layout: a header, then COUNT records in key order. Each record
+ * is a struct record, then the key and the value, each padded to a
+ * multiple of 8 bytes so they can be used in place. */
+#define MAGIC "skiplst1"
+
+struct header {
+    char magic[8];
+    uint64_t count;
+};
+
+struct record {
+    uint32_t klen;
+    uint32_t vlen;
+};
+
+#define PAD8(n) (((n) + 7) & ~(size_t)7)
+
+/* Size of the output buffer used by skiplist_save. */
+#define WRITE_BUF (64 * 1024)
+
+struct skiplist_mmap {
+    struct skiplist *sl;
+    void *base;
+    size_t size;
+};
+
+static size_t codec_size(const struct skiplist_codec *c, void *x) {
+    return c ? c->size(x, c->udata) : sizeof(x);
+}
+
+static void codec_encode(const struct skiplist_codec *c,
+        void *x, void *buf) {
+    if (c) {
+        c->encode(x, buf, c->udata);
+    } else {
+        memcpy(buf, &x, sizeof(x));
+    }
+}
+
+struct writer {
+    int fd;
+    bool ok;
+    size_t used;
+    unsigned char *buf;
+    const struct skiplist_codec *kc;
+    const struct skiplist_codec *vc;
+    struct skiplist *sl;
+};
+
+static bool write_all(int fd, const unsigned char *p, size_t len) {
+    while (len > 0) {
+        ssize_t res = write(fd, p, len);
+        if (res < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += res;
+        len -= (size_t)res;
+    }
+    return true;
+}
+
+static void flush(struct writer *w) {
+    if (w->ok && w->used > 0) { w->ok = write_all(w->fd, w->buf, w->used); }
+    w->used = 0;
+}
+
+/* Get room for LEN bytes in the output buffer, or NULL if it is larger
+ * than the whole buffer. */
+static unsigned char *reserve(struct writer *w, size_t len) {
+    if (len > WRITE_BUF) { return NULL; }
+    if (w->used + len > WRITE_BUF) { flush(w); }
+    unsigned char *p = w->buf + w->used;
+    w->used += len;
+    return p;
+}
+
+/* Encode X, padded to 8 bytes, into the output. */
+static void put(struct writer *w, const struct skiplist_codec *c,
+        void *x, size_t len) {
+    size_t padded = PAD8(len);
+    unsigned char *p = reserve(w, padded);
+    if (p != NULL) {
+        codec_encode(c, x, p);
+        memset(p + len, 0, padded - len);
+        return;
+    }
+
+    /* Too large to buffer: encode it separately. */
+    flush(w);
+    p = w->sl->alloc(NULL, 0, padded, w->sl->alloc_udata);
+    if (p == NULL) {
+        w->ok = false;
+        return;
+    }
+    codec_encode(c, x, p);
+    memset(p + len, 0, padded - len);
+    if (w->ok) { w->ok = write_all(w->fd, p, padded); }
+    w->sl->alloc(p, padded, 0, w->sl->alloc_udata);
+}
+
+static enum skiplist_iter_res save_cb(void *key, void *value, void *udata) {
+    struct writer *w = (struct writer *) udata;
+    struct record r;
+    size_t klen = codec_size(w->kc, key);
+    size_t vlen = codec_size(w->vc, value);
+    if (klen > UINT32_MAX || vlen > UINT32_MAX) { w->ok = false; }
+    if (!w->ok) { return SKIPLIST_ITER_HALT; }
+    r.klen = (uint32_t)klen;
+    r.vlen = (uint32_t)vlen;
+    memcpy(reserve(w, sizeof(r)), &r, sizeof(r));
+    put(w, w->kc, key, klen);
+    put(w, w->vc, value, vlen);
+    return w->ok ? SKIPLIST_ITER_CONTINUE : SKIPLIST_ITER_HALT;
+}
+
+bool skiplist_save(struct skiplist *sl, int fd,
+        const struct skiplist_codec *key_codec,
+        const struct skiplist_codec *value_codec) {
+    assert(sl);
+    struct writer w;
+    w.fd = fd;
+    w.ok = true;
+    w.used = 0;
+    w.kc = key_codec;
+    w.vc = value_codec;
+    w.sl = sl;
+    w.buf = sl->alloc(NULL, 0, WRITE_BUF, sl->alloc_udata);
+    if (w.buf == NULL) { return false; }
+
+    struct header h;
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.count = skiplist_count(sl);
+    memcpy(reserve(&w, sizeof(h)), &h, sizeof(h));
+    skiplist_iter(sl, save_cb, &w);
+    flush(&w);
+
+    sl->alloc(w.buf, WRITE_BUF, 0, sl->alloc_udata);
+    return w.ok;
+}
+
+static void *codec_decode(const struct skiplist_codec *c,
+        const unsigned char *buf, size_t len) {
+    if (c) { return c->decode(buf, len, c->udata); }
+    void *x;
+    memcpy(&x, buf, sizeof(x));
+    return x;
+}
+
+/* Build SL's nodes from the mapped records, in order, linking each
+ * level's chain as it goes, then put a head of the right height in
+ * front. Returns false if the records are malformed or out of order,
+ * or on alloc failure, after calling CB on the pairs decoded. */
+static bool build(struct skiplist *sl, const unsigned char *p,
+        const unsigned char *end, const struct skiplist_codec *kc,
+        const struct skiplist_codec *vc, skiplist_free_cb *cb,
+        void *udata) {
+    struct header h;
+    if ((size_t)(end - p) < sizeof(h)) { return false; }
+    memcpy(&h, p, sizeof(h));
+    if (memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0) { return false; }
+    p += sizeof(h);
+
+    struct skiplist_node *first[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_node *last[SKIPLIST_MAX_HEIGHT];
+    memset(first, 0, sizeof(first));
+    memset(last, 0, sizeof(last));
+    int height = 1;
+    bool ok = true;
+    uint64_t i = 0;
+
+    for (i = 0; i < h.count; i++) {
+        struct record r;
+        if ((size_t)(end - p) < sizeof(r)) { break; }
+        memcpy(&r, p, sizeof(r));
+        p += sizeof(r);
+        if ((size_t)(end - p) < PAD8(r.klen) + PAD8(r.vlen)) { break; }
+        if ((kc == NULL && r.klen != sizeof(void *))
+            || (vc == NULL && r.vlen != sizeof(void *))) {
+            break;
+        }
+        void *k = codec_decode(kc, p, r.klen);
+        p += PAD8(r.klen);
+        void *v = codec_decode(vc, p, r.vlen);
+        p += PAD8(r.vlen);
+
+        struct skiplist_node *n = NULL;
+        uint8_t nh = SKIPLIST_GEN_HEIGHT();
+        if (last[0] == NULL || CMP(sl, last[0]->k, k) <= 0) {
+            n = skiplist_node_alloc(sl, nh, k, v);
+        }
+        if (n == NULL) {
+            if (cb) { cb(k, v, udata); }
+            break;
+        }
+        for (int lvl = 0; lvl < nh; lvl++) {
+            if (last[lvl] == NULL) {
+                first[lvl] = n;
+            } else {
+                last[lvl]->next[lvl] = n;
+            }
+            last[lvl] = n;
+        }
+        if (nh > height) { height = nh; }
+    }
+    ok = i == h.count && p == end;
+
+    struct skiplist_node *head = NULL;
+    if (ok) {
+        head = skiplist_node_alloc(sl, (uint8_t)height,
+            &SENTINEL, &SENTINEL);
+        ok = head != NULL;
+    }
+    if (!ok) {
+        struct skiplist_node *n = first[0];
+        while (n != NULL && !IS_SENTINEL(n)) {
+            struct skiplist_node *next = n->next[0];
+            if (cb) { cb(n->k, n->v, udata); }
+            skiplist_node_free(sl, n);
+            n = next;
+        }
+        return false;
+    }
+
+    for (int lvl = 0; lvl < height; lvl++) {
+        if (first[lvl]) { head->next[lvl] = first[lvl]; }
+    }
+    skiplist_node_free(sl, sl->head);
+    sl->head = head;
+    sl->count = (size_t)h.count;
+    return true;
+}
+
+struct skiplist_mmap *skiplist_load_mmap(const char *path,
+        skiplist_cmp_cb *cmp, skiplist_alloc_cb *alloc, void *alloc_udata,
+        const struct skiplist_codec *key_codec,
+        const struct skiplist_codec *value_codec,
+        skiplist_free_cb *cb, void *udata) {
+    assert(path);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) { return NULL; }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { return NULL; }
+
+    struct skiplist *sl = skiplist_new(cmp, alloc, alloc_udata);
+    struct skiplist_mmap *m = NULL;
+    if (sl) { m = sl->alloc(NULL, 0, sizeof(*m), sl->alloc_udata); }
+    if (m == NULL) {
+        if (sl) { skiplist_free(sl, NULL, NULL); }
+        munmap(base, size);
+        return NULL;
+    }
+
+    /* The build reads the file front to back, once. */
+    (void)posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+    const unsigned char *p = base;
+    if (!build(sl, p, p + size, key_codec, value_codec, cb, udata)) {
+        sl->alloc(m, sizeof(*m), 0, sl->alloc_udata);
+        skiplist_free(sl, NULL, NULL);
+        munmap(base, size);
+        return NULL;
+    }
+    (void)posix_madvise(base, size, POSIX_MADV_NORMAL);
+
+    m->sl = sl;
+    m->base = base;
+    m->size = size;
+    return m;
+}
+
+struct skiplist *skiplist_mmap_list(struct skiplist_mmap *m) {
+    assert(m);
+    return m->sl;
+}
+
+void skiplist_mmap_close(struct skiplist_mmap *m,
+        skiplist_free_cb *cb, void *udata) {
+    assert(m);
+    struct skiplist *sl = m->sl;
+    void *base = m->base;
+    size_t size = m->size;
+    sl->alloc(m, sizeof(*m), 0, sl->alloc_udata);
+    skiplist_free(sl, cb, udata);
+    munmap(base, size);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Saving a skiplist to a file, and loading it back with mmap.
+ *
+ * The file holds the pairs in order, each as a length-prefixed key
+ * and value, in native byte order. Loading maps the file and builds
+ * the skiplist's towers in one pass over it, without any searching.
+ * Keys and values can be decoded to point straight into the mapping,
+ * which stays open until the loaded skiplist is closed.
+ */
+
+#ifndef SKIPLIST_IO_H
+#define SKIPLIST_IO_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How to turn keys or values into bytes and back. */
+struct skiplist_codec {
+    /* How many bytes X's encoding takes. */
+    size_t (*size)(void *x, void *udata);
+    /* Write X's encoding into BUF, which has room for size(X) bytes. */
+    void (*encode)(void *x, void *buf, void *udata);
+    /* Get a key or value back from LEN bytes at BUF. BUF is 8-byte
+     * aligned, and stays valid until skiplist_mmap_close, so it can
+     * be returned as is. */
+    void *(*decode)(const void *buf, size_t len, void *udata);
+    void *udata;
+};
+
+/* Write SL's pairs to FD. A NULL codec stores the key or value pointer
+ * itself, for integers cast to void *. Returns false on write error. */
+bool skiplist_save(struct skiplist *sl, int fd,
+    const struct skiplist_codec *key_codec,
+    const struct skiplist_codec *value_codec);
+
+/* Opaque type for a skiplist loaded from a mapped file. */
+struct skiplist_mmap;
+
+/* Map the file at PATH, written by skiplist_save, and build a skiplist
+ * from it. CMP, ALLOC and ALLOC_UDATA are as for skiplist_new, and the
+ * codecs must match the ones it was saved with. Returns NULL if the
+ * file can't be mapped, is not in the right format, or is not sorted
+ * by CMP, or on alloc failure. In that case CB (if non-NULL) is called
+ * on every pair decoded so far, as skiplist_mmap_close would, so
+ * decoders that copy don't leak. */
+struct skiplist_mmap *skiplist_load_mmap(const char *path,
+    skiplist_cmp_cb *cmp, skiplist_alloc_cb *alloc, void *alloc_udata,
+    const struct skiplist_codec *key_codec,
+    const struct skiplist_codec *value_codec,
+    skiplist_free_cb *cb, void *udata);
+
+/* The loaded skiplist. It can be used and modified like any other, but
+ * is freed by skiplist_mmap_close, not skiplist_free. */
+struct skiplist *skiplist_mmap_list(struct skiplist_mmap *m);
+
+/* Free the skiplist, calling CB (if non-NULL) on each pair as with
+ * skiplist_free, then unmap the file. */
+void skiplist_mmap_close(struct skiplist_mmap *m,
+    skiplist_free_cb *cb, void *udata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
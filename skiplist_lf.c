@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist_lf.h"
+#include "skiplist_epoch.h"
+#include "skiplist_macros_internal.h"
+
+struct lf_node {
+    void *k;                /* key */
+    void *v;                /* value, or TOMBSTONE once deleted */
+    int refs;               /* held by the inserter and the deleter */
+    int h;                  /* node height */
+    struct lf_node *retired; /* next node in sl->retired */
+
+    /* Forward pointers, allocated with (h)*sizeof(uintptr_t) extra
+     * bytes. The low bit is set when the node has been logically
+     * deleted at that level; after that, the link never changes. */
+    uintptr_t next[];
+};
+
+struct skiplist_lf {
+    struct lf_node *head;   /* SKIPLIST_MAX_HEIGHT tall, no key */
+    int height;             /* tallest node ever added */
+    size_t count;
+    struct lf_node *retired; /* unlinked nodes, freed with the list */
+    struct skiplist_epoch *epoch; /* if non-NULL, retire nodes there */
+    skiplist_cmp_cb *cmp;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+#define MARK ((uintptr_t)1)
+#define IS_MARKED(l) ((l) & MARK)
+#define PTR(l) ((struct lf_node *)((l) & ~MARK))
+#define LINK(n) ((uintptr_t)(n))
+
+/* Value swapped into a node by the thread that deletes it, so a
+ * racing skiplist_lf_set can tell its value was not stored. */
+static char TOMBSTONE_BYTE;
+#define TOMBSTONE ((void *)&TOMBSTONE_BYTE)
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+static size_t node_size(int height) {
+    return sizeof(struct lf_node) + height * sizeof(uintptr_t);
+}
+
+/* Allocate a node. The forward pointers are initialized to NULL. */
+static struct lf_node *node_alloc(struct skiplist_lf *sl,
+        int height, void *key, void *value) {
+    assert(height > 0);
+    assert(height <= SKIPLIST_MAX_HEIGHT);
+    struct lf_node *n = sl->alloc(NULL, 0,
+        node_size(height), sl->alloc_udata);
+    if (n == NULL) { return NULL; }
+    n->k = key;
+    n->v = value;
+    n->refs = 2;
+    n->h = height;
+    n->retired = NULL;
+    DO(height, n->next[i] = LINK(NULL));
+    return n;
+}
+
+static void node_free(struct skiplist_lf *sl, struct lf_node *n) {
+    sl->alloc(n, node_size(n->h), 0, sl->alloc_udata);
+}
+
+/* random() takes a lock in most libcs, so each thread uses its own
+ * xorshift state instead. */
+static __thread uint64_t random_state;
+
+static uint64_t next_random(void) {
+    uint64_t x = random_state;
+    if (x == 0) {
+        /* The address differs for every thread. */
+        x = (uint64_t)(uintptr_t)&random_state ^ 0x9e3779b97f4a7c15ULL;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    random_state = x;
+    return x;
+}
+
+/* Random height with P = 0.5. */
+static int gen_height(void) {
+    uint64_t x = next_random();
+    int h = 1;
+    while ((x & 1) && h < SKIPLIST_MAX_HEIGHT) {
+        h++;
+        x >>= 1;
+    }
+    return h;
+}
+
+struct skiplist_lf *skiplist_lf_new(skiplist_cmp_cb *cmp,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (cmp == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+
+    struct skiplist_lf *sl = alloc(NULL, 0, sizeof(*sl), alloc_udata);
+    if (sl) {
+        sl->height = 1;
+        sl->count = 0;
+        sl->retired = NULL;
+        sl->epoch = NULL;
+        sl->cmp = cmp;
+        sl->alloc = alloc;
+        sl->alloc_udata = alloc_udata;
+
+        struct lf_node *head = node_alloc(sl,
+            SKIPLIST_MAX_HEIGHT, NULL, NULL);
+        if (head == NULL) {
+            alloc(sl, sizeof(*sl), 0, alloc_udata);
+            return NULL;
+        }
+        sl->head = head;
+    }
+    return sl;
+}
+
+/* Raise sl->height to at least HEIGHT. */
+static void raise_height(struct skiplist_lf *sl, int height) {
+    int cur = ATOMIC_LOAD(&sl->height);
+    while (cur < height) {
+        if (ATOMIC_CAS(&sl->height, &cur, height)) { break; }
+    }
+}
+
+/* Get the nodes before and at-or-after KEY at each level, unlinking
+ * any logically deleted nodes on the way. Only levels below the
+ * current height are filled in. Returns whether succs[0] has KEY. */
+static bool find(struct skiplist_lf *sl, void *key,
+        struct lf_node **preds, struct lf_node **succs) {
+    int res = 1;
+retry:
+    res = 1;
+    struct lf_node *pred = sl->head, *cur = NULL;
+    for (int lvl = ATOMIC_LOAD(&sl->height) - 1; lvl >= 0; lvl--) {
+        res = 1;
+        cur = PTR(ATOMIC_LOAD(&pred->next[lvl]));
+        while (cur != NULL) {
+            uintptr_t succ = ATOMIC_LOAD(&cur->next[lvl]);
+            if (IS_MARKED(succ)) {
+                /* cur is being deleted, help unlink it. */
+                uintptr_t expected = LINK(cur);
+                if (!ATOMIC_CAS(&pred->next[lvl], &expected,
+                        succ & ~MARK)) {
+                    goto retry;     /* pred changed or was deleted */
+                }
+                cur = PTR(succ);
+                continue;
+            }
+            res = sl->cmp(cur->k, key);
+            if (res < 0) {          /* < - advance. */
+                pred = cur;
+                cur = PTR(succ);
+            } else {                /* >= - descend. */
+                break;
+            }
+        }
+        preds[lvl] = pred;
+        succs[lvl] = cur;
+    }
+    return cur != NULL && res == 0;
+}
+
+/* Like find, but read-only: get the first node >= KEY that has not
+ * been deleted, and whether it is == KEY. Wait-free. */
+static struct lf_node *search(struct skiplist_lf *sl, void *key,
+        bool *found) {
+    int res = 1;
+    struct lf_node *pred = sl->head, *cur = NULL;
+    for (int lvl = ATOMIC_LOAD(&sl->height) - 1; lvl >= 0; lvl--) {
+        res = 1;
+        cur = PTR(ATOMIC_LOAD(&pred->next[lvl]));
+        while (cur != NULL) {
+            uintptr_t succ = ATOMIC_LOAD(&cur->next[lvl]);
+            if (IS_MARKED(succ)) {
+                cur = PTR(succ);
+                continue;
+            }
+            res = sl->cmp(cur->k, key);
+            if (res < 0) {
+                pred = cur;
+                cur = PTR(succ);
+            } else {
+                break;
+            }
+        }
+    }
+    *found = cur != NULL && res == 0;
+    return cur;
+}
+
+void skiplist_lf_set_epoch(struct skiplist_lf *sl, struct skiplist_epoch *e) {
+    assert(sl);
+    sl->epoch = e;
+}
+
+/* Drop one of the node's two references. Once both the inserter and
+ * the deleter are done with it, it is unreachable and can be retired.
+ * Without an epoch domain (or if retiring fails, since this thread is
+ * in a critical section and cannot wait), it is kept until the
+ * skiplist is freed. */
+static void release(struct skiplist_lf *sl, struct lf_node *n) {
+    if (ATOMIC_ADD(&n->refs, -1) > 0) { return; }
+    if (sl->epoch && skiplist_epoch_retire(sl->epoch, n,
+            node_size(n->h), sl->alloc, sl->alloc_udata)) {
+        return;
+    }
+    struct lf_node *head = ATOMIC_LOAD(&sl->retired);
+    do {
+        n->retired = head;
+    } while (!ATOMIC_CAS(&sl->retired, &head, n));
+}
+
+/* Logically delete N by marking its links, top-down. Returns whether
+ * this thread marked level 0, and so is responsible for unlinking it. */
+static bool mark_node(struct lf_node *n) {
+    for (int lvl = n->h - 1; lvl >= 1; lvl--) {
+        uintptr_t succ = ATOMIC_LOAD(&n->next[lvl]);
+        while (!IS_MARKED(succ)) {
+            if (ATOMIC_CAS(&n->next[lvl], &succ, succ | MARK)) { break; }
+        }
+    }
+    uintptr_t succ = ATOMIC_LOAD(&n->next[0]);
+    while (!IS_MARKED(succ)) {
+        if (ATOMIC_CAS(&n->next[0], &succ, succ | MARK)) { return true; }
+    }
+    return false;
+}
+
+/* Finish deleting N, after this thread won mark_node: take its value,
+ * unlink it at every level, and drop the deleter's reference. */
+static void *unlink_node(struct skiplist_lf *sl, struct lf_node *n) {
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    void *value = ATOMIC_XCHG(&n->v, TOMBSTONE);
+    ATOMIC_ADD(&sl->count, -1);
+    (void)find(sl, n->k, preds, succs);
+    release(sl, n);
+    return value;
+}
+
+static bool add_or_set(struct skiplist_lf *sl, bool try_replace,
+        void *key, void *value, void **old) {
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *nn = NULL;
+    int height = gen_height();
+    raise_height(sl, height);
+
+    for (;;) {
+        if (find(sl, key, preds, succs)) {
+            if (!try_replace) {
+                if (nn) { node_free(sl, nn); }
+                return false;
+            }
+            /* Never store over a tombstone: the deleter already owns
+             * that node, and a value written there would be lost. */
+            void *prev = ATOMIC_LOAD(&succs[0]->v);
+            while (prev != TOMBSTONE
+                && !ATOMIC_CAS(&succs[0]->v, &prev, value)) {}
+            if (prev != TOMBSTONE) { /* key exists, replaced value */
+                if (nn) { node_free(sl, nn); }
+                if (old) { *old = prev; }
+                return true;
+            }
+            continue;       /* raced with a delete; insert instead */
+        }
+
+        if (nn == NULL) {
+            nn = node_alloc(sl, height, key, value);
+            if (nn == NULL) { return false; }
+        }
+        DO(height, nn->next[i] = LINK(succs[i]));
+        uintptr_t expected = LINK(succs[0]);
+        if (ATOMIC_CAS(&preds[0]->next[0], &expected, LINK(nn))) {
+            break;          /* linked at level 0, now present */
+        }
+    }
+    if (old) { *old = NULL; }
+    ATOMIC_ADD(&sl->count, 1);
+
+    /* Link the upper levels, bottom-up. If the node gets deleted
+     * meanwhile, stop, and make sure it is unlinked everywhere. */
+    bool deleted = false;
+    for (int lvl = 1; lvl < height && !deleted; lvl++) {
+        for (;;) {
+            uintptr_t succ = ATOMIC_LOAD(&nn->next[lvl]);
+            if (IS_MARKED(succ) || (PTR(succ) != succs[lvl]
+                    && !ATOMIC_CAS(&nn->next[lvl], &succ,
+                        LINK(succs[lvl])))) {
+                deleted = true;
+                break;
+            }
+            uintptr_t expected = LINK(succs[lvl]);
+            if (ATOMIC_CAS(&preds[lvl]->next[lvl], &expected, LINK(nn))) {
+                deleted = IS_MARKED(ATOMIC_LOAD(&nn->next[lvl]));
+                break;
+            }
+            if (!find(sl, key, preds, succs) || succs[0] != nn) {
+                deleted = true;
+                break;
+            }
+        }
+    }
+    if (deleted) { (void)find(sl, key, preds, succs); }
+    release(sl, nn);
+    return true;
+}
+
+bool skiplist_lf_add(struct skiplist_lf *sl, void *key, void *value) {
+    assert(sl);
+    return add_or_set(sl, false, key, value, NULL);
+}
+
+bool skiplist_lf_set(struct skiplist_lf *sl,
+        void *key, void *value, void **old) {
+    assert(sl);
+    return add_or_set(sl, true, key, value, old);
+}
+
+bool skiplist_lf_get(struct skiplist_lf *sl, void *key, void **value) {
+    assert(sl);
+    bool found = false;
+    struct lf_node *n = search(sl, key, &found);
+    if (!found) { return false; }
+    void *v = ATOMIC_LOAD(&n->v);
+    if (v == TOMBSTONE) { return false; }
+    if (value) { *value = v; }
+    return true;
+}
+
+bool skiplist_lf_member(struct skiplist_lf *sl, void *key) {
+    return skiplist_lf_get(sl, key, NULL);
+}
+
+bool skiplist_lf_delete(struct skiplist_lf *sl, void *key, void **value) {
+    assert(sl);
+    struct lf_node *preds[SKIPLIST_MAX_HEIGHT];
+    struct lf_node *succs[SKIPLIST_MAX_HEIGHT];
+    for (;;) {
+        if (!find(sl, key, preds, succs)) { return false; }
+        struct lf_node *doomed = succs[0];
+        if (mark_node(doomed)) {
+            void *v = unlink_node(sl, doomed);
+            if (value) { *value = v; }
+            return true;
+        }
+        /* Another thread deleted it first; check again, in case
+         * the key was re-added. */
+    }
+}
+
+/* Get the first node that has not been deleted, or NULL. */
+static struct lf_node *first_node(struct skiplist_lf *sl) {
+    uintptr_t link = ATOMIC_LOAD(&sl->head->next[0]);
+    struct lf_node *cur = PTR(link);
+    while (cur != NULL) {
+        link = ATOMIC_LOAD(&cur->next[0]);
+        if (!IS_MARKED(link)) { break; }
+        cur = PTR(link);
+    }
+    return cur;
+}
+
+/* Get the last node that has not been deleted, or NULL. */
+static struct lf_node *last_node(struct skiplist_lf *sl) {
+    struct lf_node *pred = sl->head;
+    for (int lvl = ATOMIC_LOAD(&sl->height) - 1; lvl >= 0; lvl--) {
+        struct lf_node *cur = PTR(ATOMIC_LOAD(&pred->next[lvl]));
+        while (cur != NULL) {
+            uintptr_t succ = ATOMIC_LOAD(&cur->next[lvl]);
+            if (!IS_MARKED(succ)) { pred = cur; }
+            cur = PTR(succ);
+        }
+    }
+    return pred == sl->head ? NULL : pred;
+}
+
+/* Read N's pair, unless it was deleted after being found. */
+static bool read_pair(struct lf_node *n, void **key, void **value) {
+    void *v = ATOMIC_LOAD(&n->v);
+    if (v == TOMBSTONE) { return false; }
+    if (key) { *key = n->k; }
+    if (value) { *value = v; }
+    return true;
+}
+
+bool skiplist_lf_first(struct skiplist_lf *sl, void **key, void **value) {
+    assert(sl);
+    for (;;) {
+        struct lf_node *n = first_node(sl);
+        if (n == NULL) { return false; }
+        if (read_pair(n, key, value)) { return true; }
+    }
+}
+
+bool skiplist_lf_last(struct skiplist_lf *sl, void **key, void **value) {
+    assert(sl);
+    for (;;) {
+        struct lf_node *n = last_node(sl);
+        if (n == NULL) { return false; }
+        if (read_pair(n, key, value)) { return true; }
+    }
+}
+
+bool skiplist_lf_pop_first(struct skiplist_lf *sl,
+        void **key, void **value) {
+    assert(sl);
+    for (;;) {
+        struct lf_node *n = first_node(sl);
+        if (n == NULL) { return false; }
+        if (mark_node(n)) {
+            if (key) { *key = n->k; }
+            void *v = unlink_node(sl, n);
+            if (value) { *value = v; }
+            return true;
+        }
+    }
+}
+
+bool skiplist_lf_pop_last(struct skiplist_lf *sl,
+        void **key, void **value) {
+    assert(sl);
+    for (;;) {
+        struct lf_node *n = last_node(sl);
+        if (n == NULL) { return false; }
+        if (mark_node(n)) {
+            if (key) { *key = n->k; }
+            void *v = unlink_node(sl, n);
+            if (value) { *value = v; }
+            return true;
+        }
+    }
+}
+
+/* Random walk for pop_spray: starting from the head at level START - 1,
+ * take up to MAX_JUMP steps over live nodes on each level, then drop a
+ * level. Returns where the walk ended, or NULL if it ran off the end. */
+static struct lf_node *spray(struct skiplist_lf *sl,
+        int start, unsigned max_jump) {
+    struct lf_node *cur = sl->head;
+    for (int lvl = start - 1; lvl >= 0; lvl--) {
+        unsigned jumps = (unsigned)(next_random() % (max_jump + 1));
+        while (jumps > 0) {
+            struct lf_node *next = PTR(ATOMIC_LOAD(&cur->next[lvl]));
+            if (next == NULL) { return NULL; }
+            cur = next;
+            if (!IS_MARKED(ATOMIC_LOAD(&next->next[lvl]))) { jumps--; }
+        }
+    }
+    return cur == sl->head ? first_node(sl) : cur;
+}
+
+bool skiplist_lf_pop_spray(struct skiplist_lf *sl, unsigned threads,
+        void **key, void **value) {
+    assert(sl);
+    if (threads <= 1) { return skiplist_lf_pop_first(sl, key, value); }
+
+    /* Per the SprayList paper, start about log2(p) levels up, and jump
+     * about as far on each level, so p threads land on different
+     * nodes among roughly the first p*log(p). */
+    unsigned log_p = 0;
+    while ((threads >> (log_p + 1)) > 0) { log_p++; }
+    int start = (int)log_p + 1;
+    int height = ATOMIC_LOAD(&sl->height);
+    if (start > height) { start = height; }
+
+    /* Claim the first node from where the walk landed that nobody
+     * else has claimed yet. */
+    for (struct lf_node *n = spray(sl, start, log_p + 1); n != NULL;
+         n = PTR(ATOMIC_LOAD(&n->next[0]))) {
+        if (mark_node(n)) {
+            if (key) { *key = n->k; }
+            void *v = unlink_node(sl, n);
+            if (value) { *value = v; }
+            return true;
+        }
+    }
+    /* Ran off the end, so the list is short; take the minimum. */
+    return skiplist_lf_pop_first(sl, key, value);
+}
+
+size_t skiplist_lf_count(struct skiplist_lf *sl) {
+    assert(sl);
+    return ATOMIC_LOAD(&sl->count);
+}
+
+bool skiplist_lf_empty(struct skiplist_lf *sl) {
+    return first_node(sl) == NULL;
+}
+
+static void walk_and_apply(struct lf_node *cur,
+        skiplist_iter_cb *cb, void *udata) {
+    while (cur != NULL) {
+        uintptr_t succ = ATOMIC_LOAD(&cur->next[0]);
+        void *v = ATOMIC_LOAD(&cur->v);
+        if (!IS_MARKED(succ) && v != TOMBSTONE) {
+            if (cb(cur->k, v, udata) != SKIPLIST_ITER_CONTINUE) { break; }
+        }
+        cur = PTR(succ);
+    }
+}
+
+void skiplist_lf_iter(struct skiplist_lf *sl,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(sl);
+    assert(cb);
+    walk_and_apply(PTR(ATOMIC_LOAD(&sl->head->next[0])), cb, udata);
+}
+
+void skiplist_lf_iter_from(struct skiplist_lf *sl, void *key,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(sl);
+    assert(cb);
+    bool found = false;
+    struct lf_node *cur = search(sl, key, &found);
+    if (found) { walk_and_apply(cur, cb, udata); }
+}
+
+size_t skiplist_lf_free(struct skiplist_lf *sl,
+        skiplist_free_cb *cb, void *udata) {
+    assert(sl);
+    size_t ct = 0;
+    struct lf_node *cur = PTR(sl->head->next[0]);
+    while (cur != NULL) {
+        struct lf_node *doomed = cur;
+        /* With no operations in progress, every deleted
+         * node has been unlinked and retired. */
+        assert(!IS_MARKED(doomed->next[0]));
+        if (cb) { cb(doomed->k, doomed->v, udata); }
+        cur = PTR(doomed->next[0]);
+        node_free(sl, doomed);
+        ct++;
+    }
+
+    cur = sl->retired;
+    while (cur != NULL) {
+        struct lf_node *doomed = cur;
+        cur = doomed->retired;
+        node_free(sl, doomed);
+    }
+
+    node_free(sl, sl->head);
+    sl->alloc(sl, sizeof(*sl), 0, sl->alloc_udata);
+    return ct;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Lock-free concurrent skiplist.
+ *
+ * This mirrors the interface in skiplist.h, but every operation except
+ * skiplist_lf_free can be called from any number of threads at once.
+ * Links are updated with compare-and-swap, insertion links a node
+ * bottom-up, and deletion first marks a node's links (logical
+ * deletion) before unlinking it. get, member, first, last and iteration
+ * never write shared memory.
+ *
+ * The algorithm follows Herlihy & Shavit's "The Art of Multiprocessor
+ * Programming", ch. 14, and Fraser's "Practical lock-freedom".
+ *
+ * Differences from skiplist.h:
+ * - Keys are unique: skiplist_lf_add fails if KEY is already present,
+ *   so there is no delete_all.
+ * - Iteration is weakly consistent: it sees every pair present for the
+ *   whole iteration, and may or may not see concurrent changes.
+ * - The allocation callback must be thread-safe.
+ * - Unlinked nodes are not freed until skiplist_lf_free, since a
+ *   concurrent reader may still be looking at them, unless an epoch
+ *   domain is attached with skiplist_lf_set_epoch.
+ */
+
+#ifndef SKIPLIST_LF_H
+#define SKIPLIST_LF_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque lock-free skiplist type. */
+struct skiplist_lf;
+
+/* Create a new lock-free skiplist, returns NULL on error.
+ * Same arguments as skiplist_new, but ALLOC must be thread-safe. */
+struct skiplist_lf *skiplist_lf_new(skiplist_cmp_cb *cmp,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Epoch-based reclamation domain, see skiplist_epoch.h. */
+struct skiplist_epoch;
+
+/* Retire deleted nodes through epoch domain E, so they are freed as
+ * soon as it is safe. Must be set before the skiplist is shared, and
+ * then every thread must call every skiplist_lf_* function other than
+ * free from within an epoch critical section. */
+void skiplist_lf_set_epoch(struct skiplist_lf *sl, struct skiplist_epoch *e);
+
+/* Add a key/value pair, if KEY is not already present.
+ * Returns whether the pair was added. */
+bool skiplist_lf_add(struct skiplist_lf *sl, void *key, void *value);
+
+/* Set a key/value pair, replacing an existing value if present.
+ * If OLD is non-NULL, *old will be set to the previous value,
+ * or NULL if it was not present. Returns false on alloc failure. */
+bool skiplist_lf_set(struct skiplist_lf *sl,
+    void *key, void *value, void **old);
+
+/* Get the value associated with KEY. Wait-free.
+ * Returns whether the key was found. */
+bool skiplist_lf_get(struct skiplist_lf *sl, void *key, void **value);
+
+/* Does the skiplist contain KEY? Wait-free. */
+bool skiplist_lf_member(struct skiplist_lf *sl, void *key);
+
+/* Delete KEY. If found and VALUE is non-NULL, the old value will
+ * be written to *VALUE. Returns whether this call deleted it. */
+bool skiplist_lf_delete(struct skiplist_lf *sl, void *key, void **value);
+
+/* Same as skiplist_first/last/pop_first/pop_last. */
+bool skiplist_lf_first(struct skiplist_lf *sl, void **key, void **value);
+bool skiplist_lf_last(struct skiplist_lf *sl, void **key, void **value);
+bool skiplist_lf_pop_first(struct skiplist_lf *sl, void **key, void **value);
+bool skiplist_lf_pop_last(struct skiplist_lf *sl, void **key, void **value);
+
+/* Relaxed pop_first, for using the skiplist as a concurrent priority
+ * queue. Rather than every caller fighting over the first node, each
+ * does a short random walk (a "spray") over the low levels, and pops
+ * one of roughly the first THREADS*log2(THREADS) pairs, where THREADS
+ * is how many threads are expected to pop at once. Falls back to
+ * skiplist_lf_pop_first when THREADS <= 1 or the skiplist is short.
+ *
+ * See Alistarh, Kopinsky, Li & Shavit, "The SprayList: A Scalable
+ * Relaxed Priority Queue". */
+bool skiplist_lf_pop_spray(struct skiplist_lf *sl, unsigned threads,
+    void **key, void **value);
+
+/* How many pairs are in the skiplist? */
+size_t skiplist_lf_count(struct skiplist_lf *sl);
+
+/* Is the skiplist empty? */
+bool skiplist_lf_empty(struct skiplist_lf *sl);
+
+/* Iterate over the skiplist, from the start or from KEY. */
+void skiplist_lf_iter(struct skiplist_lf *sl,
+    skiplist_iter_cb *cb, void *udata);
+void skiplist_lf_iter_from(struct skiplist_lf *sl, void *key,
+    skiplist_iter_cb *cb, void *udata);
+
+/* Free the skiplist, calling CB (if non-NULL) on every remaining pair.
+ * No other thread may be using the skiplist.
+ * Returns the number of pairs removed. */
+size_t skiplist_lf_free(struct skiplist_lf *sl,
+    skiplist_free_cb *cb, void *udata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
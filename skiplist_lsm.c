@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+#include "skiplist_lsm.h"
+#include "skiplist_macros_internal.h"
+
+/* Run file layout: the magic, the blocks, the index (one uint64_t block
+ * offset per block), then a struct footer. Each block is a series of
+ * entries, each a struct entry, then the key's unshared suffix and the
+ * value, each padded to a multiple of 8 bytes. The first entry in a
+ * block shares nothing, so its key can be decoded in place. */
+#define MAGIC "skiprun1"
+
+struct entry {
+    uint32_t shared;            /* bytes shared with the previous key */
+    uint32_t unshared;
+    uint32_t vlen;              /* TOMBSTONE_LEN for a delete */
+    uint32_t pad;
+};
+
+struct footer {
+    uint64_t index_off;
+    uint64_t blocks;
+    uint64_t count;
+    uint64_t max_klen;
+    char magic[8];
+};
+
+#define TOMBSTONE_LEN UINT32_MAX
+#define PAD8(n) (((n) + 7) & ~(size_t)7)
+
+/* Start a new block once the current one is at least this large. */
+#define BLOCK_SIZE 4096
+
+/* Lookups rebuild keys in a buffer on the stack up to this size. */
+#define GET_SCRATCH 256
+
+/* Size of the output buffer used when writing runs. */
+#define WRITE_BUF (64 * 1024)
+
+/* Run file names are the run's sequence number, in hex. */
+#define RUN_NAME "%016llx.run"
+#define RUN_NAME_LEN 20
+
+/* Memtable value standing for a delete. */
+static char tombstone;
+#define TOMBSTONE ((void *)&tombstone)
+
+struct memtable {
+    struct skiplist *sl;
+    struct memtable *next;      /* older */
+};
+
+struct run {
+    unsigned char *base;
+    size_t size;
+    const uint64_t *index;
+    uint64_t index_off;
+    uint64_t blocks;
+    size_t scratch_size;        /* room needed to rebuild a key */
+    struct run *next;           /* older */
+};
+
+struct skiplist_lsm {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* memtable frozen, or stopping */
+    pthread_cond_t idle;        /* memtable flushed, or failed */
+    pthread_t flusher;
+    struct memtable *active;
+    struct memtable *frozen;    /* newest first */
+    struct run *runs;           /* newest first */
+    size_t run_count;
+    size_t scratch_size;        /* largest of the runs' */
+    uint64_t next_seq;
+    int freeing;                /* flushed memtables not yet freed */
+    bool stopping;
+    bool failed;
+
+    char *dir;
+    skiplist_cmp_cb *cmp;
+    const struct skiplist_codec *kc;
+    const struct skiplist_codec *vc;
+    size_t memtable_max;
+    skiplist_free_cb *free_cb;
+    void *free_udata;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+static size_t codec_size(const struct skiplist_codec *c, void *x) {
+    return c ? c->size(x, c->udata) : sizeof(x);
+}
+
+static void codec_encode(const struct skiplist_codec *c,
+        void *x, void *buf) {
+    if (c) {
+        c->encode(x, buf, c->udata);
+    } else {
+        memcpy(buf, &x, sizeof(x));
+    }
+}
+
+static void *codec_decode(const struct skiplist_codec *c,
+        const void *buf, size_t len) {
+    if (c) { return c->decode(buf, len, c->udata); }
+    void *x = NULL;
+    memcpy(&x, buf, len < sizeof(x) ? len : sizeof(x));
+    return x;
+}
+
+static struct memtable *memtable_new(struct skiplist_lsm *lsm) {
+    struct memtable *m = lsm->alloc(NULL, 0, sizeof(*m), lsm->alloc_udata);
+    if (m == NULL) { return NULL; }
+    m->sl = skiplist_new(lsm->cmp, lsm->alloc, lsm->alloc_udata);
+    if (m->sl == NULL) {
+        lsm->alloc(m, sizeof(*m), 0, lsm->alloc_udata);
+        return NULL;
+    }
+    m->next = NULL;
+    return m;
+}
+
+static void free_pair(void *key, void *value, void *udata) {
+    struct skiplist_lsm *lsm = (struct skiplist_lsm *) udata;
+    lsm->free_cb(key, value == TOMBSTONE ? NULL : value, lsm->free_udata);
+}
+
+static void memtable_free(struct skiplist_lsm *lsm, struct memtable *m) {
+    skiplist_free(m->sl, lsm->free_cb ? free_pair : NULL, lsm);
+    lsm->alloc(m, sizeof(*m), 0, lsm->alloc_udata);
+}
+
+static char *run_path(struct skiplist_lsm *lsm, uint64_t seq,
+        const char *suffix) {
+    size_t len = strlen(lsm->dir) + 1 + RUN_NAME_LEN + strlen(suffix) + 1;
+    char *path = lsm->alloc(NULL, 0, len, lsm->alloc_udata);
+    if (path) {
+        snprintf(path, len, "%s/" RUN_NAME "%s", lsm->dir,
+            (unsigned long long)seq, suffix);
+    }
+    return path;
+}
+
+static void path_free(struct skiplist_lsm *lsm, char *path) {
+    lsm->alloc(path, strlen(path) + 1, 0, lsm->alloc_udata);
+}
+
+/* Map the run at PATH. Only the footer is checked, so this is O(1). */
+static struct run *run_open(struct skiplist_lsm *lsm, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) { return NULL; }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0
+        && (size_t)st.st_size >= sizeof(MAGIC) - 1 + sizeof(struct footer)) {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) { return NULL; }
+
+    size_t size = (size_t)st.st_size;
+    struct footer f;
+    memcpy(&f, (unsigned char *)base + size - sizeof(f), sizeof(f));
+    struct run *r = NULL;
+    if (memcmp(base, MAGIC, sizeof(MAGIC) - 1) != 0
+        || memcmp(f.magic, MAGIC, sizeof(f.magic)) != 0
+        || f.index_off < sizeof(MAGIC) - 1
+        || f.index_off > size - sizeof(f)
+        || f.blocks != (size - sizeof(f) - f.index_off) / sizeof(uint64_t)
+        || f.max_klen > size) {
+        goto fail;
+    }
+    r = lsm->alloc(NULL, 0, sizeof(*r), lsm->alloc_udata);
+    if (r == NULL) { goto fail; }
+    r->scratch_size = PAD8(f.max_klen) + 8;
+    r->base = base;
+    r->size = size;
+    r->index = (const uint64_t *)((unsigned char *)base + f.index_off);
+    r->index_off = f.index_off;
+    r->blocks = f.blocks;
+    r->next = NULL;
+    posix_madvise(base, size, POSIX_MADV_RANDOM);
+    return r;
+
+fail:
+    if (r) { lsm->alloc(r, sizeof(*r), 0, lsm->alloc_udata); }
+    munmap(base, size);
+    return NULL;
+}
+
+static void run_close(struct skiplist_lsm *lsm, struct run *r) {
+    munmap(r->base, r->size);
+    lsm->alloc(r, sizeof(*r), 0, lsm->alloc_udata);
+}
+
+/* Look KEY up in run R, rebuilding keys in SCRATCH, which has room
+ * for R's scratch_size. Returns false if absent, otherwise sets
+ * *VALUE, or *DELETED if the newest entry is a tombstone. */
+static bool run_get(struct skiplist_lsm *lsm, struct run *r,
+        unsigned char *scratch, void *key, void **value, bool *deleted) {
+    /* Find the last block whose first key is <= KEY. */
+    uint64_t lo = 0, hi = r->blocks;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const unsigned char *p = r->base + r->index[mid];
+        struct entry e;
+        memcpy(&e, p, sizeof(e));
+        void *first = codec_decode(lsm->kc, p + sizeof(e), e.unshared);
+        if (lsm->cmp(first, key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) { return false; }
+
+    uint64_t off = r->index[lo - 1];
+    uint64_t end = lo < r->blocks ? r->index[lo] : r->index_off;
+    while (off < end) {
+        struct entry e;
+        memcpy(&e, r->base + off, sizeof(e));
+        off += sizeof(e);
+        size_t klen = (size_t)e.shared + e.unshared;
+        if (klen > r->scratch_size || off + e.unshared > end) {
+            return false;       /* corrupt */
+        }
+        memcpy(scratch + e.shared, r->base + off, e.unshared);
+        off += PAD8(e.unshared);
+        int res = lsm->cmp(codec_decode(lsm->kc, scratch, klen), key);
+        if (res > 0) { return false; }
+        if (res == 0) {
+            if (e.vlen == TOMBSTONE_LEN) {
+                *deleted = true;
+            } else if (value) {
+                *value = codec_decode(lsm->vc, r->base + off, e.vlen);
+            }
+            return true;
+        }
+        if (e.vlen != TOMBSTONE_LEN) { off += PAD8(e.vlen); }
+    }
+    return false;
+}
+
+/* Put R at the front of the runs. Called with the lock held, unless
+ * the store is still being opened. Runs are never changed or removed
+ * until close, so lookups can search a snapshot of the list unlocked. */
+static void add_run(struct skiplist_lsm *lsm, struct run *r) {
+    r->next = lsm->runs;
+    lsm->runs = r;
+    lsm->run_count++;
+    if (r->scratch_size > lsm->scratch_size) {
+        lsm->scratch_size = r->scratch_size;
+    }
+}
+
+struct writer {
+    struct skiplist_lsm *lsm;
+    int fd;
+    bool ok;
+    unsigned char *buf;
+    size_t used;
+    uint64_t off;               /* file offset of buf[used] */
+    uint64_t block_start;
+    uint64_t count;
+    uint64_t max_klen;
+    unsigned char *key;         /* encoded current key */
+    size_t key_cap;
+    unsigned char *prev;        /* encoded previous key */
+    size_t prev_len;
+    size_t prev_cap;
+    unsigned char *val;         /* encoded current value */
+    size_t val_cap;
+    uint64_t *index;
+    size_t blocks;
+    size_t index_cap;
+};
+
+static bool write_all(int fd, const unsigned char *p, size_t len) {
+    while (len > 0) {
+        ssize_t res = write(fd, p, len);
+        if (res < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += res;
+        len -= (size_t)res;
+    }
+    return true;
+}
+
+static void out_flush(struct writer *w) {
+    if (w->ok && w->used > 0) { w->ok = write_all(w->fd, w->buf, w->used); }
+    w->used = 0;
+}
+
+/* Write LEN bytes from P, then pad to a multiple of 8. */
+static void out(struct writer *w, const void *p, size_t len) {
+    static const unsigned char zeroes[8];
+    size_t padded = PAD8(len);
+    if (w->used + padded > WRITE_BUF) { out_flush(w); }
+    if (padded > WRITE_BUF) {
+        if (w->ok) {
+            w->ok = write_all(w->fd, p, len)
+              && write_all(w->fd, zeroes, padded - len);
+        }
+    } else {
+        memcpy(w->buf + w->used, p, len);
+        memset(w->buf + w->used + len, 0, padded - len);
+        w->used += padded;
+    }
+    w->off += padded;
+}
+
+/* Grow *BUF to hold at least LEN bytes, discarding its contents. */
+static bool scratch(struct writer *w, unsigned char **buf,
+        size_t *cap, size_t len) {
+    if (*buf != NULL && len <= *cap) { return true; }
+    size_t ncap = *cap ? *cap : 64;
+    while (ncap < len) { ncap *= 2; }
+    unsigned char *nbuf = w->lsm->alloc(NULL, 0, ncap, w->lsm->alloc_udata);
+    if (nbuf == NULL) { return false; }
+    if (*buf) { w->lsm->alloc(*buf, *cap, 0, w->lsm->alloc_udata); }
+    *buf = nbuf;
+    *cap = ncap;
+    return true;
+}
+
+static bool add_block(struct writer *w) {
+    if (w->blocks == w->index_cap) {
+        size_t ncap = w->index_cap ? 2 * w->index_cap : 64;
+        uint64_t *ni = w->lsm->alloc(NULL, 0, ncap * sizeof(*ni),
+            w->lsm->alloc_udata);
+        if (ni == NULL) { return false; }
+        if (w->index) {
+            memcpy(ni, w->index, w->blocks * sizeof(*ni));
+            w->lsm->alloc(w->index, w->index_cap * sizeof(*ni), 0,
+                w->lsm->alloc_udata);
+        }
+        w->index = ni;
+        w->index_cap = ncap;
+    }
+    w->index[w->blocks++] = w->off;
+    w->block_start = w->off;
+    return true;
+}
+
+static enum skiplist_iter_res write_pair(void *key, void *value,
+        void *udata) {
+    struct writer *w = (struct writer *) udata;
+    struct skiplist_lsm *lsm = w->lsm;
+    size_t klen = codec_size(lsm->kc, key);
+    size_t vlen = value == TOMBSTONE ? 0 : codec_size(lsm->vc, value);
+    if (klen > UINT32_MAX || vlen >= TOMBSTONE_LEN
+        || !scratch(w, &w->key, &w->key_cap, klen)) {
+        w->ok = false;
+    }
+    if (!w->ok) { return SKIPLIST_ITER_HALT; }
+    codec_encode(lsm->kc, key, w->key);
+
+    size_t shared = 0;
+    if (w->blocks == 0 || w->off - w->block_start >= BLOCK_SIZE) {
+        if (!add_block(w)) {
+            w->ok = false;
+            return SKIPLIST_ITER_HALT;
+        }
+    } else {
+        size_t max = klen < w->prev_len ? klen : w->prev_len;
+        while (shared < max && w->key[shared] == w->prev[shared]) {
+            shared++;
+        }
+    }
+
+    struct entry e;
+    e.shared = (uint32_t)shared;
+    e.unshared = (uint32_t)(klen - shared);
+    e.vlen = value == TOMBSTONE ? TOMBSTONE_LEN : (uint32_t)vlen;
+    e.pad = 0;
+    out(w, &e, sizeof(e));
+    out(w, w->key + shared, klen - shared);
+    if (value != TOMBSTONE) {
+        if (!scratch(w, &w->val, &w->val_cap, vlen)) {
+            w->ok = false;
+            return SKIPLIST_ITER_HALT;
+        }
+        codec_encode(lsm->vc, value, w->val);
+        out(w, w->val, vlen);
+    }
+
+    /* The encoded key becomes the previous one. */
+    unsigned char *tmp = w->prev;
+    size_t tmp_cap = w->prev_cap;
+    w->prev = w->key;
+    w->prev_cap = w->key_cap;
+    w->prev_len = klen;
+    w->key = tmp;
+    w->key_cap = tmp_cap;
+
+    if (klen > w->max_klen) { w->max_klen = klen; }
+    w->count++;
+    return w->ok ? SKIPLIST_ITER_CONTINUE : SKIPLIST_ITER_HALT;
+}
+
+/* Write the frozen skiplist SL to run file SEQ, then open it. */
+static struct run *write_run(struct skiplist_lsm *lsm,
+        struct skiplist *sl, uint64_t seq) {
+    char *tmp = run_path(lsm, seq, ".tmp");
+    char *path = run_path(lsm, seq, "");
+    struct run *r = NULL;
+    struct writer w;
+    memset(&w, 0, sizeof(w));
+    w.lsm = lsm;
+    w.ok = tmp != NULL && path != NULL;
+    w.fd = -1;
+    if (w.ok) {
+        w.buf = lsm->alloc(NULL, 0, WRITE_BUF, lsm->alloc_udata);
+        w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        w.ok = w.buf != NULL && w.fd != -1;
+    }
+
+    if (w.ok) {
+        out(&w, MAGIC, sizeof(MAGIC) - 1);
+        skiplist_iter(sl, write_pair, &w);
+        struct footer f;
+        f.index_off = w.off;
+        f.blocks = w.blocks;
+        f.count = w.count;
+        f.max_klen = w.max_klen;
+        memcpy(f.magic, MAGIC, sizeof(f.magic));
+        if (w.blocks > 0) { out(&w, w.index, w.blocks * sizeof(*w.index)); }
+        out(&w, &f, sizeof(f));
+        out_flush(&w);
+        w.ok = w.ok && fsync(w.fd) == 0;
+    }
+    if (w.fd != -1) { close(w.fd); }
+
+    if (w.ok && rename(tmp, path) == 0) {
+        int dfd = open(lsm->dir, O_RDONLY);
+        if (dfd != -1) {
+            (void)fsync(dfd);
+            close(dfd);
+        }
+        r = run_open(lsm, path);
+    } else if (tmp) {
+        unlink(tmp);
+    }
+
+    if (w.buf) { lsm->alloc(w.buf, WRITE_BUF, 0, lsm->alloc_udata); }
+    if (w.key) { lsm->alloc(w.key, w.key_cap, 0, lsm->alloc_udata); }
+    if (w.prev) { lsm->alloc(w.prev, w.prev_cap, 0, lsm->alloc_udata); }
+    if (w.val) { lsm->alloc(w.val, w.val_cap, 0, lsm->alloc_udata); }
+    if (w.index) {
+        lsm->alloc(w.index, w.index_cap * sizeof(*w.index), 0,
+            lsm->alloc_udata);
+    }
+    if (tmp) { path_free(lsm, tmp); }
+    if (path) { path_free(lsm, path); }
+    return r;
+}
+
+/* Background thread: flush frozen memtables, oldest first. The
+ * memtable is read without the lock, which is safe since it is frozen;
+ * the lock is only held to swap it for its run. */
+static void *flusher(void *arg) {
+    struct skiplist_lsm *lsm = (struct skiplist_lsm *) arg;
+    pthread_mutex_lock(&lsm->lock);
+    for (;;) {
+        if (lsm->frozen == NULL || lsm->failed) {
+            if (lsm->stopping) { break; }
+            pthread_cond_wait(&lsm->work, &lsm->lock);
+            continue;
+        }
+        struct memtable **pm = &lsm->frozen;
+        while ((*pm)->next != NULL) { pm = &(*pm)->next; }
+        struct memtable *m = *pm;
+        uint64_t seq = lsm->next_seq++;
+        pthread_mutex_unlock(&lsm->lock);
+
+        struct run *r = write_run(lsm, m->sl, seq);
+
+        pthread_mutex_lock(&lsm->lock);
+        if (r == NULL) {
+            lsm->failed = true;
+        } else {
+            add_run(lsm, r);
+            /* Newer memtables may have been frozen meanwhile. */
+            pm = &lsm->frozen;
+            while (*pm != m) { pm = &(*pm)->next; }
+            *pm = NULL;
+        }
+        if (r != NULL) {
+            /* Free it without the lock, but don't count the flush as
+             * done until free_cb has seen its pairs. */
+            lsm->freeing++;
+            pthread_mutex_unlock(&lsm->lock);
+            memtable_free(lsm, m);
+            pthread_mutex_lock(&lsm->lock);
+            lsm->freeing--;
+        }
+        pthread_cond_broadcast(&lsm->idle);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+    return NULL;
+}
+
+static int cmp_seq(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Open the runs already in the directory, newest first in the list. */
+static bool open_runs(struct skiplist_lsm *lsm) {
+    DIR *d = opendir(lsm->dir);
+    if (d == NULL) { return false; }
+    uint64_t *seqs = NULL;
+    size_t count = 0, cap = 0;
+    bool ok = true;
+    struct dirent *de;
+    while (ok && (de = readdir(d)) != NULL) {
+        unsigned long long seq;
+        char suffix[5];
+        if (strlen(de->d_name) != RUN_NAME_LEN
+            || sscanf(de->d_name, "%16llx%4s", &seq, suffix) != 2
+            || strcmp(suffix, ".run") != 0) {
+            continue;
+        }
+        if (count == cap) {
+            size_t ncap = cap ? 2 * cap : 16;
+            uint64_t *ns = lsm->alloc(NULL, 0, ncap * sizeof(*ns),
+                lsm->alloc_udata);
+            if (ns == NULL) {
+                ok = false;
+                break;
+            }
+            if (seqs) {
+                memcpy(ns, seqs, count * sizeof(*ns));
+                lsm->alloc(seqs, cap * sizeof(*seqs), 0, lsm->alloc_udata);
+            }
+            seqs = ns;
+            cap = ncap;
+        }
+        seqs[count++] = seq;
+    }
+    closedir(d);
+
+    if (ok && count > 0) { qsort(seqs, count, sizeof(*seqs), cmp_seq); }
+    for (size_t i = 0; ok && i < count; i++) {
+        char *path = run_path(lsm, seqs[i], "");
+        struct run *r = path ? run_open(lsm, path) : NULL;
+        if (path) { path_free(lsm, path); }
+        if (r == NULL) {
+            ok = false;
+            break;
+        }
+        add_run(lsm, r);
+        lsm->next_seq = seqs[i] + 1;
+    }
+    if (seqs) { lsm->alloc(seqs, cap * sizeof(*seqs), 0, lsm->alloc_udata); }
+    return ok;
+}
+
+static void close_runs(struct skiplist_lsm *lsm) {
+    struct run *r = lsm->runs;
+    while (r != NULL) {
+        struct run *next = r->next;
+        run_close(lsm, r);
+        r = next;
+    }
+    lsm->runs = NULL;
+}
+
+struct skiplist_lsm *skiplist_lsm_open(const char *dir,
+        skiplist_cmp_cb *cmp, const struct skiplist_lsm_config *config,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (dir == NULL || cmp == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_lsm *lsm = alloc(NULL, 0, sizeof(*lsm), alloc_udata);
+    if (lsm == NULL) { return NULL; }
+    memset(lsm, 0, sizeof(*lsm));
+    lsm->cmp = cmp;
+    if (config) {
+        lsm->kc = config->key_codec;
+        lsm->vc = config->value_codec;
+        lsm->memtable_max = config->memtable_max;
+        lsm->free_cb = config->free_cb;
+        lsm->free_udata = config->free_udata;
+    }
+    lsm->alloc = alloc;
+    lsm->alloc_udata = alloc_udata;
+
+    lsm->dir = alloc(NULL, 0, strlen(dir) + 1, alloc_udata);
+    if (lsm->dir == NULL) { goto fail; }
+    strcpy(lsm->dir, dir);
+    if (!open_runs(lsm)) { goto fail; }
+    lsm->active = memtable_new(lsm);
+    if (lsm->active == NULL) { goto fail; }
+
+    pthread_mutex_init(&lsm->lock, NULL);
+    pthread_cond_init(&lsm->work, NULL);
+    pthread_cond_init(&lsm->idle, NULL);
+    if (pthread_create(&lsm->flusher, NULL, flusher, lsm) != 0) {
+        pthread_mutex_destroy(&lsm->lock);
+        pthread_cond_destroy(&lsm->work);
+        pthread_cond_destroy(&lsm->idle);
+        memtable_free(lsm, lsm->active);
+        goto fail;
+    }
+    return lsm;
+
+fail:
+    close_runs(lsm);
+    if (lsm->dir) { alloc(lsm->dir, strlen(lsm->dir) + 1, 0, alloc_udata); }
+    alloc(lsm, sizeof(*lsm), 0, alloc_udata);
+    return NULL;
+}
+
+/* Freeze the active memtable and hand it to the flusher.
+ * Called with the lock held. */
+static bool rotate(struct skiplist_lsm *lsm) {
+    if (skiplist_empty(lsm->active->sl)) { return true; }
+    struct memtable *m = memtable_new(lsm);
+    if (m == NULL) { return false; }
+    skiplist_freeze(lsm->active->sl);
+    lsm->active->next = lsm->frozen;
+    lsm->frozen = lsm->active;
+    lsm->active = m;
+    pthread_cond_signal(&lsm->work);
+    return true;
+}
+
+static bool put(struct skiplist_lsm *lsm, void *key, void *value) {
+    assert(lsm);
+    pthread_mutex_lock(&lsm->lock);
+    bool res = true;
+    if (lsm->memtable_max > 0
+        && skiplist_count(lsm->active->sl) >= lsm->memtable_max) {
+        res = rotate(lsm);
+    }
+    struct skiplist *sl = lsm->active->sl;
+    void *old = NULL;
+    if (!res) {
+        /* out of memory */
+    } else if (lsm->free_cb && skiplist_get(sl, key, &old)) {
+        res = skiplist_set(sl, key, value, NULL);
+        free_pair(key, old, lsm);
+    } else {
+        res = skiplist_set(sl, key, value, NULL);
+    }
+    pthread_mutex_unlock(&lsm->lock);
+    return res;
+}
+
+bool skiplist_lsm_set(struct skiplist_lsm *lsm, void *key, void *value) {
+    return put(lsm, key, value);
+}
+
+bool skiplist_lsm_delete(struct skiplist_lsm *lsm, void *key) {
+    return put(lsm, key, TOMBSTONE);
+}
+
+bool skiplist_lsm_get(struct skiplist_lsm *lsm, void *key, void **value) {
+    assert(lsm);
+    pthread_mutex_lock(&lsm->lock);
+    void *v = NULL;
+    bool found = skiplist_get(lsm->active->sl, key, &v);
+    for (struct memtable *m = lsm->frozen; !found && m; m = m->next) {
+        found = skiplist_get(m->sl, key, &v);
+    }
+    struct run *runs = lsm->runs;
+    size_t scratch_size = lsm->scratch_size;
+    pthread_mutex_unlock(&lsm->lock);
+
+    bool deleted = found && v == TOMBSTONE;
+    if (!found && runs) {
+        unsigned char buf[GET_SCRATCH];
+        unsigned char *scratch = buf;
+        if (scratch_size > sizeof(buf)) {
+            scratch = lsm->alloc(NULL, 0, scratch_size, lsm->alloc_udata);
+            if (scratch == NULL) { return false; }
+        }
+        for (struct run *r = runs; !found && r; r = r->next) {
+            found = run_get(lsm, r, scratch, key, &v, &deleted);
+        }
+        if (scratch != buf) {
+            lsm->alloc(scratch, scratch_size, 0, lsm->alloc_udata);
+        }
+    }
+    if (!found || deleted) { return false; }
+    if (value) { *value = v; }
+    return true;
+}
+
+bool skiplist_lsm_rotate(struct skiplist_lsm *lsm) {
+    assert(lsm);
+    pthread_mutex_lock(&lsm->lock);
+    bool res = rotate(lsm);
+    pthread_mutex_unlock(&lsm->lock);
+    return res;
+}
+
+bool skiplist_lsm_wait(struct skiplist_lsm *lsm) {
+    assert(lsm);
+    pthread_mutex_lock(&lsm->lock);
+    while ((lsm->frozen != NULL && !lsm->failed) || lsm->freeing > 0) {
+        pthread_cond_wait(&lsm->idle, &lsm->lock);
+    }
+    bool res = !lsm->failed;
+    pthread_mutex_unlock(&lsm->lock);
+    return res;
+}
+
+size_t skiplist_lsm_run_count(struct skiplist_lsm *lsm) {
+    assert(lsm);
+    pthread_mutex_lock(&lsm->lock);
+    size_t res = lsm->run_count;
+    pthread_mutex_unlock(&lsm->lock);
+    return res;
+}
+
+bool skiplist_lsm_close(struct skiplist_lsm *lsm) {
+    assert(lsm);
+    pthread_mutex_lock(&lsm->lock);
+    bool res = rotate(lsm);
+    lsm->stopping = true;
+    pthread_cond_signal(&lsm->work);
+    pthread_mutex_unlock(&lsm->lock);
+    pthread_join(lsm->flusher, NULL);
+    if (lsm->failed) { res = false; }
+
+    memtable_free(lsm, lsm->active);
+    struct memtable *m = lsm->frozen;
+    while (m != NULL) {
+        struct memtable *next = m->next;
+        memtable_free(lsm, m);
+        m = next;
+    }
+    close_runs(lsm);
+    pthread_mutex_destroy(&lsm->lock);
+    pthread_cond_destroy(&lsm->work);
+    pthread_cond_destroy(&lsm->idle);
+    lsm->alloc(lsm->dir, strlen(lsm->dir) + 1, 0, lsm->alloc_udata);
+    lsm->alloc(lsm, sizeof(*lsm), 0, lsm->alloc_udata);
+    return res;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Log-structured store using skiplists as memtables.
+ *
+ * Writes go to the active memtable, an ordinary skiplist. Once it
+ * reaches memtable_max pairs (or on skiplist_lsm_rotate), it is frozen
+ * (see skiplist_freeze) and a fresh one takes its place, so writers
+ * never wait on a flush. A background thread streams each frozen
+ * memtable, oldest first, to a sorted run file in DIR, and then drops
+ * it. Lookups check the active memtable, then the frozen ones, then the
+ * runs, newest first, and stop at the first match. A delete is kept as
+ * a tombstone, which hides older versions of the key.
+ *
+ * A run is a series of blocks of about 4 KB, each starting with a full
+ * key and prefix-compressing the rest against the previous key,
+ * followed by an index of where the blocks start. Lookups binary search
+ * the index, then scan one block. Runs are never merged.
+ *
+ * There is no log, so pairs not yet in a run are lost on a crash;
+ * see skiplist_wal.h.
+ */
+
+#ifndef SKIPLIST_LSM_H
+#define SKIPLIST_LSM_H
+
+#include "skiplist.h"
+#include "skiplist_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque LSM store type. */
+struct skiplist_lsm;
+
+struct skiplist_lsm_config {
+    /* How keys and values are written to runs, as for skiplist_save.
+     * NULL stores the pointer itself. Values read from a run stay
+     * mapped until skiplist_lsm_close. Keys read from a run are only
+     * used for comparison, from a scratch buffer, so key decode must
+     * not allocate. */
+    const struct skiplist_codec *key_codec;
+    const struct skiplist_codec *value_codec;
+    /* Rotate the active memtable once it holds this many pairs, or
+     * only on skiplist_lsm_rotate if 0. */
+    size_t memtable_max;
+    /* If non-NULL, called on keys and values the store drops: the new
+     * key and old value when a key is set again, and each pair of a
+     * memtable once it has been flushed (with a NULL value for a
+     * tombstone). */
+    skiplist_free_cb *free_cb;
+    void *free_udata;
+};
+
+/* Open the store in directory DIR, which must exist, picking up any
+ * runs already there. CMP compares keys. CONFIG can be NULL, for
+ * pointer codecs and manual rotation only. ALLOC is used for the
+ * memtables and buffers, must be thread-safe, and can be NULL to use
+ * malloc & free. Returns NULL on error. */
+struct skiplist_lsm *skiplist_lsm_open(const char *dir,
+    skiplist_cmp_cb *cmp, const struct skiplist_lsm_config *config,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Set KEY to VALUE. Returns false on alloc failure. */
+bool skiplist_lsm_set(struct skiplist_lsm *lsm, void *key, void *value);
+
+/* Delete KEY, by setting a tombstone. Returns false on alloc failure. */
+bool skiplist_lsm_delete(struct skiplist_lsm *lsm, void *key);
+
+/* Get KEY's newest value. A value from a memtable can be freed by
+ * free_cb once that memtable is flushed, so copy it if that matters.
+ * The runs are searched without holding the store's lock. Returns
+ * whether KEY was found (and not deleted), or false on alloc failure
+ * of the buffer for very long keys. */
+bool skiplist_lsm_get(struct skiplist_lsm *lsm, void *key, void **value);
+
+/* Freeze the active memtable, if it isn't empty, and queue it to be
+ * flushed. Returns false on alloc failure. */
+bool skiplist_lsm_rotate(struct skiplist_lsm *lsm);
+
+/* Wait until every frozen memtable has been flushed. Returns false if
+ * a flush failed, after which the remaining memtables are kept in
+ * memory. */
+bool skiplist_lsm_wait(struct skiplist_lsm *lsm);
+
+/* How many runs are there? */
+size_t skiplist_lsm_run_count(struct skiplist_lsm *lsm);
+
+/* Rotate, flush everything, and close the store. Returns false if
+ * anything could not be flushed. */
+bool skiplist_lsm_close(struct skiplist_lsm *lsm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,7 +16,95 @@
 #define LOG1(...) LOG(1, __VA_ARGS__)
 #define LOG2(...) LOG(2, __VA_ARGS__)
 
+/* Operation counters. All of these are no-ops unless SKIPLIST_STATS.
+ * A frozen skiplist can be read by several threads at once, so its
+ * counters are left alone. */
+#if SKIPLIST_STATS
+#define STAT_OP(sl, op) ((sl)->frozen ? (void)0 : (void)(sl)->stats.ops[op]++)
+#define STAT_CMP(sl) ((sl)->frozen ? (void)0 : (void)(sl)->stats.cmps++)
+#define STAT_PATH_BEGIN() uint64_t stat_path = 0
+#define STAT_VISIT(sl, lvl)                                             \
+        do {                                                            \
+                if (!(sl)->frozen) (sl)->stats.hops[lvl]++;             \
+                stat_path++;                                            \
+        } while(0)
+#define STAT_PATH_END(sl)                                               \
+        do {                                                            \
+                if (!(sl)->frozen && stat_path > (sl)->stats.max_path)  \
+                        (sl)->stats.max_path = stat_path;               \
+        } while(0)
+#else
+#define STAT_OP(sl, op) ((void)0)
+#define STAT_CMP(sl) ((void)0)
+#define STAT_PATH_BEGIN()
+#define STAT_VISIT(sl, lvl) ((void)0)
+#define STAT_PATH_END(sl) ((void)0)
+#endif
+
+/* Latency recording around public operations, when SKIPLIST_LATENCY. */
+#if SKIPLIST_LATENCY
+#define LATENCY_SUB_BITS 2
+#define LATENCY_MAX_BIT 40
+#define LATENCY_BUCKETS                                                 \
+        ((1 << LATENCY_SUB_BITS) * (LATENCY_MAX_BIT - LATENCY_SUB_BITS + 2))
+#define LAT_BEGIN() uint64_t lat_start = latency_now()
+#define LAT_END(sl, op) latency_record(sl, op, latency_now() - lat_start)
+#else
+#define LAT_BEGIN()
+#define LAT_END(sl, op) ((void)0)
+#endif
+
+/* Call the skiplist's comparison callback, counting the call. */
+#define CMP(sl, a, b) (STAT_CMP(sl), (sl)->cmp(a, b))
+
+/* Atomic operations, via the GCC/Clang builtins (C99 has none).
+ * Loads acquire and stores release; read-modify-writes do both. */
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define ATOMIC_CAS(p, expp, v)                                          \
+        __atomic_compare_exchange_n(p, expp, v, false,                  \
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define ATOMIC_XCHG(p, v) __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL)
+#define ATOMIC_ADD(p, v) __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL)
+
+/* Structs that different threads write are kept on separate cache
+ * lines: CACHE_ALIGNED rounds their size up to whole lines, and they
+ * are placed with CACHE_ALIGN_PTR at the first line boundary in a
+ * block of CACHE_ALLOC_SIZE bytes (the allocator only promises
+ * malloc's alignment). Like the atomics, this needs GCC or Clang. */
+#define CACHE_LINE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+#define CACHE_ALLOC_SIZE(size) ((size) + CACHE_LINE - 1)
+#define CACHE_ALIGN_PTR(p)                                              \
+        ((void *)(((uintptr_t)(p) + CACHE_LINE - 1)                     \
+            & ~(uintptr_t)(CACHE_LINE - 1)))
+
+/* Writer side of the single-writer/multi-reader seqlock. The sequence
+ * number is odd while a write is in progress, and every link readers
+ * can follow is stored with release semantics. */
+#if SKIPLIST_SWMR
+#define PUBLISH(lval, v) ATOMIC_STORE(&(lval), v)
+#define SEQ_WRITE_BEGIN(sl)                                             \
+        do {                                                            \
+                __atomic_store_n(&(sl)->seq, (sl)->seq + 1,             \
+                    __ATOMIC_RELAXED);                                  \
+                __atomic_thread_fence(__ATOMIC_RELEASE);                \
+        } while(0)
+#define SEQ_WRITE_END(sl) ATOMIC_STORE(&(sl)->seq, (sl)->seq + 1)
+#else
+#define PUBLISH(lval, v) ((lval) = (v))
+#define SEQ_WRITE_BEGIN(sl) ((void)0)
+#define SEQ_WRITE_END(sl) ((void)0)
+#endif
+
 #define DO(count, block)                                \
         { for(int i=0; i<count; i++) { block; } }
 
+/* Hint that the memory at P will be read soon. */
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
 #endif
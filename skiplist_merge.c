@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+#include "skiplist_merge.h"
+#include "skiplist_macros_internal.h"
+#include "skiplist_internal.h"
+
+struct cursor {
+    struct skiplist_node *n;    /* current node, never the sentinel */
+    size_t list;                /* index into lists */
+};
+
+struct skiplist_merge {
+    size_t count;
+    size_t heap_len;
+    enum skiplist_merge_policy policy;
+    skiplist_cmp_cb *cmp;
+    struct skiplist **lists;
+    struct cursor *heap;        /* min-heap by key, then list */
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+static size_t merge_size(size_t count) {
+    return sizeof(struct skiplist_merge)
+      + count * (sizeof(struct skiplist *) + sizeof(struct cursor));
+}
+
+struct skiplist_merge *skiplist_merge_new(size_t count,
+        struct skiplist **lists, enum skiplist_merge_policy policy,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (count > 0 && lists == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_merge *m = alloc(NULL, 0, merge_size(count),
+        alloc_udata);
+    if (m == NULL) { return NULL; }
+    m->count = count;
+    m->policy = policy;
+    m->cmp = count > 0 ? lists[0]->cmp : NULL;
+    m->heap = (struct cursor *)(m + 1);
+    m->lists = (struct skiplist **)(m->heap + count);
+    for (size_t i = 0; i < count; i++) {
+        assert(lists[i]->cmp == m->cmp);
+        m->lists[i] = lists[i];
+    }
+    m->alloc = alloc;
+    m->alloc_udata = alloc_udata;
+    skiplist_merge_rewind(m);
+    return m;
+}
+
+static bool before(struct skiplist_merge *m,
+        const struct cursor *a, const struct cursor *b) {
+    int res = m->cmp(a->n->k, b->n->k);
+    return res < 0 || (res == 0 && a->list < b->list);
+}
+
+static void sift_down(struct skiplist_merge *m, size_t i) {
+    struct cursor c = m->heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= m->heap_len) { break; }
+        if (child + 1 < m->heap_len
+            && before(m, &m->heap[child + 1], &m->heap[child])) {
+            child++;
+        }
+        if (!before(m, &m->heap[child], &c)) { break; }
+        m->heap[i] = m->heap[child];
+        i = child;
+    }
+    m->heap[i] = c;
+}
+
+static struct skiplist_node *skip_dead(struct skiplist_node *n) {
+    while (!IS_SENTINEL(n) && !IS_LIVE(n)) { n = n->next[0]; }
+    return n;
+}
+
+/* Rebuild the heap from each list's node N[i]. */
+static void heapify(struct skiplist_merge *m) {
+    size_t len = 0;
+    for (size_t i = 0; i < m->count; i++) {
+        struct skiplist_node *n = skip_dead(m->heap[i].n);
+        if (!IS_SENTINEL(n)) {
+            m->heap[len].n = n;
+            m->heap[len].list = i;
+            len++;
+        }
+    }
+    m->heap_len = len;
+    for (size_t i = len / 2; i-- > 0;) { sift_down(m, i); }
+}
+
+void skiplist_merge_rewind(struct skiplist_merge *m) {
+    assert(m);
+    for (size_t i = 0; i < m->count; i++) {
+        m->heap[i].n = m->lists[i]->head->next[0];
+    }
+    heapify(m);
+}
+
+/* First node in SL with a key >= KEY, or the sentinel. */
+static struct skiplist_node *find_ge(struct skiplist *sl,
+        skiplist_cmp_cb *cmp, void *key) {
+    struct skiplist_node *cur = sl->head;
+    for (int lvl = cur->h - 1; lvl >= 0; lvl--) {
+        struct skiplist_node *next = cur->next[lvl];
+        while (!IS_SENTINEL(next) && cmp(next->k, key) < 0) {
+            cur = next;
+            next = cur->next[lvl];
+        }
+    }
+    return cur->next[0];
+}
+
+void skiplist_merge_seek(struct skiplist_merge *m, void *key) {
+    assert(m);
+    for (size_t i = 0; i < m->count; i++) {
+        m->heap[i].n = find_ge(m->lists[i], m->cmp, key);
+    }
+    heapify(m);
+}
+
+/* Move the top cursor to its next node, dropping it if exhausted. */
+static void advance_top(struct skiplist_merge *m) {
+    struct skiplist_node *n = skip_dead(m->heap[0].n->next[0]);
+    if (IS_SENTINEL(n)) {
+        m->heap[0] = m->heap[--m->heap_len];
+    } else {
+        m->heap[0].n = n;
+    }
+    if (m->heap_len > 0) { sift_down(m, 0); }
+}
+
+bool skiplist_merge_next(struct skiplist_merge *m,
+        void **key, void **value) {
+    assert(m);
+    if (m->heap_len == 0) { return false; }
+    struct skiplist_node *top = m->heap[0].n;
+    if (key) { *key = top->k; }
+    if (value) { *value = top->v; }
+    advance_top(m);
+    if (m->policy == SKIPLIST_MERGE_NEWEST) {
+        while (m->heap_len > 0 && m->cmp(m->heap[0].n->k, top->k) == 0) {
+            advance_top(m);
+        }
+    }
+    return true;
+}
+
+void skiplist_merge_free(struct skiplist_merge *m) {
+    assert(m);
+    m->alloc(m, merge_size(m->count), 0, m->alloc_udata);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Merging iterator over several skiplists.
+ *
+ * This steps through N skiplists that share a comparison callback as
+ * if they were one, keeping a binary heap of each list's current node,
+ * so each pair costs O(log N) comparisons, and nothing is allocated
+ * after skiplist_merge_new. The skiplists must not be modified while
+ * the iterator is in use.
+ */
+
+#ifndef SKIPLIST_MERGE_H
+#define SKIPLIST_MERGE_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque merging iterator type. */
+struct skiplist_merge;
+
+/* What to do with equal keys. Lists earlier in the array count as
+ * newer, so with SKIPLIST_MERGE_ALL equal keys come out in list order,
+ * and SKIPLIST_MERGE_NEWEST only yields the first of them. */
+enum skiplist_merge_policy {
+    SKIPLIST_MERGE_ALL,
+    SKIPLIST_MERGE_NEWEST,
+};
+
+/* Create an iterator over the COUNT skiplists in LISTS, positioned at
+ * the start. The array is copied. ALLOC can be NULL to use malloc &
+ * free. Returns NULL on error. */
+struct skiplist_merge *skiplist_merge_new(size_t count,
+    struct skiplist **lists, enum skiplist_merge_policy policy,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Get the next pair, writing it to *KEY and *VALUE (if non-NULL).
+ * Returns false once every list is exhausted. */
+bool skiplist_merge_next(struct skiplist_merge *m, void **key, void **value);
+
+/* Reposition the iterator at the first key >= KEY. */
+void skiplist_merge_seek(struct skiplist_merge *m, void *key);
+
+/* Reposition the iterator at the start. */
+void skiplist_merge_rewind(struct skiplist_merge *m);
+
+/* Free the iterator, but not the skiplists. */
+void skiplist_merge_free(struct skiplist_merge *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+#include "skiplist_parallel.h"
+#include "skiplist_macros_internal.h"
+#include "skiplist_internal.h"
+
+#define MAX_THREADS SKIPLIST_PARALLEL_MAX_THREADS
+
+/* Don't start another thread for less than this many pairs. */
+#define MIN_PER_THREAD 4096
+
+/* Runs at most this long are insertion sorted. */
+#define SMALL_SORT 16
+
+struct pair {
+    void *k;
+    void *v;
+};
+
+/* Sort one contiguous run of the input. */
+struct sort_task {
+    skiplist_cmp_cb *cmp;
+    struct pair *a;
+    struct pair *tmp;       /* scratch space, as long as A */
+    size_t n;
+};
+
+/* Merge runs A and B into OUT, or only output positions [LO, HI) of
+ * it, so that several threads can share one large merge. */
+struct merge_task {
+    skiplist_cmp_cb *cmp;
+    struct pair *a;
+    struct pair *b;
+    struct pair *out;
+    size_t na;
+    size_t nb;
+    size_t lo;
+    size_t hi;
+};
+
+/* Link one contiguous run of sorted pairs into nodes, remembering the
+ * first and last node at each level, to join with its neighbors. */
+struct segment {
+    struct skiplist *sl;
+    struct pair *p;
+    size_t n;
+    uint64_t seed;
+    int height;             /* tallest node */
+    bool failed;
+    struct skiplist_node *first[SKIPLIST_MAX_HEIGHT];
+    struct skiplist_node *last[SKIPLIST_MAX_HEIGHT];
+};
+
+/* One partition for skiplist_parallel_iter: level 0 from FROM up to,
+ * but not including, TO. */
+struct part {
+    struct skiplist_node *from;
+    struct skiplist_node *to;
+    skiplist_iter_cb *cb;
+    void *udata;
+};
+
+/* Run FN on each of the COUNT task records in TASKS (SIZE bytes
+ * apart), one thread each. The calling thread runs the first task;
+ * if a thread can't be started, its task runs inline instead. */
+static void run_tasks(void *(*fn)(void *), void *tasks,
+        size_t size, size_t count) {
+    assert(count <= MAX_THREADS);
+    pthread_t threads[MAX_THREADS];
+    bool started[MAX_THREADS];
+    char *base = tasks;
+    for (size_t i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL,
+            fn, base + i * size) == 0;
+        if (!started[i]) { (void)fn(base + i * size); }
+    }
+    if (count > 0) { (void)fn(base); }
+    for (size_t i = 1; i < count; i++) {
+        if (started[i]) { (void)pthread_join(threads[i], NULL); }
+    }
+}
+
+static unsigned thread_count(unsigned nthreads, size_t count) {
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (nthreads > MAX_THREADS) { nthreads = MAX_THREADS; }
+    size_t useful = count / MIN_PER_THREAD;
+    if (useful < nthreads) { nthreads = useful > 0 ? (unsigned)useful : 1; }
+    return nthreads;
+}
+
+/* Stable merge of A and B into OUT. */
+static void merge_runs(skiplist_cmp_cb *cmp, struct pair *a, size_t na,
+        struct pair *b, size_t nb, struct pair *out) {
+    size_t i = 0, j = 0;
+    while (i < na && j < nb) {
+        if (cmp(a[i].k, b[j].k) <= 0) {
+            *out++ = a[i++];
+        } else {
+            *out++ = b[j++];
+        }
+    }
+    memcpy(out, a + i, (na - i) * sizeof(*a));
+    memcpy(out + (na - i), b + j, (nb - j) * sizeof(*b));
+}
+
+static void merge_sort(skiplist_cmp_cb *cmp, struct pair *a,
+        struct pair *tmp, size_t n) {
+    if (n <= SMALL_SORT) {
+        for (size_t i = 1; i < n; i++) {
+            struct pair cur = a[i];
+            size_t j = i;
+            while (j > 0 && cmp(a[j - 1].k, cur.k) > 0) {
+                a[j] = a[j - 1];
+                j--;
+            }
+            a[j] = cur;
+        }
+        return;
+    }
+    size_t half = n / 2;
+    merge_sort(cmp, a, tmp, half);
+    merge_sort(cmp, a + half, tmp, n - half);
+    merge_runs(cmp, a, half, a + half, n - half, tmp);
+    memcpy(a, tmp, n * sizeof(*a));
+}
+
+static void *sort_run(void *arg) {
+    struct sort_task *t = (struct sort_task *) arg;
+    merge_sort(t->cmp, t->a, t->tmp, t->n);
+    return NULL;
+}
+
+/* How many of the first D merged pairs come from A? Equal keys take
+ * A's first, to keep the merge stable. */
+static size_t co_rank(skiplist_cmp_cb *cmp, size_t d,
+        struct pair *a, size_t na, struct pair *b, size_t nb) {
+    size_t lo = d > nb ? d - nb : 0;
+    size_t hi = d < na ? d : na;
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        size_t j = d - i;
+        if (j > 0 && cmp(a[i].k, b[j - 1].k) <= 0) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+    return lo;
+}
+
+static void *merge_part(void *arg) {
+    struct merge_task *t = (struct merge_task *) arg;
+    size_t i0 = co_rank(t->cmp, t->lo, t->a, t->na, t->b, t->nb);
+    size_t i1 = co_rank(t->cmp, t->hi, t->a, t->na, t->b, t->nb);
+    size_t j0 = t->lo - i0;
+    size_t j1 = t->hi - i1;
+    merge_runs(t->cmp, t->a + i0, i1 - i0, t->b + j0, j1 - j0,
+        t->out + t->lo);
+    return NULL;
+}
+
+/* Sort P (COUNT pairs) using NTHREADS threads and scratch space TMP,
+ * which must be as large. Returns whichever of the two holds the
+ * result. */
+static struct pair *sort_pairs(skiplist_cmp_cb *cmp, struct pair *p,
+        struct pair *tmp, size_t count, unsigned nthreads) {
+    size_t bounds[MAX_THREADS + 1];
+    for (unsigned i = 0; i <= nthreads; i++) {
+        bounds[i] = count * i / nthreads;
+    }
+
+    struct sort_task sorts[MAX_THREADS];
+    for (unsigned i = 0; i < nthreads; i++) {
+        sorts[i].cmp = cmp;
+        sorts[i].a = p + bounds[i];
+        sorts[i].tmp = tmp + bounds[i];
+        sorts[i].n = bounds[i + 1] - bounds[i];
+    }
+    run_tasks(sort_run, sorts, sizeof(sorts[0]), nthreads);
+
+    /* Merge runs pairwise until there is only one. Each merge is split
+     * by output position, so every round keeps all threads busy. */
+    struct pair *src = p, *dst = tmp;
+    size_t runs = nthreads;
+    while (runs > 1) {
+        struct merge_task merges[MAX_THREADS];
+        size_t tasks = 0;
+        size_t pairs = (runs + 1) / 2;
+        size_t parts = nthreads / pairs;
+        if (parts == 0) { parts = 1; }
+        for (size_t r = 0; r < runs; r += 2) {
+            size_t lo = bounds[r];
+            size_t mid = bounds[r + 1];
+            size_t hi = r + 2 <= runs ? bounds[r + 2] : mid;
+            for (size_t q = 0; q < parts; q++) {
+                struct merge_task *t = &merges[tasks++];
+                t->cmp = cmp;
+                t->a = src + lo;
+                t->na = mid - lo;
+                t->b = src + mid;
+                t->nb = hi - mid;
+                t->out = dst + lo;
+                t->lo = (hi - lo) * q / parts;
+                t->hi = (hi - lo) * (q + 1) / parts;
+            }
+        }
+        run_tasks(merge_part, merges, sizeof(merges[0]), tasks);
+
+        for (size_t r = 0; r < pairs; r++) {
+            bounds[r] = bounds[2 * r];
+        }
+        bounds[pairs] = count;
+        runs = pairs;
+        struct pair *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    return src;
+}
+
+#ifndef SKIPLIST_GEN_HEIGHT
+/* Same distribution as the default SKIPLIST_GEN_HEIGHT, but from a
+ * per-thread xorshift generator, so the threads don't all contend on
+ * random()'s lock. */
+static uint8_t gen_height(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    uint8_t h = 1;
+    for (uint8_t bit = 0; bit < 63 && (x & ((uint64_t)1 << bit)); bit++) {
+        h++;
+    }
+    return (uint8_t)(h > SKIPLIST_MAX_HEIGHT ? SKIPLIST_MAX_HEIGHT : h);
+}
+#endif
+
+static void *build_segment(void *arg) {
+    struct segment *s = (struct segment *) arg;
+    uint64_t state = s->seed;
+    for (size_t i = 0; i < s->n; i++) {
+#ifdef SKIPLIST_GEN_HEIGHT
+        uint8_t h = SKIPLIST_GEN_HEIGHT();
+        (void)state;
+#else
+        uint8_t h = gen_height(&state);
+#endif
+        struct skiplist_node *n = skiplist_node_alloc(s->sl, h,
+            s->p[i].k, s->p[i].v);
+        if (n == NULL) {
+            s->failed = true;
+            break;
+        }
+        for (int lvl = 0; lvl < h; lvl++) {
+            if (s->last[lvl] == NULL) {
+                s->first[lvl] = n;
+            } else {
+                s->last[lvl]->next[lvl] = n;
+            }
+            s->last[lvl] = n;
+        }
+        if (h > s->height) { s->height = h; }
+    }
+    return NULL;
+}
+
+/* Free every node in a segment that was not joined to the list. */
+static void free_segment(struct skiplist *sl, struct segment *s) {
+    struct skiplist_node *n = s->first[0];
+    while (n != NULL && !IS_SENTINEL(n)) {
+        struct skiplist_node *next = n->next[0];
+        skiplist_node_free(sl, n);
+        n = next;
+    }
+}
+
+/* Build SL's nodes from the sorted pairs, one segment per thread, then
+ * join each level's chains left to right under a new head. */
+static bool build_nodes(struct skiplist *sl, struct pair *p,
+        size_t count, unsigned nthreads) {
+    struct segment *segs = sl->alloc(NULL, 0,
+        nthreads * sizeof(*segs), sl->alloc_udata);
+    if (segs == NULL) { return false; }
+    for (unsigned i = 0; i < nthreads; i++) {
+        struct segment *s = &segs[i];
+        size_t lo = count * i / nthreads;
+        s->sl = sl;
+        s->p = p + lo;
+        s->n = count * (i + 1) / nthreads - lo;
+        /* Seeded from random(), so skiplist_set_seed still applies. */
+        s->seed = (((uint64_t)random() << 32) ^ (uint64_t)random()) | 1;
+        s->height = 1;
+        s->failed = false;
+        memset(s->first, 0, sizeof(s->first));
+        memset(s->last, 0, sizeof(s->last));
+    }
+    run_tasks(build_segment, segs, sizeof(segs[0]), nthreads);
+
+    bool ok = true;
+    int height = 1;
+    for (unsigned i = 0; i < nthreads; i++) {
+        if (segs[i].failed) { ok = false; }
+        if (segs[i].height > height) { height = segs[i].height; }
+    }
+
+    struct skiplist_node *head = NULL;
+    if (ok) {
+        head = skiplist_node_alloc(sl, (uint8_t)height,
+            &SENTINEL, &SENTINEL);
+        ok = head != NULL;
+    }
+    if (!ok) {
+        for (unsigned i = 0; i < nthreads; i++) {
+            free_segment(sl, &segs[i]);
+        }
+        sl->alloc(segs, nthreads * sizeof(*segs), 0, sl->alloc_udata);
+        return false;
+    }
+
+    for (int lvl = 0; lvl < height; lvl++) {
+        struct skiplist_node *prev = head;
+        for (unsigned i = 0; i < nthreads; i++) {
+            if (segs[i].first[lvl] == NULL) { continue; }
+            prev->next[lvl] = segs[i].first[lvl];
+            prev = segs[i].last[lvl];
+        }
+    }
+    skiplist_node_free(sl, sl->head);
+    sl->head = head;
+    sl->count = count;
+    sl->alloc(segs, nthreads * sizeof(*segs), 0, sl->alloc_udata);
+    return true;
+}
+
+struct skiplist *skiplist_build_parallel(skiplist_cmp_cb *cmp,
+        skiplist_alloc_cb *alloc, void *alloc_udata,
+        size_t count, void **keys, void **values, unsigned nthreads) {
+    if (count > 0 && keys == NULL) { return NULL; }
+    if (count > SIZE_MAX / (2 * sizeof(struct pair))) { return NULL; }
+    struct skiplist *sl = skiplist_new(cmp, alloc, alloc_udata);
+    if (sl == NULL || count == 0) { return sl; }
+
+    size_t size = count * sizeof(struct pair);
+    struct pair *p = sl->alloc(NULL, 0, size, sl->alloc_udata);
+    struct pair *tmp = sl->alloc(NULL, 0, size, sl->alloc_udata);
+    bool ok = p != NULL && tmp != NULL;
+    if (ok) {
+        for (size_t i = 0; i < count; i++) {
+            p[i].k = keys[i];
+            p[i].v = values ? values[i] : NULL;
+        }
+        nthreads = thread_count(nthreads, count);
+        struct pair *sorted = sort_pairs(cmp, p, tmp, count, nthreads);
+        ok = build_nodes(sl, sorted, count, nthreads);
+    }
+    if (p) { sl->alloc(p, size, 0, sl->alloc_udata); }
+    if (tmp) { sl->alloc(tmp, size, 0, sl->alloc_udata); }
+    if (!ok) {
+        skiplist_free(sl, NULL, NULL);
+        return NULL;
+    }
+    return sl;
+}
+
+static void *iter_part(void *arg) {
+    struct part *p = (struct part *) arg;
+    for (struct skiplist_node *n = p->from; n != p->to; n = n->next[0]) {
+        if (!IS_LIVE(n)) { continue; }
+        if (p->cb(n->k, n->v, p->udata) == SKIPLIST_ITER_HALT) { break; }
+    }
+    return NULL;
+}
+
+/* How many nodes are linked at level LVL? */
+static size_t level_count(struct skiplist *sl, int lvl) {
+    size_t ct = 0;
+    for (struct skiplist_node *n = sl->head->next[lvl];
+         !IS_SENTINEL(n); n = n->next[lvl]) {
+        ct++;
+    }
+    return ct;
+}
+
+bool skiplist_parallel_iter(struct skiplist *sl, unsigned nthreads,
+        skiplist_iter_cb *cb, void **udata,
+        skiplist_parallel_merge_cb *merge) {
+    assert(sl);
+    assert(cb);
+    if (nthreads == 0 || nthreads > MAX_THREADS) { return false; }
+    STAT_OP(sl, SKIPLIST_OP_ITER);
+
+    /* Split at evenly spaced nodes on the highest level that has
+     * enough of them; nodes there are spaced about 2^level apart. */
+    int lvl = sl->head->h - 1;
+    size_t ct = level_count(sl, lvl);
+    while (lvl > 0 && ct < nthreads) {
+        lvl--;
+        ct = level_count(sl, lvl);
+    }
+
+    struct part parts[MAX_THREADS];
+    parts[0].from = sl->head->next[0];
+    struct skiplist_node *n = sl->head->next[lvl];
+    size_t pos = 0;
+    for (unsigned i = 1; i < nthreads; i++) {
+        size_t want = ct * i / nthreads;
+        while (pos < want) {
+            n = n->next[lvl];
+            pos++;
+        }
+        parts[i].from = n;
+    }
+    for (unsigned i = 0; i < nthreads; i++) {
+        parts[i].to = i + 1 < nthreads ? parts[i + 1].from : &SENTINEL;
+        parts[i].cb = cb;
+        parts[i].udata = udata[i];
+    }
+    run_tasks(iter_part, parts, sizeof(parts[0]), nthreads);
+
+    if (merge) {
+        for (unsigned i = 1; i < nthreads; i++) { merge(udata[0], udata[i]); }
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Parallel bulk operations on an ordinary struct skiplist.
+ *
+ * These split one large job over several pthreads, and return once
+ * all of them are done, so the caller does not need to do any
+ * locking. The skiplist must not be modified while they run.
+ */
+
+#ifndef SKIPLIST_PARALLEL_H
+#define SKIPLIST_PARALLEL_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Upper bound on how many threads are used. */
+#define SKIPLIST_PARALLEL_MAX_THREADS 64
+
+/* Build a new skiplist holding COUNT key/value pairs, from KEYS[i] and
+ * VALUES[i], which can be in any order. VALUES can be NULL, to use a
+ * NULL value for every key. The pairs are sorted with a parallel merge
+ * sort, disjoint runs of nodes are linked by separate threads, and
+ * then their towers are joined at the boundaries. Equal keys keep
+ * their input order. The arrays are not modified.
+ *
+ * NTHREADS of 0 means one thread per online CPU. Small inputs use
+ * fewer threads than requested. ALLOC (or malloc & free, if NULL) is
+ * called from several threads at once, so must be thread-safe.
+ *
+ * Returns the skiplist, which is used exactly like one from
+ * skiplist_new, or NULL on error. */
+struct skiplist *skiplist_build_parallel(skiplist_cmp_cb *cmp,
+    skiplist_alloc_cb *alloc, void *alloc_udata,
+    size_t count, void **keys, void **values, unsigned nthreads);
+
+/* Callback to combine the results of two partitions of
+ * skiplist_parallel_iter: fold FROM's into INTO. */
+typedef void skiplist_parallel_merge_cb(void *into, void *from);
+
+/* Iterate over SL with NTHREADS threads at once, each walking one
+ * contiguous partition of its pairs. The list's tallest nodes are used
+ * as split points, so the partitions are close to the same size.
+ *
+ * CB is called as with skiplist_iter, but gets UDATA[i] for partition
+ * i, so each thread can build its own result without locking. All
+ * keys in partition i come before those in partition i+1. Returning
+ * SKIPLIST_ITER_HALT only stops that partition.
+ *
+ * If MERGE is non-NULL, once every thread is done it is called as
+ * MERGE(UDATA[0], UDATA[i]) for i = 1 to NTHREADS-1, in order, leaving
+ * the combined result in UDATA[0]. Partitions may be empty, so every
+ * UDATA[i] should start out as an identity for MERGE.
+ *
+ * Returns false (without calling CB) if NTHREADS is 0 or more than
+ * SKIPLIST_PARALLEL_MAX_THREADS. */
+bool skiplist_parallel_iter(struct skiplist *sl, unsigned nthreads,
+    skiplist_iter_cb *cb, void **udata, skiplist_parallel_merge_cb *merge);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
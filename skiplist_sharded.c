@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist_sharded.h"
+#include "skiplist_macros_internal.h"
+
+struct shard {
+    pthread_mutex_t lock;
+    struct skiplist *sl;
+    size_t count;           /* copy of skiplist_count, read unlocked */
+    unsigned adds;          /* since the last skew check */
+} CACHE_ALIGNED;
+
+#define SHARDS_ALLOC_SIZE(N) CACHE_ALLOC_SIZE((N) * sizeof(struct shard))
+
+struct skiplist_sharded {
+    size_t shard_count;
+    struct shard *shards;
+    void *shards_block;     /* as allocated, for freeing */
+    /* splits[i] bounds shard i from above, and shard i + 1 from
+     * below. Only changed while holding both of their locks. */
+    void **splits;
+    pthread_mutex_t rebalance_lock;
+    skiplist_cmp_cb *cmp;
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+/* Split point above every key, for shards that are still empty. */
+static char UNBOUNDED_BYTE;
+#define UNBOUNDED ((void *)&UNBOUNDED_BYTE)
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+static void free_shards(struct skiplist_sharded *ss, size_t built,
+        skiplist_free_cb *cb, void *udata, size_t *ct) {
+    for (size_t i = 0; i < built; i++) {
+        size_t n = skiplist_free(ss->shards[i].sl, cb, udata);
+        if (ct) { *ct += n; }
+        pthread_mutex_destroy(&ss->shards[i].lock);
+    }
+    ss->alloc(ss->shards_block, SHARDS_ALLOC_SIZE(ss->shard_count),
+        0, ss->alloc_udata);
+    ss->alloc(ss->splits, ss->shard_count * sizeof(void *),
+        0, ss->alloc_udata);
+    pthread_mutex_destroy(&ss->rebalance_lock);
+    ss->alloc(ss, sizeof(*ss), 0, ss->alloc_udata);
+}
+
+struct skiplist_sharded *skiplist_sharded_new(skiplist_cmp_cb *cmp,
+        skiplist_alloc_cb *alloc, void *alloc_udata,
+        size_t shard_count, void **splits) {
+    if (cmp == NULL || shard_count == 0) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+
+    struct skiplist_sharded *ss = alloc(NULL, 0, sizeof(*ss), alloc_udata);
+    if (ss == NULL) { return NULL; }
+    ss->shard_count = shard_count;
+    ss->cmp = cmp;
+    ss->alloc = alloc;
+    ss->alloc_udata = alloc_udata;
+    ss->shards_block = alloc(NULL, 0, SHARDS_ALLOC_SIZE(shard_count),
+        alloc_udata);
+    ss->splits = alloc(NULL, 0, shard_count * sizeof(void *), alloc_udata);
+    if (ss->shards_block == NULL || ss->splits == NULL) {
+        if (ss->shards_block) {
+            alloc(ss->shards_block, SHARDS_ALLOC_SIZE(shard_count),
+                0, alloc_udata);
+        }
+        if (ss->splits) {
+            alloc(ss->splits, shard_count * sizeof(void *), 0, alloc_udata);
+        }
+        alloc(ss, sizeof(*ss), 0, alloc_udata);
+        return NULL;
+    }
+    ss->shards = CACHE_ALIGN_PTR(ss->shards_block);
+    pthread_mutex_init(&ss->rebalance_lock, NULL);
+
+    for (size_t i = 0; i < shard_count - 1; i++) {
+        ss->splits[i] = splits ? splits[i] : UNBOUNDED;
+        assert(splits == NULL || i == 0 || cmp(splits[i - 1], splits[i]) <= 0);
+    }
+    ss->splits[shard_count - 1] = UNBOUNDED;   /* last shard's bound */
+
+    for (size_t i = 0; i < shard_count; i++) {
+        struct shard *sh = &ss->shards[i];
+        sh->sl = skiplist_new(cmp, alloc, alloc_udata);
+        if (sh->sl == NULL) {
+            free_shards(ss, i, NULL, NULL, NULL);
+            return NULL;
+        }
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->count = 0;
+        sh->adds = 0;
+    }
+    return ss;
+}
+
+/* Does KEY belong below split point SPLIT? */
+static bool below(struct skiplist_sharded *ss, void *key, void *split) {
+    return split == UNBOUNDED || ss->cmp(key, split) < 0;
+}
+
+/* Index of the shard KEY currently belongs in. The split points can
+ * move during the search, so this is only a guess until that shard
+ * is locked and in_range agrees. */
+static size_t route(struct skiplist_sharded *ss, void *key) {
+    size_t lo = 0, hi = ss->shard_count - 1;
+    while (lo < hi) {           /* first split that KEY is below */
+        size_t mid = lo + (hi - lo) / 2;
+        if (below(ss, key, ATOMIC_LOAD(&ss->splits[mid]))) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/* Does KEY belong in shard I? Only stable while I is locked. */
+static bool in_range(struct skiplist_sharded *ss, size_t i, void *key) {
+    if (i > 0 && below(ss, key, ss->splits[i - 1])) { return false; }
+    return below(ss, key, ss->splits[i]);
+}
+
+/* Lock and return the shard that KEY belongs in. */
+static struct shard *lock_shard(struct skiplist_sharded *ss, void *key) {
+    for (;;) {
+        size_t i = route(ss, key);
+        struct shard *sh = &ss->shards[i];
+        pthread_mutex_lock(&sh->lock);
+        if (in_range(ss, i, key)) { return sh; }
+        pthread_mutex_unlock(&sh->lock);    /* raced a rebalance */
+    }
+}
+
+static void unlock_shard(struct shard *sh) {
+    __atomic_store_n(&sh->count, skiplist_count(sh->sl), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+/* Is the shard holding too many more pairs than the smallest one? */
+static bool too_hot(struct skiplist_sharded *ss, struct shard *sh) {
+    size_t count = __atomic_load_n(&sh->count, __ATOMIC_RELAXED);
+    if (count <= SKIPLIST_SHARD_CHECK_INTERVAL) { return false; }
+    for (size_t i = 0; i < ss->shard_count; i++) {
+        size_t other = __atomic_load_n(&ss->shards[i].count,
+            __ATOMIC_RELAXED);
+        if (count > SKIPLIST_SHARD_SKEW * other) { return true; }
+    }
+    return false;
+}
+
+static size_t rebalance(struct skiplist_sharded *ss, bool wait);
+
+static bool add_or_set(struct skiplist_sharded *ss, bool replace,
+        void *key, void *value, void **old) {
+    assert(ss);
+    struct shard *sh = lock_shard(ss, key);
+    bool res = replace
+      ? skiplist_set(sh->sl, key, value, old)
+      : skiplist_add(sh->sl, key, value);
+    bool check = ++sh->adds == SKIPLIST_SHARD_CHECK_INTERVAL;
+    if (check) { sh->adds = 0; }
+    unlock_shard(sh);
+
+    /* Leave it alone if another thread is already rebalancing. */
+    if (check && ss->shard_count > 1 && too_hot(ss, sh)) {
+        (void)rebalance(ss, false);
+    }
+    return res;
+}
+
+bool skiplist_sharded_add(struct skiplist_sharded *ss,
+        void *key, void *value) {
+    return add_or_set(ss, false, key, value, NULL);
+}
+
+bool skiplist_sharded_set(struct skiplist_sharded *ss,
+        void *key, void *value, void **old) {
+    return add_or_set(ss, true, key, value, old);
+}
+
+bool skiplist_sharded_get(struct skiplist_sharded *ss,
+        void *key, void **value) {
+    assert(ss);
+    struct shard *sh = lock_shard(ss, key);
+    bool res = skiplist_get(sh->sl, key, value);
+    pthread_mutex_unlock(&sh->lock);
+    return res;
+}
+
+bool skiplist_sharded_member(struct skiplist_sharded *ss, void *key) {
+    return skiplist_sharded_get(ss, key, NULL);
+}
+
+bool skiplist_sharded_delete(struct skiplist_sharded *ss,
+        void *key, void **value) {
+    assert(ss);
+    struct shard *sh = lock_shard(ss, key);
+    bool res = skiplist_delete(sh->sl, key, value);
+    unlock_shard(sh);
+    return res;
+}
+
+void skiplist_sharded_delete_all(struct skiplist_sharded *ss, void *key,
+        skiplist_free_cb *cb, void *udata) {
+    assert(ss);
+    assert(cb);
+    struct shard *sh = lock_shard(ss, key);
+    skiplist_delete_all(sh->sl, key, cb, udata);
+    unlock_shard(sh);
+}
+
+size_t skiplist_sharded_count(struct skiplist_sharded *ss) {
+    assert(ss);
+    size_t total = 0;
+    for (size_t i = 0; i < ss->shard_count; i++) {
+        total += __atomic_load_n(&ss->shards[i].count, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/* Wraps the caller's callback, to notice when it halts. */
+struct stitch {
+    skiplist_iter_cb *cb;
+    void *udata;
+    bool halted;
+};
+
+static enum skiplist_iter_res stitch_cb(void *key, void *value,
+        void *udata) {
+    struct stitch *s = (struct stitch *)udata;
+    enum skiplist_iter_res res = s->cb(key, value, s->udata);
+    if (res != SKIPLIST_ITER_CONTINUE) { s->halted = true; }
+    return res;
+}
+
+/* Iterate over the shards after I, which is locked by the caller.
+ * Locks are taken hand-over-hand, so pairs cannot be migrated across
+ * the boundary between visited and unvisited shards. */
+static void iter_rest(struct skiplist_sharded *ss, size_t i,
+        struct stitch *s) {
+    while (!s->halted && i + 1 < ss->shard_count) {
+        pthread_mutex_lock(&ss->shards[i + 1].lock);
+        pthread_mutex_unlock(&ss->shards[i].lock);
+        i++;
+        skiplist_iter(ss->shards[i].sl, stitch_cb, s);
+    }
+    pthread_mutex_unlock(&ss->shards[i].lock);
+}
+
+void skiplist_sharded_iter(struct skiplist_sharded *ss,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(ss);
+    assert(cb);
+    struct stitch s = { cb, udata, false };
+    pthread_mutex_lock(&ss->shards[0].lock);
+    skiplist_iter(ss->shards[0].sl, stitch_cb, &s);
+    iter_rest(ss, 0, &s);
+}
+
+void skiplist_sharded_iter_from(struct skiplist_sharded *ss, void *key,
+        skiplist_iter_cb *cb, void *udata) {
+    assert(ss);
+    assert(cb);
+    struct stitch s = { cb, udata, false };
+    struct shard *sh = lock_shard(ss, key);
+    /* Like skiplist_iter_from, do nothing if KEY is not present. */
+    if (!skiplist_member(sh->sl, key)) {
+        pthread_mutex_unlock(&sh->lock);
+        return;
+    }
+    skiplist_iter_from(sh->sl, key, stitch_cb, &s);
+    iter_rest(ss, (size_t)(sh - ss->shards), &s);
+}
+
+/* Move the pairs with shard A's last key to the start of shard B.
+ * Each pair is added before it is removed, so an allocation failure
+ * loses nothing. Returns how many pairs were moved. */
+static size_t push_last_key(struct skiplist_sharded *ss,
+        struct skiplist *a, struct skiplist *b, void **moved_key) {
+    void *key = NULL, *k = NULL, *v = NULL;
+    size_t ct = 0;
+    if (!skiplist_last(a, &key, NULL)) { return 0; }
+    do {
+        if (!skiplist_last(a, &k, &v)) { break; }
+        if (ss->cmp(k, key) != 0) { break; }
+        if (!skiplist_add(b, k, v)) { break; }
+        (void)skiplist_pop_last(a, NULL, NULL);
+        ct++;
+    } while (true);
+    *moved_key = key;
+    return ct;
+}
+
+/* Move the pairs with shard B's first key to the end of shard A. */
+static size_t pull_first_key(struct skiplist_sharded *ss,
+        struct skiplist *a, struct skiplist *b) {
+    void *key = NULL, *k = NULL, *v = NULL;
+    size_t ct = 0;
+    if (!skiplist_first(b, &key, NULL)) { return 0; }
+    do {
+        if (!skiplist_first(b, &k, &v)) { break; }
+        if (ss->cmp(k, key) != 0) { break; }
+        if (!skiplist_add(a, k, v)) { break; }
+        (void)skiplist_pop_first(b, NULL, NULL);
+        ct++;
+    } while (true);
+    return ct;
+}
+
+/* Walk the boundaries left to right. Shard I gives pairs to, or takes
+ * pairs from, shard I + 1 until the shards up to I hold their share of
+ * the total. Returns how many pairs were moved. */
+static size_t rebalance_pass(struct skiplist_sharded *ss) {
+    size_t n = ss->shard_count, moved = 0;
+    size_t total = skiplist_sharded_count(ss), before = 0;
+    for (size_t i = 0; i + 1 < n; i++) {
+        struct shard *sa = &ss->shards[i], *sb = &ss->shards[i + 1];
+        struct skiplist *a = sa->sl, *b = sb->sl;
+        pthread_mutex_lock(&sa->lock);
+        pthread_mutex_lock(&sb->lock);
+        size_t goal = total * (i + 1) / n;
+        size_t want = goal > before ? goal - before : 0;
+
+        if (skiplist_count(a) > want) {
+            void *key = NULL;
+            size_t ct = 0;
+            while (skiplist_count(a) > want &&
+                   (ct = push_last_key(ss, a, b, &key)) > 0) {
+                moved += ct;
+                ATOMIC_STORE(&ss->splits[i], key);
+            }
+        } else {
+            size_t ct = 0;
+            while (skiplist_count(a) < want &&
+                   (ct = pull_first_key(ss, a, b)) > 0) {
+                moved += ct;
+                void *next = ss->splits[i + 1];
+                (void)skiplist_first(b, &next, NULL);
+                ATOMIC_STORE(&ss->splits[i], next);
+            }
+        }
+
+        before += skiplist_count(a);
+        unlock_shard(sb);
+        unlock_shard(sa);
+    }
+    return moved;
+}
+
+/* Rebalance until the shards even out. If WAIT is false and another
+ * thread is already rebalancing, return 0 at once instead. */
+static size_t rebalance(struct skiplist_sharded *ss, bool wait) {
+    size_t moved = 0, ct = 0;
+    if (wait) {
+        pthread_mutex_lock(&ss->rebalance_lock);
+    } else if (pthread_mutex_trylock(&ss->rebalance_lock) != 0) {
+        return 0;
+    }
+    /* A pass only pulls pairs one shard to the left, so if shard I + 1
+     * runs dry before shard I has its share, it takes another. No pair
+     * needs to move more than shard_count - 1 shards. */
+    for (size_t pass = 1; pass < ss->shard_count; pass++) {
+        if ((ct = rebalance_pass(ss)) == 0) { break; }
+        moved += ct;
+    }
+    pthread_mutex_unlock(&ss->rebalance_lock);
+    return moved;
+}
+
+size_t skiplist_sharded_rebalance(struct skiplist_sharded *ss) {
+    assert(ss);
+    return rebalance(ss, true);
+}
+
+size_t skiplist_sharded_free(struct skiplist_sharded *ss,
+        skiplist_free_cb *cb, void *udata) {
+    assert(ss);
+    size_t ct = 0;
+    free_shards(ss, ss->shard_count, cb, udata, &ct);
+    return ct;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Range-partitioned skiplist.
+ *
+ * The key space is split into N ranges by N-1 split points, and each
+ * range (shard) is an ordinary skiplist behind its own mutex, so
+ * writers to different ranges never touch the same memory. Point
+ * operations lock a single shard. Iteration walks the shards in key
+ * order, holding at most two shard locks at a time.
+ *
+ * Split points can be given up front, or left out and picked from the
+ * data: skiplist_sharded_rebalance moves the pairs at the edges of
+ * each shard into its neighbors until the shards hold roughly equal
+ * numbers of pairs, and it runs automatically when an add finds its
+ * shard holding more than SKIPLIST_SHARD_SKEW times as many pairs
+ * as the smallest one.
+ *
+ * Split points are compared against long after they were chosen, so
+ * a key picked as a split point (from the arguments to new, or by
+ * rebalancing) must stay valid until skiplist_sharded_free, even if
+ * its pair is deleted. This is free for keys that are not pointers
+ * to memory, such as integers cast to void *.
+ */
+
+#ifndef SKIPLIST_SHARDED_H
+#define SKIPLIST_SHARDED_H
+
+#include "skiplist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque sharded skiplist type. */
+struct skiplist_sharded;
+
+/* Create a new sharded skiplist with SHARD_COUNT shards, returns NULL
+ * on error. SPLITS, if non-NULL, holds SHARD_COUNT - 1 ascending keys:
+ * keys below SPLITS[0] go to the first shard, keys in
+ * [SPLITS[i-1], SPLITS[i]) to shard i, and the rest to the last.
+ * If SPLITS is NULL, every key goes to the first shard until the
+ * first rebalance. Other arguments are the same as skiplist_new,
+ * but ALLOC must be thread-safe. */
+struct skiplist_sharded *skiplist_sharded_new(skiplist_cmp_cb *cmp,
+    skiplist_alloc_cb *alloc, void *alloc_udata,
+    size_t shard_count, void **splits);
+
+/* Same as the corresponding skiplist_* functions, and safe to call
+ * from any number of threads at once. */
+bool skiplist_sharded_add(struct skiplist_sharded *ss,
+    void *key, void *value);
+bool skiplist_sharded_set(struct skiplist_sharded *ss,
+    void *key, void *value, void **old);
+bool skiplist_sharded_get(struct skiplist_sharded *ss,
+    void *key, void **value);
+bool skiplist_sharded_member(struct skiplist_sharded *ss, void *key);
+bool skiplist_sharded_delete(struct skiplist_sharded *ss,
+    void *key, void **value);
+void skiplist_sharded_delete_all(struct skiplist_sharded *ss, void *key,
+    skiplist_free_cb *cb, void *udata);
+
+/* How many pairs are in the skiplist? Only a snapshot, if other
+ * threads are writing. */
+size_t skiplist_sharded_count(struct skiplist_sharded *ss);
+
+/* Iterate over every shard in key order, from the start or from KEY.
+ * Pairs are never skipped or repeated because of a concurrent
+ * rebalance. CB is called with a shard locked, so it must not call
+ * back into the same sharded skiplist. */
+void skiplist_sharded_iter(struct skiplist_sharded *ss,
+    skiplist_iter_cb *cb, void *udata);
+void skiplist_sharded_iter_from(struct skiplist_sharded *ss, void *key,
+    skiplist_iter_cb *cb, void *udata);
+
+/* Move split points, and the pairs at each shard's edges across them,
+ * until the shards hold roughly equal numbers of pairs.
+ * Returns how many pairs were moved. */
+size_t skiplist_sharded_rebalance(struct skiplist_sharded *ss);
+
+/* Free the sharded skiplist, calling CB (if non-NULL) on every pair.
+ * No other thread may be using it. Returns the number of pairs removed. */
+size_t skiplist_sharded_free(struct skiplist_sharded *ss,
+    skiplist_free_cb *cb, void *udata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "skiplist_config.h"
+#include "skiplist.h"
+#include "skiplist_wal.h"
+#include "skiplist_macros_internal.h"
+#include "skiplist_internal.h"
+
+/* File layout: the magic, then records. Each record is a struct
+ * record, then the key and the value, each padded to a multiple of 8
+ * bytes. SUM covers everything after it, so a record cut short by a
+ * crash is detected and dropped on replay. */
+#define MAGIC "skipwal1"
+
+enum op { OP_ADD = 1, OP_SET, OP_DELETE };
+
+struct record {
+    uint32_t sum;
+    uint8_t op;
+    uint8_t pad[3];
+    uint32_t klen;
+    uint32_t vlen;
+};
+
+#define PAD8(n) (((n) + 7) & ~(size_t)7)
+
+/* Initial size of the record buffers. */
+#define DEF_BUF (64 * 1024)
+
+/* How many adds to hand to skiplist_add_sorted at a time on replay. */
+#define REPLAY_CHUNK 256
+
+struct skiplist_wal {
+    pthread_mutex_t lock;
+    pthread_cond_t synced;
+    int fd;
+    struct skiplist *sl;
+    const struct skiplist_codec *kc;
+    const struct skiplist_codec *vc;
+    size_t group_bytes;
+    unsigned group_usec;
+
+    unsigned char *buf;         /* records not yet written */
+    size_t used;
+    size_t cap;
+    unsigned char *spare;       /* being written by the syncing thread */
+    size_t spare_cap;
+    struct timespec batch_start;
+
+    uint64_t appended;          /* records appended */
+    uint64_t durable;           /* records synced */
+    bool syncing;
+    bool failed;
+
+    void *replay_base;          /* mapping the replayed pairs point into */
+    size_t replay_size;
+
+    skiplist_alloc_cb *alloc;
+    void *alloc_udata;
+};
+
+static void *def_alloc(void *p,
+        size_t osize, size_t nsize, void *udata) {
+    (void)udata;
+    (void)osize;
+    if (p) {
+        assert(nsize == 0);
+        free(p);
+        return NULL;
+    } else {
+        assert(osize == 0);
+        return malloc(nsize);
+    }
+}
+
+/* FNV-1a. */
+static uint32_t checksum(const unsigned char *p, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static size_t codec_size(const struct skiplist_codec *c, void *x) {
+    return c ? c->size(x, c->udata) : sizeof(x);
+}
+
+static void codec_encode(const struct skiplist_codec *c,
+        void *x, void *buf) {
+    if (c) {
+        c->encode(x, buf, c->udata);
+    } else {
+        memcpy(buf, &x, sizeof(x));
+    }
+}
+
+static void *codec_decode(const struct skiplist_codec *c,
+        const void *buf, size_t len) {
+    if (c) { return c->decode(buf, len, c->udata); }
+    void *x = NULL;
+    memcpy(&x, buf, len < sizeof(x) ? len : sizeof(x));
+    return x;
+}
+
+static bool write_all(int fd, const unsigned char *p, size_t len) {
+    while (len > 0) {
+        ssize_t wr = write(fd, p, len);
+        if (wr == -1) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += wr;
+        len -= (size_t)wr;
+    }
+    return true;
+}
+
+/* Replay the records in the mapping, and return the offset of the end
+ * of the last good one, or 0 on alloc failure. */
+static size_t replay(struct skiplist_wal *w,
+        const unsigned char *base, size_t size) {
+    void *keys[REPLAY_CHUNK];
+    void *values[REPLAY_CHUNK];
+    size_t pending = 0;
+    size_t off = sizeof(MAGIC) - 1;
+
+    while (off + sizeof(struct record) <= size) {
+        struct record r;
+        memcpy(&r, base + off, sizeof(r));
+        size_t klen = PAD8((size_t)r.klen), vlen = PAD8((size_t)r.vlen);
+        size_t len = sizeof(r) + klen + vlen;
+        if (len > size - off || r.op < OP_ADD || r.op > OP_DELETE
+            || r.sum != checksum(base + off + sizeof(r.sum),
+                len - sizeof(r.sum))) {
+            break;              /* torn or corrupt tail */
+        }
+        const unsigned char *kp = base + off + sizeof(r);
+        void *k = codec_decode(w->kc, kp, r.klen);
+        void *v = r.op == OP_DELETE ? NULL
+          : codec_decode(w->vc, kp + klen, r.vlen);
+
+        /* Flush the run of sorted adds when it ends. */
+        if (pending > 0 && (r.op != OP_ADD || pending == REPLAY_CHUNK
+                || w->sl->cmp(keys[pending - 1], k) > 0)) {
+            if (skiplist_add_sorted(w->sl, pending, keys, values)
+                < pending) {
+                return 0;
+            }
+            pending = 0;
+        }
+
+        switch ((enum op)r.op) {
+        case OP_ADD:
+            keys[pending] = k;
+            values[pending] = v;
+            pending++;
+            break;
+        case OP_SET:
+            if (!skiplist_set(w->sl, k, v, NULL)) { return 0; }
+            break;
+        case OP_DELETE:
+            (void)skiplist_delete(w->sl, k, NULL);
+            break;
+        }
+        off += len;
+    }
+
+    if (pending > 0
+        && skiplist_add_sorted(w->sl, pending, keys, values) < pending) {
+        return 0;
+    }
+    return off;
+}
+
+/* Map and replay an existing log, then cut off any torn tail. */
+static bool open_existing(struct skiplist_wal *w, size_t size) {
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, w->fd, 0);
+    if (base == MAP_FAILED) { return false; }
+    w->replay_base = base;
+    w->replay_size = size;
+    if (size < sizeof(MAGIC) - 1
+        || memcmp(base, MAGIC, sizeof(MAGIC) - 1) != 0) {
+        return false;
+    }
+    posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+
+    size_t end = replay(w, base, size);
+    if (end == 0
+        || (end < size && ftruncate(w->fd, (off_t)end) == -1)
+        || lseek(w->fd, (off_t)end, SEEK_SET) == -1) {
+        /* The replayed pairs may point into the mapping, which
+         * goes away with the log. */
+        (void)skiplist_clear(w->sl, NULL, NULL);
+        return false;
+    }
+    return true;
+}
+
+struct skiplist_wal *skiplist_wal_open(const char *path,
+        struct skiplist *sl, const struct skiplist_wal_config *config,
+        skiplist_alloc_cb *alloc, void *alloc_udata) {
+    if (path == NULL || sl == NULL) { return NULL; }
+    if (alloc == NULL) { alloc = def_alloc; }
+    struct skiplist_wal *w = alloc(NULL, 0, sizeof(*w), alloc_udata);
+    if (w == NULL) { return NULL; }
+    memset(w, 0, sizeof(*w));
+    w->sl = sl;
+    if (config) {
+        w->kc = config->key_codec;
+        w->vc = config->value_codec;
+        w->group_bytes = config->group_bytes;
+        w->group_usec = config->group_usec;
+    }
+    w->alloc = alloc;
+    w->alloc_udata = alloc_udata;
+    w->fd = -1;
+    w->replay_base = MAP_FAILED;
+
+    w->buf = alloc(NULL, 0, DEF_BUF, alloc_udata);
+    w->spare = alloc(NULL, 0, DEF_BUF, alloc_udata);
+    if (w->buf == NULL || w->spare == NULL) { goto fail; }
+    w->cap = w->spare_cap = DEF_BUF;
+
+    w->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (w->fd == -1) { goto fail; }
+    struct stat st;
+    if (fstat(w->fd, &st) == -1) { goto fail; }
+    if (st.st_size == 0) {
+        if (!write_all(w->fd, (const unsigned char *)MAGIC,
+                sizeof(MAGIC) - 1) || fsync(w->fd) == -1) {
+            goto fail;
+        }
+    } else if (!open_existing(w, (size_t)st.st_size)) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->synced, NULL);
+    return w;
+
+fail:
+    if (w->replay_base != MAP_FAILED) {
+        munmap(w->replay_base, w->replay_size);
+    }
+    if (w->fd != -1) { close(w->fd); }
+    if (w->buf) { alloc(w->buf, w->cap, 0, alloc_udata); }
+    if (w->spare) { alloc(w->spare, w->spare_cap, 0, alloc_udata); }
+    alloc(w, sizeof(*w), 0, alloc_udata);
+    return NULL;
+}
+
+/* Make room for LEN more bytes in the buffer. Called with the lock
+ * held; only the current buffer is resized, never the spare. */
+static bool reserve(struct skiplist_wal *w, size_t len) {
+    if (w->used + len <= w->cap) { return true; }
+    size_t cap = w->cap;
+    while (cap < w->used + len) { cap *= 2; }
+    unsigned char *buf = w->alloc(NULL, 0, cap, w->alloc_udata);
+    if (buf == NULL) { return false; }
+    memcpy(buf, w->buf, w->used);
+    w->alloc(w->buf, w->cap, 0, w->alloc_udata);
+    w->buf = buf;
+    w->cap = cap;
+    return true;
+}
+
+/* Append a record, with room already reserved. Returns its number. */
+static uint64_t append(struct skiplist_wal *w, enum op op,
+        void *key, size_t klen, void *value, size_t vlen) {
+    unsigned char *p = w->buf + w->used;
+    size_t len = sizeof(struct record) + PAD8(klen) + PAD8(vlen);
+    memset(p, 0, len);
+    struct record r = { 0, (uint8_t)op, { 0, 0, 0 },
+                        (uint32_t)klen, (uint32_t)vlen };
+    memcpy(p, &r, sizeof(r));
+    codec_encode(w->kc, key, p + sizeof(r));
+    if (op != OP_DELETE) {
+        codec_encode(w->vc, value, p + sizeof(r) + PAD8(klen));
+    }
+    r.sum = checksum(p + sizeof(r.sum), len - sizeof(r.sum));
+    memcpy(p, &r.sum, sizeof(r.sum));
+
+    if (w->used == 0) { clock_gettime(CLOCK_REALTIME, &w->batch_start); }
+    w->used += len;
+    return ++w->appended;
+}
+
+static struct timespec deadline(struct skiplist_wal *w) {
+    struct timespec ts = w->batch_start;
+    long ns = ts.tv_nsec + (long)w->group_usec * 1000;
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+static bool batch_due(struct skiplist_wal *w) {
+    if (w->used == 0) { return false; }
+    if (w->used >= w->group_bytes || w->group_usec == 0) { return true; }
+    struct timespec now, due = deadline(w);
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec > due.tv_sec
+      || (now.tv_sec == due.tv_sec && now.tv_nsec >= due.tv_nsec);
+}
+
+/* Write and sync everything buffered. Called with the lock held, and
+ * drops it during I/O so others can keep appending to the other
+ * buffer. */
+static void flush(struct skiplist_wal *w) {
+    assert(!w->syncing);
+    w->syncing = true;
+    unsigned char *out = w->buf;
+    size_t len = w->used, cap = w->cap;
+    uint64_t upto = w->appended;
+    w->buf = w->spare;
+    w->cap = w->spare_cap;
+    w->used = 0;
+    w->spare = out;
+    w->spare_cap = cap;
+
+    pthread_mutex_unlock(&w->lock);
+    bool ok = write_all(w->fd, out, len) && fsync(w->fd) == 0;
+    pthread_mutex_lock(&w->lock);
+
+    w->syncing = false;
+    if (ok) {
+        w->durable = upto;
+    } else {
+        w->failed = true;
+    }
+    pthread_cond_broadcast(&w->synced);
+}
+
+/* Wait until record SEQ is durable, syncing if it's our turn (or at
+ * once, if NOW is set). Called with the lock held. */
+static bool commit(struct skiplist_wal *w, uint64_t seq, bool now) {
+    while (w->durable < seq && !w->failed) {
+        if (!w->syncing && (now || batch_due(w))) {
+            flush(w);
+        } else if (w->syncing) {
+            pthread_cond_wait(&w->synced, &w->lock);
+        } else {
+            struct timespec due = deadline(w);
+            pthread_cond_timedwait(&w->synced, &w->lock, &due);
+        }
+    }
+    return !w->failed;
+}
+
+/* Log and apply one change, then wait for it to be durable. The
+ * record is buffered before the skiplist is touched, and taken back
+ * out if the change turns out not to apply (e.g. a delete of a missing
+ * key): nothing else can append in between, since the lock is held. */
+static bool logged(struct skiplist_wal *w, enum op op,
+        void *key, void *value, void **old) {
+    assert(w);
+    pthread_mutex_lock(&w->lock);
+    bool res = false;
+    if (w->failed) { goto done; }
+    size_t klen = codec_size(w->kc, key);
+    size_t vlen = op == OP_DELETE ? 0 : codec_size(w->vc, value);
+    if (klen > UINT32_MAX || vlen > UINT32_MAX) { goto done; }
+    size_t len = sizeof(struct record) + PAD8(klen) + PAD8(vlen);
+    if (!reserve(w, len)) { goto done; }
+
+    uint64_t seq = append(w, op, key, klen, value, vlen);
+    switch (op) {
+    case OP_ADD:
+        res = skiplist_add(w->sl, key, value);
+        break;
+    case OP_SET:
+        res = skiplist_set(w->sl, key, value, old);
+        break;
+    case OP_DELETE:
+        res = skiplist_delete(w->sl, key, old);
+        break;
+    }
+    if (res) {
+        res = commit(w, seq, false);
+    } else {
+        w->used -= len;
+        w->appended--;
+    }
+done:
+    pthread_mutex_unlock(&w->lock);
+    return res;
+}
+
+bool skiplist_wal_add(struct skiplist_wal *w, void *key, void *value) {
+    return logged(w, OP_ADD, key, value, NULL);
+}
+
+bool skiplist_wal_set(struct skiplist_wal *w,
+        void *key, void *value, void **old) {
+    return logged(w, OP_SET, key, value, old);
+}
+
+bool skiplist_wal_delete(struct skiplist_wal *w, void *key, void **value) {
+    return logged(w, OP_DELETE, key, NULL, value);
+}
+
+bool skiplist_wal_get(struct skiplist_wal *w, void *key, void **value) {
+    assert(w);
+    pthread_mutex_lock(&w->lock);
+    bool res = skiplist_get(w->sl, key, value);
+    pthread_mutex_unlock(&w->lock);
+    return res;
+}
+
+bool skiplist_wal_sync(struct skiplist_wal *w) {
+    assert(w);
+    pthread_mutex_lock(&w->lock);
+    bool res = commit(w, w->appended, true);
+    pthread_mutex_unlock(&w->lock);
+    return res;
+}
+
+bool skiplist_wal_close(struct skiplist_wal *w) {
+    assert(w);
+    bool res = skiplist_wal_sync(w);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->synced);
+    if (close(w->fd) == -1) { res = false; }
+    if (w->replay_base != MAP_FAILED) {
+        munmap(w->replay_base, w->replay_size);
+    }
+    w->alloc(w->buf, w->cap, 0, w->alloc_udata);
+    w->alloc(w->spare, w->spare_cap, 0, w->alloc_udata);
+    w->alloc(w, sizeof(*w), 0, w->alloc_udata);
+    return res;
+}
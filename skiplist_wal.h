@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Write-ahead log for a skiplist.
+ *
+ * Each add, set or delete made through the log is appended as a record
+ * to an in-memory buffer, then applied to the skiplist, and the call
+ * returns once the record is on disk. Rather than syncing once
+ * per call, concurrent callers are grouped: one of the waiting threads
+ * writes out and fsyncs everything buffered so far, which makes all of
+ * their records durable at once. A batch is written once it reaches
+ * group_bytes, or once its oldest record has waited group_usec, or
+ * right away when both are 0.
+ *
+ * Opening the log replays it into the skiplist. A torn record at the
+ * end (from a crash during a write) is discarded. Runs of adds in
+ * ascending key order are replayed with skiplist_add_sorted.
+ */
+
+#ifndef SKIPLIST_WAL_H
+#define SKIPLIST_WAL_H
+
+#include "skiplist.h"
+#include "skiplist_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opaque write-ahead log type. */
+struct skiplist_wal;
+
+struct skiplist_wal_config {
+    /* How keys and values are written, as for skiplist_save. NULL
+     * stores the pointer itself. When replaying, BUF stays mapped
+     * until skiplist_wal_close. Pairs that replay later replaces or
+     * deletes are dropped without being freed, so decode should
+     * return pointers into BUF rather than allocating. */
+    const struct skiplist_codec *key_codec;
+    const struct skiplist_codec *value_codec;
+    /* Group commit thresholds, see above. */
+    size_t group_bytes;
+    unsigned group_usec;
+};
+
+/* Open (or create) the log at PATH, replay it into SL, and log SL's
+ * changes from then on. From then on SL must only be changed through
+ * the log. CONFIG can be NULL for the defaults: pointer codecs, and
+ * syncing right away. ALLOC is used for the log's buffers, must be
+ * thread-safe, and can be NULL to use malloc & free. Returns NULL if
+ * the file cannot be opened or is not a log, or if replay runs out of
+ * memory; if replay had started, SL is emptied (without freeing its
+ * pairs, which can point into the log) before returning. */
+struct skiplist_wal *skiplist_wal_open(const char *path,
+    struct skiplist *sl, const struct skiplist_wal_config *config,
+    skiplist_alloc_cb *alloc, void *alloc_udata);
+
+/* Same as the corresponding skiplist_* functions, but logged, and safe
+ * to call from several threads. Each returns after its change is on
+ * disk. If writing the log fails, they return false, and the log is
+ * poisoned: every later change is refused. The failed batch's changes
+ * stay in the skiplist but may be lost on a crash, so the skiplist no
+ * longer matches what reopening the log would give. skiplist_wal_delete
+ * only logs if KEY was found.
+ *
+ * With duplicate keys, replaying a delete may remove a different one of
+ * the key's values than the original call did (see skiplist_delete). */
+bool skiplist_wal_add(struct skiplist_wal *w, void *key, void *value);
+bool skiplist_wal_set(struct skiplist_wal *w,
+    void *key, void *value, void **old);
+bool skiplist_wal_delete(struct skiplist_wal *w, void *key, void **value);
+
+/* Get KEY's value, serialized with the logged changes. A change is
+ * visible as soon as it is applied, before its record is durable, so
+ * this can return a value that a crash would still lose. */
+bool skiplist_wal_get(struct skiplist_wal *w, void *key, void **value);
+
+/* Write out and sync any buffered records now.
+ * Returns false if the log has failed. */
+bool skiplist_wal_sync(struct skiplist_wal *w);
+
+/* Sync and close the log. The skiplist is not freed, but pairs
+ * decoded by replay may point into the log's mapping, which is
+ * unmapped here, so free the skiplist first if so. */
+bool skiplist_wal_close(struct skiplist_wal *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
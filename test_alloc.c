@@ -8,19 +8,21 @@ long allocated = 0;
 
 #define TRACE_ALLOC 0
 
+/* The count is updated atomically, since the concurrency
+ * tests allocate from several threads at once. */
 void *test_alloc(void *p, size_t osize, size_t nsize, void *udata) {
     (void)udata;
     if (p) {
         assert(nsize == 0);
         if (TRACE_ALLOC) { fprintf(stderr, "free %zd bytes\n", osize); }
-        allocated -= osize;
+        __atomic_sub_fetch(&allocated, osize, __ATOMIC_RELAXED);
         free(p);
         return NULL;
     } else {
         if (TRACE_ALLOC) { fprintf(stderr, "alloc %zd bytes\n", nsize); }
         assert(osize == 0);
         p = malloc(nsize);
-        allocated += nsize;
+        __atomic_add_fetch(&allocated, nsize, __ATOMIC_RELAXED);
         return p;
     }
 }
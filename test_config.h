@@ -7,4 +7,20 @@
 
 #define SKIPLIST_DEBUG 1
 
+/* The tests are run twice: once with the optional features at their
+ * defaults (off), and once built with SKIPLIST_TEST_ALL_FLAGS. */
+#ifdef SKIPLIST_TEST_ALL_FLAGS
+
+#define SKIPLIST_STATS 1
+
+#define SKIPLIST_LATENCY 1
+
+#define SKIPLIST_SWMR 1
+
+#define SKIPLIST_SNAPSHOTS 1
+
+#define SKIPLIST_ADAPTIVE 1
+
+#endif
+
 #endif
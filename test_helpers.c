@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "test_helpers.h"
+#include "test_alloc.h"
+
+int sl_longcmp(void *la, void *lb) {
+    long a = (long) la;
+    long b = (long) lb;
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+int sl_strcmp(void *a, void *b) {
+    return strcmp((char *) a, (char *) b);
+}
+
+void test_setup(void *udata) {
+    (void)udata;
+    test_reset();
+}
+
+void test_teardown(void *udata) {
+    (void)udata;
+    assert(test_check_for_leaks());
+}
+
+static size_t str_size(void *x, void *udata) {
+    (void)udata;
+    return strlen((char *) x) + 1;
+}
+
+static void str_encode(void *x, void *buf, void *udata) {
+    (void)udata;
+    memcpy(buf, x, strlen((char *) x) + 1);
+}
+
+static void *str_decode(const void *buf, size_t len, void *udata) {
+    (void)udata;
+    (void)len;
+    return (void *) buf;
+}
+
+const struct skiplist_codec str_codec = {
+    str_size, str_encode, str_decode, NULL
+};
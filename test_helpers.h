@@ -0,0 +1,19 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include "skiplist_io.h"
+
+/* Comparison callbacks for keys that are longs, and C strings. */
+int sl_longcmp(void *la, void *lb);
+int sl_strcmp(void *a, void *b);
+
+/* Suite setup and teardown: reset the allocation count before each
+ * test, and check that everything was freed afterward. */
+void test_setup(void *udata);
+void test_teardown(void *udata);
+
+/* Codec for C strings, written with their terminator. Decoding uses
+ * the string in place rather than copying it. */
+extern const struct skiplist_codec str_codec;
+
+#endif
@@ -4,10 +4,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <err.h>
+#include <pthread.h>
 #include <assert.h>
 
 #include "test_config.h"
 #include "skiplist.h"
+#include "skiplist_epoch.h"
 #include "greatest.h"
 #include "test_alloc.h"
 
@@ -657,6 +659,7 @@ TEST clear(void) {
     ASSERT(ud.ok == 1);
     ASSERT(ud.count == limit);
     ASSERT(ct == limit);
+    ASSERT(skiplist_empty(sl));
     skiplist_free(sl, NULL, NULL);
     PASS();
 }
@@ -759,6 +762,824 @@ TEST pop_last(void) {
     PASS();
 }
 
+/* Add a sorted batch interleaved with existing keys, including a
+ * duplicate, and check everything ends up in order. */
+TEST add_sorted(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 2000;
+    for (intptr_t i = 0; i < limit; i += 2) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+
+    void *keys[limit / 2 + 1];
+    size_t ct = 0;
+    for (intptr_t i = 1; i < limit; i += 2) {
+        keys[ct++] = (void *) i;
+        if (i == 501) { keys[ct++] = (void *) i; }
+    }
+    ASSERT_EQ(ct, skiplist_add_sorted(sl, ct, keys, keys));
+    ASSERT_EQ(limit + 1, skiplist_count(sl));
+    ASSERT_EQ(0, skiplist_add_sorted(sl, 0, keys, keys));
+
+    for (intptr_t i = 0; i < limit; i++) {
+        void *k = NULL, *v = NULL;
+        ASSERT(skiplist_pop_first(sl, &k, &v));
+        ASSERT_EQ(i, (intptr_t) k);
+        ASSERT_EQ(k, v);
+        if (i == 501) {
+            ASSERT(skiplist_pop_first(sl, &k, NULL));
+            ASSERT_EQ(i, (intptr_t) k);
+        }
+    }
+    ASSERT(skiplist_empty(sl));
+
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#if SKIPLIST_STATS
+/* Check that the operation counters track calls, comparisons,
+ * and search paths, and that they can be reset. */
+TEST stats(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 1000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_set(sl, (void *) 0, (void *) 1, NULL));
+
+    struct skiplist_stats st;
+    skiplist_get_stats(sl, &st);
+    ASSERT_EQ(limit, st.ops[SKIPLIST_OP_ADD]);
+    ASSERT_EQ(1, st.ops[SKIPLIST_OP_SET]);
+    ASSERT(st.cmps > limit);
+
+    skiplist_reset_stats(sl);
+    skiplist_get_stats(sl, &st);
+    ASSERT_EQ(0, st.ops[SKIPLIST_OP_ADD]);
+    ASSERT_EQ(0, st.cmps);
+    ASSERT_EQ(0, st.max_path);
+
+    ASSERT(skiplist_member(sl, (void *) (limit / 2)));
+    skiplist_get_stats(sl, &st);
+    ASSERT_EQ(1, st.ops[SKIPLIST_OP_GET]);
+    ASSERT(st.cmps > 0);
+    ASSERT(st.hops[0] > 0);
+    uint64_t visited = 0;
+    for (int i = 0; i < SKIPLIST_STATS_LEVELS; i++) {
+        visited += st.hops[i];
+    }
+    ASSERT_EQ(visited, st.max_path);
+
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#endif
+
+#if SKIPLIST_LATENCY
+/* Check that latency is recorded per operation type, and that the
+ * percentiles are ordered and bounded by the max. */
+TEST latency(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 10000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    for (intptr_t i = 0; i < limit / 2; i++) {
+        ASSERT(skiplist_pop_first(sl, NULL, NULL));
+    }
+
+    struct skiplist_latency lat;
+    ASSERT(skiplist_get_latency(sl, SKIPLIST_OP_ADD, &lat));
+    ASSERT_EQ(limit, lat.count);
+    ASSERT(lat.p50 <= lat.p99);
+    ASSERT(lat.p99 <= lat.p999);
+    ASSERT(lat.p999 <= lat.max);
+    ASSERT(lat.max > 0);
+
+    ASSERT(skiplist_get_latency(sl, SKIPLIST_OP_POP_FIRST, &lat));
+    ASSERT_EQ(limit / 2, lat.count);
+    ASSERT(!skiplist_get_latency(sl, SKIPLIST_OP_DELETE, &lat));
+    ASSERT_EQ(0, lat.count);
+
+    skiplist_reset_latency(sl);
+    ASSERT(!skiplist_get_latency(sl, SKIPLIST_OP_ADD, &lat));
+
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#endif
+
+#if SKIPLIST_SWMR
+#define SWMR_KEYS 2000
+#define SWMR_READERS 3
+
+struct swmr_reader {
+    struct skiplist *sl;
+    struct skiplist_epoch *e;
+    const bool *done;
+    bool ok;
+};
+
+/* Odd keys are always present; even keys come and go. Every value
+ * seen must be the one stored with that key. */
+static void *swmr_read(void *arg) {
+    struct swmr_reader *r = (struct swmr_reader *) arg;
+    struct skiplist_epoch_reader *er = skiplist_epoch_register(r->e);
+    r->ok = er != NULL;
+    if (er == NULL) { return NULL; }
+    while (!__atomic_load_n(r->done, __ATOMIC_ACQUIRE)) {
+        for (intptr_t k = 0; k < SWMR_KEYS; k++) {
+            void *v = NULL;
+            skiplist_epoch_enter(er);
+            bool found = skiplist_get_swmr(r->sl, (void *) k, &v);
+            skiplist_epoch_exit(er);
+            if ((k & 1) && !found) { r->ok = false; }
+            if (found && v != (void *) (k * 10)) { r->ok = false; }
+        }
+    }
+    skiplist_epoch_unregister(er);
+    return NULL;
+}
+
+TEST swmr_concurrent_get(void) {
+    struct skiplist_epoch *e = skiplist_epoch_new(test_alloc, NULL);
+    ASSERT(e);
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_set_epoch(sl, e);
+    for (intptr_t k = 1; k < SWMR_KEYS; k += 2) {
+        ASSERT(skiplist_add(sl, (void *) k, (void *) (k * 10)));
+    }
+
+    bool done = false;
+    pthread_t threads[SWMR_READERS];
+    struct swmr_reader readers[SWMR_READERS];
+    for (int i = 0; i < SWMR_READERS; i++) {
+        readers[i] = (struct swmr_reader){ sl, e, &done, true };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                swmr_read, &readers[i]));
+    }
+
+    for (int round = 0; round < 20; round++) {
+        for (intptr_t k = 0; k < SWMR_KEYS; k += 2) {
+            ASSERT(skiplist_set(sl, (void *) k, (void *) (k * 10), NULL));
+        }
+        for (intptr_t k = 0; k < SWMR_KEYS; k += 2) {
+            ASSERT(skiplist_delete(sl, (void *) k, NULL));
+        }
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < SWMR_READERS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(readers[i].ok);
+    }
+    ASSERT_EQ(SWMR_KEYS / 2, skiplist_count(sl));
+
+    skiplist_free(sl, NULL, NULL);
+    skiplist_epoch_free(e);
+    PASS();
+}
+
+#endif
+
+#if SKIPLIST_SNAPSHOTS
+struct sum_env {
+    intptr_t sum;
+    size_t count;
+};
+
+static enum skiplist_iter_res sum_cb(void *key, void *value, void *udata) {
+    struct sum_env *env = (struct sum_env *) udata;
+    (void)key;
+    env->sum += (intptr_t) value;
+    env->count++;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+/* A snapshot keeps seeing the pairs as they were, while deletes, sets
+ * and adds change the live list, and releasing it frees what only it
+ * could see. */
+TEST snapshot(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 1000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    long before = allocated;
+    struct skiplist_snapshot *snap = skiplist_snapshot(sl);
+    ASSERT(snap);
+
+    for (intptr_t i = 0; i < limit; i += 2) {
+        ASSERT(skiplist_delete(sl, (void *) i, NULL));
+    }
+    for (intptr_t i = 1; i < limit; i += 2) {
+        void *old = NULL;
+        ASSERT(skiplist_set(sl, (void *) i, (void *) -i, &old));
+        ASSERT_EQ((void *) i, old);
+    }
+    ASSERT(skiplist_add(sl, (void *) limit, (void *) limit));
+    ASSERT_EQ(limit / 2 + 1, skiplist_count(sl));
+
+    for (intptr_t i = 0; i <= limit; i++) {
+        void *v = NULL;
+        bool live = skiplist_get(sl, (void *) i, &v);
+        ASSERT_EQ((i & 1) || i == limit, live);
+        if (live) { ASSERT_EQ((void *) (i == limit ? i : -i), v); }
+        bool old = skiplist_snapshot_get(snap, (void *) i, &v);
+        ASSERT_EQ(i < limit, old);
+        if (old) { ASSERT_EQ((void *) i, v); }
+    }
+
+    struct sum_env env = { 0, 0 };
+    skiplist_snapshot_iter(snap, sum_cb, &env);
+    ASSERT_EQ(limit, env.count);
+    ASSERT_EQ(limit * (limit - 1) / 2, env.sum);
+    env = (struct sum_env) { 0, 0 };
+    skiplist_iter(sl, sum_cb, &env);
+    ASSERT_EQ(limit / 2 + 1, env.count);
+    env = (struct sum_env) { 0, 0 };
+    skiplist_snapshot_iter_from(snap, (void *) (limit - 2), sum_cb, &env);
+    ASSERT_EQ(2, env.count);
+
+    skiplist_snapshot_release(snap);
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT(allocated < before);
+    env = (struct sum_env) { 0, 0 };
+    skiplist_iter(sl, sum_cb, &env);
+    ASSERT_EQ(limit / 2 + 1, env.count);
+
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+/* Overlapping snapshots, released out of order, and the operations
+ * that have to skip over nodes only kept for a snapshot. */
+TEST snapshot_nested(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 1; i <= 10; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    struct skiplist_snapshot *a = skiplist_snapshot(sl);
+    ASSERT(a);
+
+    void *k = NULL;
+    for (intptr_t i = 10; i > 7; i--) {
+        ASSERT(skiplist_pop_last(sl, &k, NULL));
+        ASSERT_EQ((void *) i, k);
+    }
+    ASSERT(skiplist_pop_first(sl, &k, NULL));
+    ASSERT_EQ((void *) 1, k);
+    ASSERT(skiplist_first(sl, &k, NULL));
+    ASSERT_EQ((void *) 2, k);
+    ASSERT(skiplist_last(sl, &k, NULL));
+    ASSERT_EQ((void *) 7, k);
+
+    ASSERT(skiplist_add(sl, (void *) 5, (void *) 50));
+    struct skiplist_snapshot *b = skiplist_snapshot(sl);
+    ASSERT(b);
+    int deleted = 0;
+    skiplist_delete_all(sl, (void *) 5, inc_cb, &deleted);
+    ASSERT_EQ(0, deleted);      /* until the snapshots are released */
+    ASSERT(!skiplist_member(sl, (void *) 5));
+    ASSERT_EQ(5, skiplist_clear(sl, NULL, NULL));
+    ASSERT(skiplist_empty(sl));
+    ASSERT(!skiplist_first(sl, NULL, NULL));
+    ASSERT(!skiplist_last(sl, NULL, NULL));
+
+    struct sum_env env = { 0, 0 };
+    skiplist_snapshot_iter(a, sum_cb, &env);
+    ASSERT_EQ(10, env.count);
+    ASSERT_EQ(55, env.sum);
+    skiplist_snapshot_release(a);
+
+    env = (struct sum_env) { 0, 0 };
+    skiplist_snapshot_iter(b, sum_cb, &env);
+    ASSERT_EQ(7, env.count);
+    ASSERT_EQ(2 + 3 + 4 + 5 + 50 + 6 + 7, env.sum);
+    skiplist_snapshot_release(b);
+    ASSERT_EQ(2, deleted);
+
+    ASSERT(skiplist_add(sl, (void *) 1, (void *) 1));
+    ASSERT_EQ(1, skiplist_count(sl));
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+/* Repeated sets keep a version chain, readable by version back to the
+ * oldest open snapshot, and trimmed once it is released. */
+TEST get_at(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    ASSERT(skiplist_add(sl, (void *) 1, (void *) 0));
+    ASSERT(skiplist_add(sl, (void *) 2, (void *) 0));
+    long base = allocated;
+    struct skiplist_snapshot *snap = skiplist_snapshot(sl);
+    ASSERT(snap);
+    ASSERT_EQ(skiplist_version(sl), skiplist_snapshot_version(snap));
+
+    uint64_t versions[100];
+    for (intptr_t i = 0; i < 100; i++) {
+        ASSERT(skiplist_set(sl, (void *) 1, (void *) (i + 1), NULL));
+        versions[i] = skiplist_version(sl);
+    }
+    ASSERT(skiplist_delete(sl, (void *) 2, NULL));
+    ASSERT_EQ(1, skiplist_count(sl));
+
+    void *v = NULL;
+    ASSERT(skiplist_get_at(sl, (void *) 1,
+            skiplist_snapshot_version(snap), &v));
+    ASSERT_EQ((void *) 0, v);
+    for (intptr_t i = 0; i < 100; i++) {
+        ASSERT(skiplist_get_at(sl, (void *) 1, versions[i], &v));
+        ASSERT_EQ((void *) (i + 1), v);
+        ASSERT(skiplist_get_at(sl, (void *) 2, versions[i], NULL));
+    }
+    ASSERT(!skiplist_get_at(sl, (void *) 2, skiplist_version(sl), NULL));
+    ASSERT(skiplist_get(sl, (void *) 1, &v));
+    ASSERT_EQ((void *) 100, v);
+
+    skiplist_snapshot_release(snap);
+    ASSERT(allocated < base);
+    ASSERT(skiplist_get_at(sl, (void *) 1, skiplist_version(sl), &v));
+    ASSERT_EQ((void *) 100, v);
+
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+static long *new_long(long x) {
+    long *p = test_malloc(sizeof(*p));
+    if (p) { *p = x; }
+    return p;
+}
+
+static void free_long(void *key, void *value, void *udata) {
+    (void)key;
+    (*(int *) udata)++;
+    test_free(value, sizeof(long));
+}
+
+/* Free callbacks wait until no snapshot can see what they free. */
+TEST snapshot_deferred_free(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < 4; i++) {
+        long *v = new_long(i * 10);
+        ASSERT(v);
+        ASSERT(skiplist_add(sl, (void *) i, v));
+    }
+    int freed = 0;
+    struct skiplist_snapshot *a = skiplist_snapshot(sl);
+    ASSERT(a);
+    skiplist_delete_all(sl, (void *) 0, free_long, &freed);
+
+    struct skiplist_write_batch *b = skiplist_write_batch_new(sl);
+    ASSERT(b);
+    long *v1 = new_long(11);
+    ASSERT(v1);
+    ASSERT(skiplist_write_batch_set(b, (void *) 1, v1));
+    ASSERT(skiplist_write_batch_delete(b, (void *) 2));
+    ASSERT(skiplist_write_batch_apply(b, free_long, &freed));
+    skiplist_write_batch_free(b);
+
+    struct skiplist_snapshot *c = skiplist_snapshot(sl);
+    ASSERT(c);
+    ASSERT_EQ(2, skiplist_clear(sl, free_long, &freed));
+    ASSERT_EQ(0, freed);
+
+    for (intptr_t i = 0; i < 4; i++) {
+        void *v = NULL;
+        ASSERT(skiplist_snapshot_get(a, (void *) i, &v));
+        ASSERT_EQ(i * 10, *(long *) v);
+    }
+    void *v = NULL;
+    ASSERT(skiplist_snapshot_get(c, (void *) 1, &v));
+    ASSERT_EQ(11, *(long *) v);
+    ASSERT_FALSE(skiplist_snapshot_get(c, (void *) 2, &v));
+
+    /* C still sees the pairs in it, but not the ones deleted before. */
+    skiplist_snapshot_release(a);
+    ASSERT_EQ(3, freed);
+    ASSERT(skiplist_snapshot_get(c, (void *) 3, &v));
+    ASSERT_EQ(30, *(long *) v);
+    skiplist_snapshot_release(c);
+    ASSERT_EQ(5, freed);
+    ASSERT_EQ(0, skiplist_count(sl));
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#define SNAPSHOT_KEYS 2000
+
+struct snapshot_reader {
+    struct skiplist_snapshot *snap;
+    struct skiplist_epoch *e;
+    const bool *done;
+    bool ok;
+};
+
+/* The snapshot's sum never changes while the writer churns. */
+static void *snapshot_read(void *arg) {
+    struct snapshot_reader *r = (struct snapshot_reader *) arg;
+    struct skiplist_epoch_reader *er = skiplist_epoch_register(r->e);
+    r->ok = er != NULL;
+    if (er == NULL) { return NULL; }
+    const intptr_t want = SNAPSHOT_KEYS * (SNAPSHOT_KEYS - 1) / 2;
+    while (!__atomic_load_n(r->done, __ATOMIC_ACQUIRE)) {
+        struct sum_env env = { 0, 0 };
+        skiplist_epoch_enter(er);
+        skiplist_snapshot_iter(r->snap, sum_cb, &env);
+        skiplist_epoch_exit(er);
+        if (env.sum != want || env.count != SNAPSHOT_KEYS) { r->ok = false; }
+    }
+    skiplist_epoch_unregister(er);
+    return NULL;
+}
+
+TEST snapshot_concurrent_iter(void) {
+    struct skiplist_epoch *e = skiplist_epoch_new(test_alloc, NULL);
+    ASSERT(e);
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_set_epoch(sl, e);
+    for (intptr_t k = 0; k < SNAPSHOT_KEYS; k++) {
+        ASSERT(skiplist_add(sl, (void *) k, (void *) k));
+    }
+    struct skiplist_snapshot *snap = skiplist_snapshot(sl);
+    ASSERT(snap);
+
+    bool done = false;
+    pthread_t threads[SWMR_READERS];
+    struct snapshot_reader readers[SWMR_READERS];
+    for (int i = 0; i < SWMR_READERS; i++) {
+        readers[i] = (struct snapshot_reader){ snap, e, &done, true };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                snapshot_read, &readers[i]));
+    }
+
+    /* Each round's history is swept out, under the readers' feet,
+     * when its own snapshot is released. */
+    for (int round = 0; round < 10; round++) {
+        struct skiplist_snapshot *tmp = skiplist_snapshot(sl);
+        ASSERT(tmp);
+        for (intptr_t k = 0; k < SNAPSHOT_KEYS; k += 2) {
+            ASSERT(skiplist_set(sl, (void *) k, (void *) -k, NULL));
+            ASSERT(skiplist_add(sl, (void *) (k + 1), NULL));
+        }
+        for (intptr_t k = 0; k < SNAPSHOT_KEYS; k += 2) {
+            ASSERT(skiplist_delete(sl, (void *) (k + 1), NULL));
+        }
+        skiplist_snapshot_release(tmp);
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < SWMR_READERS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(readers[i].ok);
+    }
+    skiplist_snapshot_release(snap);
+    ASSERT_EQ(SNAPSHOT_KEYS, skiplist_count(sl));
+
+    skiplist_free(sl, NULL, NULL);
+    skiplist_epoch_free(e);
+    PASS();
+}
+
+#endif
+
+TEST freeze(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < 10; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    ASSERT_FALSE(skiplist_frozen(sl));
+    skiplist_freeze(sl);
+    ASSERT(skiplist_frozen(sl));
+
+    void *keys[] = { (void *) 20 };
+    void *k = NULL, *v = NULL;
+    ASSERT_FALSE(skiplist_add(sl, (void *) 11, NULL));
+    ASSERT_FALSE(skiplist_set(sl, (void *) 1, NULL, NULL));
+    ASSERT_EQ(0, skiplist_add_sorted(sl, 1, keys, keys));
+    ASSERT_FALSE(skiplist_delete(sl, (void *) 1, NULL));
+    ASSERT_FALSE(skiplist_pop_first(sl, &k, &v));
+    ASSERT_FALSE(skiplist_pop_last(sl, &k, &v));
+    ASSERT_EQ(0, skiplist_clear(sl, NULL, NULL));
+    ASSERT_EQ(10, skiplist_count(sl));
+
+    ASSERT(skiplist_get(sl, (void *) 1, &v));
+    ASSERT_EQ((void *) 1, v);
+    ASSERT(skiplist_last(sl, &k, &v));
+    ASSERT_EQ((void *) 9, k);
+    ASSERT_EQ(10, skiplist_free(sl, NULL, NULL));
+    PASS();
+}
+
+TEST iter_batch(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < 1000; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) -i));
+    }
+    struct skiplist_cursor c = SKIPLIST_CURSOR_INIT;
+    void *keys[64], *values[64];
+    ASSERT_EQ(0, skiplist_iter_batch(sl, &c, keys, values, 0));
+    intptr_t expect = 0;
+    size_t n;
+    while ((n = skiplist_iter_batch(sl, &c, keys, values, 64)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            ASSERT_EQ((void *) expect, keys[i]);
+            ASSERT_EQ((void *) -expect, values[i]);
+            expect++;
+        }
+    }
+    ASSERT_EQ(1000, expect);
+    ASSERT_EQ(0, skiplist_iter_batch(sl, &c, keys, values, 64));
+
+    /* Deleting the node the cursor is on makes it search again. */
+    struct skiplist_cursor c2 = SKIPLIST_CURSOR_INIT;
+    ASSERT_EQ(10, skiplist_iter_batch(sl, &c2, keys, NULL, 10));
+    ASSERT_EQ((void *) 9, keys[9]);
+    ASSERT(skiplist_delete(sl, (void *) 9, NULL));
+    ASSERT(skiplist_delete(sl, (void *) 10, NULL));
+    ASSERT_EQ(1, skiplist_iter_batch(sl, &c2, keys, NULL, 1));
+    ASSERT_EQ((void *) 11, keys[0]);
+    ASSERT(skiplist_add(sl, (void *) 12, NULL));
+    ASSERT_EQ(2, skiplist_iter_batch(sl, &c2, keys, NULL, 2));
+    ASSERT_EQ((void *) 12, keys[0]);
+    ASSERT_EQ((void *) 12, keys[1]);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+static void *count_upsert(void *key, void **value, void *udata) {
+    (void)key;
+    (*(int *) udata)++;
+    if (value == NULL) { return (void *) 1; }
+    *value = (void *) ((intptr_t) *value + 1);
+    return NULL;
+}
+
+TEST upsert(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    int calls = 0;
+    for (intptr_t i = 0; i < 100; i++) {
+        ASSERT(skiplist_upsert(sl, (void *) (i % 10), count_upsert, &calls));
+    }
+    ASSERT_EQ(100, calls);
+    ASSERT_EQ(10, skiplist_count(sl));
+    for (intptr_t k = 0; k < 10; k++) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, (void *) k, &v));
+        ASSERT_EQ((void *) 10, v);
+    }
+
+#if SKIPLIST_SNAPSHOTS
+    /* An open snapshot still sees the old value. */
+    struct skiplist_snapshot *snap = skiplist_snapshot(sl);
+    ASSERT(snap);
+    ASSERT(skiplist_upsert(sl, (void *) 3, count_upsert, &calls));
+    void *v = NULL;
+    ASSERT(skiplist_get(sl, (void *) 3, &v));
+    ASSERT_EQ((void *) 11, v);
+    ASSERT(skiplist_snapshot_get(snap, (void *) 3, &v));
+    ASSERT_EQ((void *) 10, v);
+    ASSERT_EQ(NULL, skiplist_emplace(sl, (void *) 3, NULL));
+    skiplist_snapshot_release(snap);
+#endif
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+TEST emplace(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < 100; i++) {
+        bool inserted = false;
+        void **slot = skiplist_emplace(sl, (void *) (i % 10), &inserted);
+        ASSERT(slot);
+        ASSERT_EQ(i < 10, inserted);
+        *slot = (void *) ((intptr_t) *slot + i);
+    }
+    ASSERT_EQ(10, skiplist_count(sl));
+    for (intptr_t k = 0; k < 10; k++) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, (void *) k, &v));
+        ASSERT_EQ((void *) (10 * k + 450), v);
+    }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+static void count_freed(void *key, void *value, void *udata) {
+    (void)key;
+    (void)value;
+    (*(int *) udata)++;
+}
+
+TEST write_batch(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < 100; i += 2) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+
+    /* Queued in descending order, with repeats of the same key. */
+    struct skiplist_write_batch *b = skiplist_write_batch_new(sl);
+    ASSERT(b);
+    for (intptr_t i = 99; i >= 0; i--) {
+        if (i % 3 == 0) {
+            ASSERT(skiplist_write_batch_set(b, (void *) i, (void *) -i));
+        } else if (i % 3 == 1) {
+            ASSERT(skiplist_write_batch_delete(b, (void *) i));
+        }
+    }
+    ASSERT(skiplist_write_batch_add(b, (void *) 1000, (void *) 1));
+    ASSERT(skiplist_write_batch_set(b, (void *) 1000, (void *) 2));
+    ASSERT(skiplist_write_batch_delete(b, (void *) 1001));
+    ASSERT_EQ(70, skiplist_write_batch_count(b));
+
+    int freed = 0;
+    ASSERT(skiplist_write_batch_apply(b, count_freed, &freed));
+    ASSERT_EQ(0, skiplist_write_batch_count(b));
+    /* Sets of even multiples of 3, deletes of evens 1 mod 3, and the
+     * set of 1000 replacing the value just added. */
+    ASSERT_EQ(17 + 16 + 1, freed);
+
+    size_t expected = 0;
+    for (intptr_t i = 0; i < 100; i++) {
+        void *v = NULL;
+        bool present = i % 3 == 0 || (i % 2 == 0 && i % 3 == 2);
+        ASSERT_EQ(present, skiplist_get(sl, (void *) i, &v));
+        if (present) {
+            ASSERT_EQ((void *) (i % 3 == 0 ? -i : i), v);
+            expected++;
+        }
+    }
+    void *v = NULL;
+    ASSERT(skiplist_get(sl, (void *) 1000, &v));
+    ASSERT_EQ((void *) 2, v);
+    ASSERT_EQ(expected + 1, skiplist_count(sl));
+
+#if SKIPLIST_SNAPSHOTS
+    /* With a snapshot open, it still applies, one change at a time. */
+    struct skiplist_snapshot *snap = skiplist_snapshot(sl);
+    ASSERT(snap);
+    ASSERT(skiplist_write_batch_set(b, (void *) 1000, (void *) 3));
+    ASSERT(skiplist_write_batch_delete(b, (void *) 0));
+    ASSERT(skiplist_write_batch_apply(b, NULL, NULL));
+    ASSERT(skiplist_get(sl, (void *) 1000, &v));
+    ASSERT_EQ((void *) 3, v);
+    ASSERT_FALSE(skiplist_get(sl, (void *) 0, &v));
+    ASSERT(skiplist_snapshot_get(snap, (void *) 1000, &v));
+    ASSERT_EQ((void *) 2, v);
+    skiplist_snapshot_release(snap);
+#endif
+    skiplist_write_batch_free(b);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+
+TEST compact(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 5000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) ((i * 7919) % limit), (void *) i));
+    }
+    for (intptr_t i = 0; i < limit; i += 3) {
+        ASSERT(skiplist_delete(sl, (void *) i, NULL));
+    }
+    size_t count = skiplist_count(sl);
+
+    /* Change the list between calls, both behind and ahead of the
+     * cursor; only the changes ahead of it affect what is moved. */
+    struct skiplist_cursor cur = SKIPLIST_CURSOR_INIT;
+    size_t moved = 0, step = 0, calls = 0;
+    while ((step = skiplist_compact(sl, &cur, 100)) > 0) {
+        ASSERT(step <= 100);
+        moved += step;
+        calls++;
+        if (calls == 10) {
+            ASSERT(skiplist_add(sl, (void *) 0, NULL));
+            ASSERT(skiplist_delete(sl, (void *) (limit - 1), NULL));
+            ASSERT(skiplist_add(sl, (void *) (limit - 3), NULL));
+        }
+    }
+    ASSERT_EQ(count - 1 + 1, moved);
+    ASSERT_EQ(0, skiplist_compact(sl, &cur, 100));
+    ASSERT_EQ(count + 1, skiplist_count(sl));
+
+    skiplist_debug(sl, NULL, NULL, NULL);
+    for (intptr_t i = 1; i < limit - 1; i++) {
+        void *v = NULL;
+        ASSERT_EQ(i % 3 != 0, skiplist_get(sl, (void *) i, &v));
+    }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#if SKIPLIST_STATS
+static uint64_t lookup_cmps(struct skiplist *sl, intptr_t limit) {
+    struct skiplist_stats st;
+    skiplist_reset_stats(sl);
+    for (intptr_t i = 0; i < limit; i++) {
+        (void)skiplist_member(sl, (void *) i);
+    }
+    skiplist_get_stats(sl, &st);
+    return st.cmps;
+}
+#endif
+
+/* After deleting most pairs, rebalancing takes fewer comparisons to
+ * find what's left. */
+TEST rebalance(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 20000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    for (intptr_t i = 0; i < limit; i++) {
+        if (i % 10 != 0) { ASSERT(skiplist_delete(sl, (void *) i, NULL)); }
+    }
+#if SKIPLIST_STATS
+    uint64_t before = lookup_cmps(sl, limit);
+#endif
+
+    struct skiplist_cursor cur = SKIPLIST_CURSOR_INIT;
+    size_t visited = 0, step = 0;
+    while ((step = skiplist_rebalance(sl, &cur, 500)) > 0) {
+        ASSERT(step <= 500);
+        visited += step;
+    }
+    ASSERT_EQ(limit / 10, visited);
+#if SKIPLIST_STATS
+    uint64_t after = lookup_cmps(sl, limit);
+    ASSERT(after < before);
+#endif
+
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(limit / 10, skiplist_count(sl));
+    for (intptr_t i = 0; i < limit; i += 10) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, (void *) i, &v));
+        ASSERT_EQ((void *) i, v);
+    }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#if SKIPLIST_ADAPTIVE
+/* Reading one key over and over moves it up, so it takes fewer
+ * comparisons to find than it did at first. */
+TEST adaptive(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 10000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    void *hot = (void *) (limit / 3);
+    struct skiplist_stats st;
+    skiplist_reset_stats(sl);
+    ASSERT(skiplist_member(sl, hot));
+    skiplist_get_stats(sl, &st);
+    uint64_t before = st.cmps;
+
+    for (int i = 0; i < 1000; i++) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, hot, &v));
+        ASSERT_EQ(hot, v);
+    }
+    skiplist_reset_stats(sl);
+    ASSERT(skiplist_member(sl, hot));
+    skiplist_get_stats(sl, &st);
+    ASSERT(st.cmps < before);
+
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT_EQ(limit, skiplist_count(sl));
+    for (intptr_t i = 0; i < limit; i++) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, (void *) i, &v));
+        ASSERT_EQ((void *) i, v);
+    }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+#endif
 
 /*********/
 /* Suite */
@@ -766,6 +1587,19 @@ TEST pop_last(void) {
 
 GREATEST_MAIN_DEFS();
 
+SUITE_EXTERN(lf_suite);
+SUITE_EXTERN(epoch_suite);
+SUITE_EXTERN(sharded_suite);
+SUITE_EXTERN(ingest_suite);
+SUITE_EXTERN(fc_suite);
+SUITE_EXTERN(parallel_suite);
+SUITE_EXTERN(io_suite);
+SUITE_EXTERN(file_suite);
+SUITE_EXTERN(wal_suite);
+SUITE_EXTERN(lsm_suite);
+SUITE_EXTERN(merge_suite);
+SUITE_EXTERN(intrusive_suite);
+
 SUITE(suite) {
     SET_SETUP(setup, NULL);
     SET_TEARDOWN(teardown, NULL);
@@ -793,11 +1627,50 @@ SUITE(suite) {
     RUN_TEST(free_clear);
     RUN_TEST(pop_first);
     RUN_TEST(pop_last);
+    RUN_TEST(add_sorted);
+#if SKIPLIST_STATS
+    RUN_TEST(stats);
+#endif
+#if SKIPLIST_LATENCY
+    RUN_TEST(latency);
+#endif
+#if SKIPLIST_SWMR
+    RUN_TEST(swmr_concurrent_get);
+#endif
+#if SKIPLIST_SNAPSHOTS
+    RUN_TEST(snapshot);
+    RUN_TEST(snapshot_nested);
+    RUN_TEST(get_at);
+    RUN_TEST(snapshot_deferred_free);
+    RUN_TEST(snapshot_concurrent_iter);
+#endif
+    RUN_TEST(freeze);
+    RUN_TEST(iter_batch);
+    RUN_TEST(upsert);
+    RUN_TEST(emplace);
+    RUN_TEST(write_batch);
+    RUN_TEST(compact);
+    RUN_TEST(rebalance);
+#if SKIPLIST_ADAPTIVE
+    RUN_TEST(adaptive);
+#endif
 }
 
 int main(int argc, char **argv) {
     GREATEST_MAIN_BEGIN();      /* init & parse command-line args */
     srandom(global_seed);
     RUN_SUITE(suite);
+    RUN_SUITE(lf_suite);
+    RUN_SUITE(epoch_suite);
+    RUN_SUITE(sharded_suite);
+    RUN_SUITE(ingest_suite);
+    RUN_SUITE(fc_suite);
+    RUN_SUITE(parallel_suite);
+    RUN_SUITE(io_suite);
+    RUN_SUITE(file_suite);
+    RUN_SUITE(wal_suite);
+    RUN_SUITE(lsm_suite);
+    RUN_SUITE(merge_suite);
+    RUN_SUITE(intrusive_suite);
     GREATEST_MAIN_END();        /* display results */
 }
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_lf.h"
+#include "skiplist_epoch.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+/* Retired memory is not freed while a reader that might see it is
+ * still in its critical section, and is freed soon after it leaves. */
+TEST epoch_defers_free(void) {
+    struct skiplist_epoch *e = skiplist_epoch_new(test_alloc, NULL);
+    ASSERT(e);
+    struct skiplist_epoch_reader *r = skiplist_epoch_register(e);
+    ASSERT(r);
+    long baseline = allocated;
+
+    skiplist_epoch_enter(r);
+    void *p = test_malloc(100);
+    ASSERT(skiplist_epoch_retire(e, p, 100, test_alloc, NULL));
+    for (int i = 0; i < 10; i++) { (void)skiplist_epoch_reclaim(e); }
+    ASSERT(allocated > baseline);   /* still pinned */
+    skiplist_epoch_exit(r);
+
+    size_t freed = 0;
+    for (int i = 0; i < 3; i++) { freed += skiplist_epoch_reclaim(e); }
+    ASSERT_EQ(1, freed);
+    ASSERT_EQ(baseline, allocated);
+
+    skiplist_epoch_unregister(r);
+    ASSERT_EQ(r, skiplist_epoch_register(e));   /* reused */
+    skiplist_epoch_unregister(r);
+    skiplist_epoch_free(e);
+    PASS();
+}
+
+/* A skiplist with an epoch domain attached retires deleted nodes,
+ * so a pinned reader can keep using a node it already found. */
+TEST epoch_skiplist_retires_nodes(void) {
+    struct skiplist_epoch *e = skiplist_epoch_new(test_alloc, NULL);
+    ASSERT(e);
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_set_epoch(sl, e);
+    for (intptr_t i = 0; i < 1000; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+
+    struct skiplist_epoch_reader *r = skiplist_epoch_register(e);
+    ASSERT(r);
+    skiplist_epoch_enter(r);
+    long before = allocated;
+    for (intptr_t i = 0; i < 1000; i += 2) {
+        ASSERT(skiplist_delete(sl, (void *) i, NULL));
+    }
+    ASSERT(allocated > before);     /* retired, not yet freed */
+    skiplist_epoch_exit(r);
+    skiplist_epoch_unregister(r);
+    skiplist_epoch_synchronize(e);
+    ASSERT(allocated < before);
+    ASSERT_EQ(500, skiplist_count(sl));
+
+    skiplist_free(sl, NULL, NULL);
+    skiplist_epoch_free(e);
+    PASS();
+}
+
+#define THREADS 4
+#define PER_THREAD 10000
+
+struct worker {
+    struct skiplist_lf *sl;
+    struct skiplist_epoch *e;
+    intptr_t id;
+    bool ok;
+};
+
+/* Add, then delete, the thread's keys, each in a critical section. */
+static void *lf_worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    struct skiplist_epoch_reader *r = skiplist_epoch_register(w->e);
+    w->ok = r != NULL;
+    if (r == NULL) { return NULL; }
+    for (intptr_t i = 0; i < PER_THREAD; i++) {
+        intptr_t k = i * THREADS + w->id;
+        skiplist_epoch_enter(r);
+        if (!skiplist_lf_add(w->sl, (void *) k, (void *) k)) {
+            w->ok = false;
+        }
+        skiplist_epoch_exit(r);
+    }
+    for (intptr_t i = 0; i < PER_THREAD; i++) {
+        intptr_t k = i * THREADS + w->id;
+        skiplist_epoch_enter(r);
+        if (!skiplist_lf_delete(w->sl, (void *) k, NULL)) { w->ok = false; }
+        skiplist_epoch_exit(r);
+    }
+    skiplist_epoch_unregister(r);
+    return NULL;
+}
+
+TEST epoch_lf_concurrent(void) {
+    struct skiplist_epoch *e = skiplist_epoch_new(test_alloc, NULL);
+    ASSERT(e);
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    skiplist_lf_set_epoch(sl, e);
+
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (intptr_t i = 0; i < THREADS; i++) {
+        workers[i].sl = sl;
+        workers[i].e = e;
+        workers[i].id = i;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                lf_worker, &workers[i]));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+    }
+    ASSERT(skiplist_lf_empty(sl));
+
+    ASSERT_EQ(0, skiplist_lf_free(sl, NULL, NULL));
+    skiplist_epoch_free(e);
+    PASS();
+}
+
+SUITE(epoch_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(epoch_defers_free);
+    RUN_TEST(epoch_skiplist_retires_nodes);
+    RUN_TEST(epoch_lf_concurrent);
+}
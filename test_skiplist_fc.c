@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_fc.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+TEST fc_basics(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    struct skiplist_fc *fc = skiplist_fc_new(sl, test_alloc, NULL);
+    ASSERT(fc);
+    struct skiplist_fc_slot *slot = skiplist_fc_register(fc);
+    ASSERT(slot);
+
+    for (intptr_t i = 0; i < 100; i++) {
+        ASSERT(skiplist_fc_add(slot, (void *) i, (void *) i));
+    }
+    void *k = NULL, *v = NULL;
+    ASSERT(skiplist_fc_get(slot, (void *) 50, &v));
+    ASSERT_EQ((void *) 50, v);
+    ASSERT(skiplist_fc_set(slot, (void *) 50, (void *) 51, &v));
+    ASSERT_EQ((void *) 50, v);
+    ASSERT(skiplist_fc_delete(slot, (void *) 50, &v));
+    ASSERT_EQ((void *) 51, v);
+    ASSERT(!skiplist_fc_get(slot, (void *) 50, NULL));
+    ASSERT(skiplist_fc_pop_first(slot, &k, &v));
+    ASSERT_EQ((void *) 0, k);
+    ASSERT_EQ(98, skiplist_count(sl));
+
+    skiplist_fc_unregister(slot);
+    ASSERT_EQ(slot, skiplist_fc_register(fc));  /* reused */
+    skiplist_fc_unregister(slot);
+    skiplist_fc_free(fc);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#define THREADS 4
+#define PER_THREAD 10000
+
+struct worker {
+    struct skiplist_fc *fc;
+    pthread_barrier_t *barrier;
+    intptr_t id;
+    size_t popped;
+    bool ok;
+};
+
+/* Add the thread's keys, delete half of them, then (once every thread
+ * is done deleting) pop a share. */
+static void *worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    struct skiplist_fc_slot *slot = skiplist_fc_register(w->fc);
+    w->ok = slot != NULL;
+    w->popped = 0;
+    if (slot == NULL) { return NULL; }
+    for (intptr_t i = 0; i < PER_THREAD; i++) {
+        intptr_t k = i * THREADS + w->id;
+        if (!skiplist_fc_add(slot, (void *) k, (void *) k)) { w->ok = false; }
+    }
+    for (intptr_t i = 0; i < PER_THREAD; i += 2) {
+        intptr_t k = i * THREADS + w->id;
+        void *v = NULL;
+        if (!skiplist_fc_delete(slot, (void *) k, &v) || v != (void *) k) {
+            w->ok = false;
+        }
+    }
+    pthread_barrier_wait(w->barrier);
+    for (intptr_t i = 0; i < PER_THREAD / 4; i++) {
+        if (skiplist_fc_pop_first(slot, NULL, NULL)) { w->popped++; }
+    }
+    skiplist_fc_unregister(slot);
+    return NULL;
+}
+
+TEST fc_concurrent(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    struct skiplist_fc *fc = skiplist_fc_new(sl, test_alloc, NULL);
+    ASSERT(fc);
+
+    pthread_barrier_t barrier;
+    ASSERT_EQ(0, pthread_barrier_init(&barrier, NULL, THREADS));
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (intptr_t i = 0; i < THREADS; i++) {
+        workers[i] = (struct worker){ fc, &barrier, i, 0, false };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                worker, &workers[i]));
+    }
+    size_t popped = 0;
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+        popped += workers[i].popped;
+    }
+    pthread_barrier_destroy(&barrier);
+    ASSERT_EQ(THREADS * PER_THREAD / 4, popped);
+    ASSERT_EQ(THREADS * PER_THREAD / 2 - popped, skiplist_count(sl));
+
+    skiplist_fc_free(fc);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+SUITE(fc_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(fc_basics);
+    RUN_TEST(fc_concurrent);
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_file.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+static int temp_file(char *path) {
+    strcpy(path, "/tmp/skiplist_file.XXXXXX");
+    return mkstemp(path);
+}
+
+static off_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+#define COUNT 5000
+
+struct order_env {
+    int seen;
+    char last[16];
+};
+
+static enum skiplist_iter_res
+check_order(const void *key, size_t key_len,
+        const void *value, size_t value_len, void *udata) {
+    struct order_env *env = (struct order_env *) udata;
+    char k[16];
+    if (key_len >= sizeof(k) || value_len != key_len
+        || memcmp(key, value, key_len) != 0) {
+        return SKIPLIST_ITER_HALT;
+    }
+    memcpy(k, key, key_len);
+    k[key_len] = '\0';
+    if (env->seen > 0 && strcmp(env->last, k) >= 0) {
+        return SKIPLIST_ITER_HALT;
+    }
+    strcpy(env->last, k);
+    env->seen++;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+TEST reopen(void) {
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    close(fd);
+
+    struct skiplist_file *f = skiplist_file_open(path, NULL,
+        test_alloc, NULL);
+    ASSERT(f);
+    for (int i = 0; i < COUNT; i++) {
+        char k[16];
+        int len = snprintf(k, sizeof(k), "k%05d", (i * 7919) % COUNT);
+        ASSERT(skiplist_file_set(f, k, (size_t)len, k, (size_t)len));
+    }
+    ASSERT_EQ(COUNT, skiplist_file_count(f));
+    ASSERT(skiplist_file_sync(f));
+    skiplist_file_close(f);
+
+    f = skiplist_file_open(path, NULL, test_alloc, NULL);
+    ASSERT(f);
+    ASSERT_EQ(COUNT, skiplist_file_count(f));
+    for (int i = 0; i < COUNT; i++) {
+        char k[16];
+        int len = snprintf(k, sizeof(k), "k%05d", i);
+        const void *v = NULL;
+        size_t vlen = 0;
+        ASSERT(skiplist_file_get(f, k, (size_t)len, &v, &vlen));
+        ASSERT_EQ((size_t)len, vlen);
+        ASSERT_EQ(0, memcmp(k, v, vlen));
+    }
+    ASSERT_FALSE(skiplist_file_get(f, "k", 1, NULL, NULL));
+
+    struct order_env env = { 0, "" };
+    skiplist_file_iter(f, check_order, &env);
+    ASSERT_EQ(COUNT, env.seen);
+    skiplist_file_close(f);
+    unlink(path);
+    PASS();
+}
+
+TEST set_and_delete(void) {
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    close(fd);
+
+    struct skiplist_file *f = skiplist_file_open(path, NULL,
+        test_alloc, NULL);
+    ASSERT(f);
+    ASSERT(skiplist_file_set(f, "a", 1, "1", 1));
+    ASSERT(skiplist_file_set(f, "b", 1, "2", 1));
+    ASSERT(skiplist_file_set(f, "a", 1, "one", 3));
+    static char big[1000];
+    memset(big, 'x', sizeof(big));
+    ASSERT(skiplist_file_set(f, "b", 1, big, sizeof(big)));
+    ASSERT_EQ(2, skiplist_file_count(f));
+
+    const void *v = NULL;
+    size_t vlen = 0;
+    ASSERT(skiplist_file_get(f, "a", 1, &v, &vlen));
+    ASSERT_EQ(3, vlen);
+    ASSERT_EQ(0, memcmp("one", v, 3));
+    ASSERT(skiplist_file_get(f, "b", 1, &v, &vlen));
+    ASSERT_EQ(sizeof(big), vlen);
+
+    ASSERT(skiplist_file_delete(f, "a", 1));
+    ASSERT_FALSE(skiplist_file_delete(f, "a", 1));
+    ASSERT_FALSE(skiplist_file_get(f, "a", 1, NULL, NULL));
+    ASSERT_EQ(1, skiplist_file_count(f));
+
+    /* Freed blocks are reused, so churn doesn't grow the file. */
+    off_t size = file_size(path);
+    for (int i = 0; i < 10 * COUNT; i++) {
+        ASSERT(skiplist_file_set(f, "c", 1, big, 100));
+        ASSERT(skiplist_file_delete(f, "c", 1));
+    }
+    ASSERT_EQ(size, file_size(path));
+    skiplist_file_close(f);
+    unlink(path);
+    PASS();
+}
+
+/* A set that can't grow the file fails, and leaves the old value. */
+TEST set_failed_grow(void) {
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    close(fd);
+
+    struct skiplist_file *f = skiplist_file_open(path, NULL,
+        test_alloc, NULL);
+    ASSERT(f);
+    ASSERT(skiplist_file_set(f, "a", 1, "1", 1));
+
+    /* Cap the file at its current size, so growing it fails. */
+    struct rlimit saved;
+    ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &saved));
+    struct rlimit cap = saved;
+    cap.rlim_cur = (rlim_t)file_size(path);
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &cap));
+    static char big[256 * 1024];
+    bool res = skiplist_file_set(f, "a", 1, big, sizeof(big));
+    ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &saved));
+    signal(SIGXFSZ, handler);
+    ASSERT_FALSE(res);
+
+    const void *v = NULL;
+    size_t vlen = 0;
+    ASSERT(skiplist_file_get(f, "a", 1, &v, &vlen));
+    ASSERT_EQ(1, vlen);
+    ASSERT_EQ(0, memcmp("1", v, 1));
+    ASSERT_EQ(1, skiplist_file_count(f));
+    skiplist_file_close(f);
+    unlink(path);
+    PASS();
+}
+
+/* A file extended past its recorded size, as by a grow whose remap
+ * failed, still opens. */
+TEST open_extended_file(void) {
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    close(fd);
+
+    struct skiplist_file *f = skiplist_file_open(path, NULL,
+        test_alloc, NULL);
+    ASSERT(f);
+    ASSERT(skiplist_file_set(f, "a", 1, "1", 1));
+    skiplist_file_close(f);
+    ASSERT_EQ(0, truncate(path, 2 * file_size(path)));
+
+    f = skiplist_file_open(path, NULL, test_alloc, NULL);
+    ASSERT(f);
+    ASSERT(skiplist_file_get(f, "a", 1, NULL, NULL));
+    ASSERT(skiplist_file_set(f, "b", 1, "2", 1));
+    ASSERT_EQ(2, skiplist_file_count(f));
+    skiplist_file_close(f);
+    unlink(path);
+    PASS();
+}
+
+TEST open_bad_file(void) {
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    static char junk[4096];
+    memset(junk, 'j', sizeof(junk));
+    ASSERT_EQ((ssize_t)sizeof(junk), write(fd, junk, sizeof(junk)));
+    close(fd);
+    ASSERT_EQ(NULL, skiplist_file_open(path, NULL, test_alloc, NULL));
+    unlink(path);
+    ASSERT_EQ(NULL, skiplist_file_open("/nonexistent/skiplist",
+            NULL, test_alloc, NULL));
+    PASS();
+}
+
+SUITE(file_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(reopen);
+    RUN_TEST(set_and_delete);
+    RUN_TEST(set_failed_grow);
+    RUN_TEST(open_extended_file);
+    RUN_TEST(open_bad_file);
+}
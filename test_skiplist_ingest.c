@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_ingest.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+/* Queued pairs only appear once drained, in order, with equal keys
+ * kept in arrival order. */
+TEST ingest_drain(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    struct skiplist_ingest *in = skiplist_ingest_new(sl, test_alloc, NULL);
+    ASSERT(in);
+
+    for (intptr_t i = 999; i >= 0; i--) {
+        ASSERT(skiplist_ingest_add(in, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_ingest_add(in, (void *) 500, (void *) 5001));
+    ASSERT(skiplist_ingest_add(in, (void *) 500, (void *) 5002));
+    ASSERT(skiplist_empty(sl));
+
+    ASSERT_EQ(1002, skiplist_ingest_drain(in));
+    ASSERT_EQ(0, skiplist_ingest_drain(in));
+    ASSERT_EQ(1002, skiplist_count(sl));
+    for (intptr_t i = 0; i < 1000; i++) {
+        void *k = NULL, *v = NULL;
+        ASSERT(skiplist_pop_first(sl, &k, &v));
+        ASSERT_EQ(i, (intptr_t) k);
+        ASSERT_EQ(i, (intptr_t) v);
+        if (i == 500) {
+            ASSERT(skiplist_pop_first(sl, &k, &v));
+            ASSERT_EQ(5001, (intptr_t) v);
+            ASSERT(skiplist_pop_first(sl, &k, &v));
+            ASSERT_EQ(5002, (intptr_t) v);
+        }
+    }
+
+    ASSERT(skiplist_ingest_add(in, (void *) 1, (void *) 1));
+    ASSERT_EQ(1, skiplist_ingest_free(in, NULL, NULL));
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+#define PRODUCERS 4
+#define PER_PRODUCER 20000
+
+struct producer {
+    struct skiplist_ingest *in;
+    intptr_t id;
+    bool ok;
+};
+
+static void *produce(void *arg) {
+    struct producer *p = (struct producer *) arg;
+    p->ok = true;
+    for (intptr_t i = 0; i < PER_PRODUCER; i++) {
+        intptr_t k = i * PRODUCERS + p->id;
+        if (!skiplist_ingest_add(p->in, (void *) k, (void *) k)) {
+            p->ok = false;
+        }
+    }
+    return NULL;
+}
+
+/* The owner drains while producers are still adding. */
+TEST ingest_concurrent(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    struct skiplist_ingest *in = skiplist_ingest_new(sl, test_alloc, NULL);
+    ASSERT(in);
+
+    pthread_t threads[PRODUCERS];
+    struct producer producers[PRODUCERS];
+    for (intptr_t i = 0; i < PRODUCERS; i++) {
+        producers[i] = (struct producer){ in, i, false };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                produce, &producers[i]));
+    }
+    size_t drained = 0;
+    while (drained < PRODUCERS * PER_PRODUCER / 2) {
+        drained += skiplist_ingest_drain(in);
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(producers[i].ok);
+    }
+    drained += skiplist_ingest_drain(in);
+    ASSERT_EQ(PRODUCERS * PER_PRODUCER, drained);
+    ASSERT_EQ(PRODUCERS * PER_PRODUCER, skiplist_count(sl));
+    for (intptr_t i = 0; i < PRODUCERS * PER_PRODUCER; i += 997) {
+        ASSERT(skiplist_member(sl, (void *) i));
+    }
+
+    ASSERT_EQ(0, skiplist_ingest_free(in, NULL, NULL));
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+SUITE(ingest_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(ingest_drain);
+    RUN_TEST(ingest_concurrent);
+}
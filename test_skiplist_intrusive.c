@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_intrusive.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+/* The link is placed right after the struct, rather than as its last
+ * member, since the tests are built with -pedantic. */
+struct item {
+    long key;
+    long value;
+};
+
+#define LINK_OFFSET (sizeof(struct item))
+
+static int keycmp(void *a, void *b) {
+    long ka = *(long *) a;
+    long kb = *(long *) b;
+    return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+static size_t item_size(uint8_t h) {
+    return LINK_OFFSET + sizeof(struct skiplist_link)
+        + SKIPLIST_TOWER_SIZE(h);
+}
+
+static struct item *item_new(long key, long value) {
+    uint8_t h = SKIPLIST_GEN_HEIGHT();
+    struct item *it = test_alloc(NULL, 0, item_size(h), NULL);
+    if (it == NULL) { return NULL; }
+    it->key = key;
+    it->value = value;
+    skiplist_link_init((struct skiplist_link *)((char *)it + LINK_OFFSET), h);
+    return it;
+}
+
+static void item_free(struct item *it) {
+    struct skiplist_link *l = (struct skiplist_link *)
+        ((char *)it + LINK_OFFSET);
+    test_alloc(it, item_size(l->h), 0, NULL);
+}
+
+static struct skiplist_intrusive *new_list(void) {
+    return skiplist_intrusive_new(LINK_OFFSET, offsetof(struct item, key),
+        keycmp, test_alloc, NULL);
+}
+
+TEST intrusive_insert_find(void) {
+    struct skiplist_intrusive *sl = new_list();
+    ASSERT(sl);
+    const long limit = 1000;
+    for (long i = 0; i < limit; i++) {
+        struct item *it = item_new((i * 7919) % limit, i);
+        ASSERT(it);
+        skiplist_intrusive_insert(sl, it);
+    }
+    ASSERT_EQ(limit, skiplist_intrusive_count(sl));
+
+    for (long k = 0; k < limit; k++) {
+        struct item *it = skiplist_intrusive_find(sl, &k);
+        ASSERT(it);
+        ASSERT_EQ(k, it->key);
+        ASSERT_EQ(k, (it->value * 7919) % limit);
+    }
+    long k = limit;
+    ASSERT_EQ(NULL, skiplist_intrusive_find(sl, &k));
+    k = -1;
+    struct item *it = skiplist_intrusive_find_ge(sl, &k);
+    ASSERT(it);
+    ASSERT_EQ(0, it->key);
+
+    /* Iterate in order, then pop everything. */
+    long expected = 0;
+    for (it = skiplist_intrusive_first(sl); it != NULL;
+         it = skiplist_intrusive_next(sl, it)) {
+        ASSERT_EQ(expected, it->key);
+        expected++;
+    }
+    ASSERT_EQ(limit, expected);
+    expected = 0;
+    while ((it = skiplist_intrusive_pop_first(sl)) != NULL) {
+        ASSERT_EQ(expected, it->key);
+        item_free(it);
+        expected++;
+    }
+    ASSERT_EQ(limit, expected);
+    ASSERT_EQ(0, skiplist_intrusive_count(sl));
+    skiplist_intrusive_free(sl);
+    PASS();
+}
+
+TEST intrusive_remove(void) {
+    struct skiplist_intrusive *sl = new_list();
+    ASSERT(sl);
+    /* 10 objects for each of 10 keys. */
+    struct item *items[100];
+    for (long i = 0; i < 100; i++) {
+        items[i] = item_new(i % 10, i);
+        ASSERT(items[i]);
+        skiplist_intrusive_insert(sl, items[i]);
+    }
+
+    /* Remove specific objects among equal keys. */
+    for (long i = 0; i < 100; i += 3) {
+        ASSERT(skiplist_intrusive_remove(sl, items[i]));
+        ASSERT_FALSE(skiplist_intrusive_remove(sl, items[i]));
+    }
+    ASSERT_EQ(66, skiplist_intrusive_count(sl));
+
+    /* What's left is still sorted, and each removed object is gone. */
+    long prev = -1;
+    size_t seen = 0;
+    for (struct item *it = skiplist_intrusive_first(sl); it != NULL;
+         it = skiplist_intrusive_next(sl, it)) {
+        ASSERT(it->key >= prev);
+        ASSERT(it->value % 3 != 0);
+        prev = it->key;
+        seen++;
+    }
+    ASSERT_EQ(66, seen);
+
+    for (long k = 0; k < 10; k++) {
+        struct item *it = NULL;
+        while ((it = skiplist_intrusive_remove_key(sl, &k)) != NULL) {
+            ASSERT_EQ(k, it->key);
+        }
+    }
+    ASSERT_EQ(0, skiplist_intrusive_count(sl));
+    ASSERT_EQ(NULL, skiplist_intrusive_first(sl));
+    for (long i = 0; i < 100; i++) { item_free(items[i]); }
+    skiplist_intrusive_free(sl);
+    PASS();
+}
+
+SUITE(intrusive_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(intrusive_insert_find);
+    RUN_TEST(intrusive_remove);
+}
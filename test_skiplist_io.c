@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_io.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+static int sl_revcmp(void *a, void *b) {
+    return sl_longcmp(b, a);
+}
+
+static int sl_revstrcmp(void *a, void *b) {
+    return sl_strcmp(b, a);
+}
+
+static int temp_file(char *path) {
+    strcpy(path, "/tmp/skiplist_io.XXXXXX");
+    return mkstemp(path);
+}
+
+#define COUNT 10000
+
+TEST save_and_load_ints(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        intptr_t k = (i * 7919) % COUNT;
+        ASSERT(skiplist_add(sl, (void *) k, (void *) (k * 3)));
+    }
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    ASSERT(skiplist_save(sl, fd, NULL, NULL));
+    close(fd);
+    skiplist_free(sl, NULL, NULL);
+
+    struct skiplist_mmap *m = skiplist_load_mmap(path, sl_longcmp,
+        test_alloc, NULL, NULL, NULL, NULL, NULL);
+    unlink(path);
+    ASSERT(m);
+    sl = skiplist_mmap_list(m);
+    ASSERT_EQ(COUNT, skiplist_count(sl));
+    skiplist_debug(sl, NULL, NULL, NULL);
+    for (intptr_t k = 0; k < COUNT; k++) {
+        void *v = NULL;
+        ASSERT(skiplist_get(sl, (void *) k, &v));
+        ASSERT_EQ((void *) (k * 3), v);
+    }
+    ASSERT(skiplist_add(sl, (void *) -1, NULL));
+    ASSERT(skiplist_delete(sl, (void *) 0, NULL));
+    skiplist_mmap_close(m, NULL, NULL);
+    PASS();
+}
+
+TEST save_and_load_strings(void) {
+    static char *words[] = { "onion", "apple", "banana", "kiwi", "" };
+    struct skiplist *sl = skiplist_new(sl_strcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        ASSERT(skiplist_add(sl, words[i], (void *) i));
+    }
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    ASSERT(skiplist_save(sl, fd, &str_codec, NULL));
+    close(fd);
+    skiplist_free(sl, NULL, NULL);
+
+    struct skiplist_mmap *m = skiplist_load_mmap(path, sl_strcmp,
+        test_alloc, NULL, &str_codec, NULL, NULL, NULL);
+    unlink(path);
+    ASSERT(m);
+    sl = skiplist_mmap_list(m);
+    ASSERT_EQ(5, skiplist_count(sl));
+    void *k = NULL, *v = NULL;
+    ASSERT(skiplist_first(sl, &k, &v));
+    ASSERT_STR_EQ("", (char *) k);
+    ASSERT_EQ((void *) 4, v);
+    ASSERT(skiplist_last(sl, &k, &v));
+    ASSERT_STR_EQ("onion", (char *) k);
+    ASSERT(skiplist_get(sl, "kiwi", &v));
+    ASSERT_EQ((void *) 3, v);
+    skiplist_mmap_close(m, NULL, NULL);
+    PASS();
+}
+
+/* Truncated, mismatched, or unsorted files are refused. */
+TEST load_bad_file(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < 100; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, (void *) i));
+    }
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    ASSERT(skiplist_save(sl, fd, NULL, NULL));
+    skiplist_free(sl, NULL, NULL);
+
+    /* Loaded with a comparison that disagrees about the order. */
+    struct skiplist_mmap *m = skiplist_load_mmap(path, sl_revcmp,
+        test_alloc, NULL, NULL, NULL, NULL, NULL);
+    ASSERT_EQ(NULL, m);
+
+    ASSERT_EQ(0, ftruncate(fd, 1000));
+    close(fd);
+    m = skiplist_load_mmap(path, sl_longcmp, test_alloc, NULL,
+        NULL, NULL, NULL, NULL);
+    ASSERT_EQ(NULL, m);
+    unlink(path);
+    ASSERT_EQ(NULL, skiplist_load_mmap(path, sl_longcmp,
+            test_alloc, NULL, NULL, NULL, NULL, NULL));
+    PASS();
+}
+
+/* A codec whose decode copies the string out of the mapping. */
+static void *copy_decode(const void *buf, size_t len, void *udata) {
+    (void)udata;
+    char *s = test_malloc(len);
+    if (s) { memcpy(s, buf, len); }
+    return s;
+}
+
+static void free_copy(void *key, void *value, void *udata) {
+    (void)value;
+    (*(int *) udata)++;
+    test_free(key, strlen((char *) key) + 1);
+}
+
+/* When loading fails partway, the keys already decoded are handed to
+ * the free callback rather than leaked. */
+TEST load_failure_frees_decoded(void) {
+    static char *words[] = { "apple", "banana", "kiwi", "onion" };
+    struct skiplist *sl = skiplist_new(sl_strcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        ASSERT(skiplist_add(sl, words[i], (void *) i));
+    }
+    char path[32];
+    int fd = temp_file(path);
+    ASSERT(fd != -1);
+    ASSERT(skiplist_save(sl, fd, &str_codec, NULL));
+    close(fd);
+    skiplist_free(sl, NULL, NULL);
+    struct skiplist_codec copy_codec = str_codec;
+    copy_codec.decode = copy_decode;
+
+    /* Fails on the second pair, which is out of order for sl_revstrcmp. */
+    int freed = 0;
+    ASSERT_EQ(NULL, skiplist_load_mmap(path, sl_revstrcmp,
+            test_alloc, NULL, &copy_codec, NULL, free_copy, &freed));
+    ASSERT_EQ(2, freed);
+
+    freed = 0;
+    struct skiplist_mmap *m = skiplist_load_mmap(path, sl_strcmp,
+        test_alloc, NULL, &copy_codec, NULL, free_copy, &freed);
+    unlink(path);
+    ASSERT(m);
+    ASSERT_EQ(0, freed);
+    skiplist_mmap_close(m, free_copy, &freed);
+    ASSERT_EQ(4, freed);
+    PASS();
+}
+
+SUITE(io_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(save_and_load_ints);
+    RUN_TEST(save_and_load_strings);
+    RUN_TEST(load_bad_file);
+    RUN_TEST(load_failure_frees_decoded);
+}
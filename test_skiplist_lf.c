@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist_lf.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+#define THREADS 4
+#define PER_THREAD 20000
+
+struct worker {
+    struct skiplist_lf *sl;
+    intptr_t id;
+    size_t popped;
+    char *seen;
+    bool spray;             /* use pop_spray rather than pop_first */
+    bool deleter;           /* delete rather than set */
+    bool ok;
+};
+
+static enum skiplist_iter_res
+check_sorted_cb(void *k, void *v, void *udata) {
+    intptr_t *prev = (intptr_t *) udata;
+    if ((intptr_t) k <= *prev || k != v) {
+        *prev = INTPTR_MAX;
+        return SKIPLIST_ITER_HALT;
+    }
+    *prev = (intptr_t) k;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+/* Single-threaded sanity check of the whole interface. */
+TEST lf_basics(void) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    ASSERT(skiplist_lf_empty(sl));
+    for (intptr_t i = 0; i < 1000; i++) {
+        ASSERT(skiplist_lf_add(sl, (void *) i, (void *) i));
+    }
+    ASSERT(!skiplist_lf_add(sl, (void *) 10, (void *) 10));
+    ASSERT_EQ(1000, skiplist_lf_count(sl));
+
+    void *v = NULL;
+    ASSERT(skiplist_lf_get(sl, (void *) 500, &v));
+    ASSERT_EQ(500, (intptr_t) v);
+    ASSERT(skiplist_lf_set(sl, (void *) 500, (void *) 501, &v));
+    ASSERT_EQ(500, (intptr_t) v);
+    ASSERT(skiplist_lf_set(sl, (void *) 500, (void *) 500, NULL));
+    ASSERT(skiplist_lf_set(sl, (void *) 2000, (void *) 2000, &v));
+    ASSERT_EQ(NULL, v);
+    ASSERT(skiplist_lf_delete(sl, (void *) 2000, &v));
+    ASSERT_EQ(2000, (intptr_t) v);
+    ASSERT(!skiplist_lf_member(sl, (void *) 2000));
+    ASSERT(!skiplist_lf_delete(sl, (void *) 2000, NULL));
+
+    void *k = NULL;
+    ASSERT(skiplist_lf_first(sl, &k, &v));
+    ASSERT_EQ(0, (intptr_t) k);
+    ASSERT(skiplist_lf_last(sl, &k, &v));
+    ASSERT_EQ(999, (intptr_t) k);
+    ASSERT(skiplist_lf_pop_first(sl, &k, &v));
+    ASSERT_EQ(0, (intptr_t) k);
+    ASSERT(skiplist_lf_pop_last(sl, &k, &v));
+    ASSERT_EQ(999, (intptr_t) k);
+    ASSERT_EQ(998, skiplist_lf_count(sl));
+
+    intptr_t prev = 0;
+    skiplist_lf_iter(sl, check_sorted_cb, &prev);
+    ASSERT_EQ(998, prev);
+
+    ASSERT_EQ(998, skiplist_lf_free(sl, NULL, NULL));
+    PASS();
+}
+
+/* Each thread adds its own keys, then deletes every other one,
+ * checking that its remaining keys stay present. */
+static void *add_delete_worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    w->ok = true;
+    for (intptr_t i = 0; i < PER_THREAD; i++) {
+        intptr_t k = i * THREADS + w->id;
+        if (!skiplist_lf_add(w->sl, (void *) k, (void *) k)) {
+            w->ok = false;
+        }
+    }
+    for (intptr_t i = 0; i < PER_THREAD; i += 2) {
+        intptr_t k = i * THREADS + w->id;
+        void *v = NULL;
+        if (!skiplist_lf_delete(w->sl, (void *) k, &v) || v != (void *) k) {
+            w->ok = false;
+        }
+        if (skiplist_lf_member(w->sl, (void *) k)) { w->ok = false; }
+        if (!skiplist_lf_member(w->sl, (void *) (k + THREADS))) {
+            w->ok = false;
+        }
+    }
+    return NULL;
+}
+
+TEST lf_concurrent_add_delete(void) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (intptr_t i = 0; i < THREADS; i++) {
+        workers[i].sl = sl;
+        workers[i].id = i;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                add_delete_worker, &workers[i]));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+    }
+
+    ASSERT_EQ(THREADS * PER_THREAD / 2, skiplist_lf_count(sl));
+    intptr_t prev = -1;
+    skiplist_lf_iter(sl, check_sorted_cb, &prev);
+    ASSERT_EQ(THREADS * PER_THREAD - 1, prev);
+    ASSERT_EQ(THREADS * PER_THREAD / 2, skiplist_lf_free(sl, NULL, NULL));
+    PASS();
+}
+
+/* Setters and deleters race on a single key. Every value stored is
+ * accounted for exactly once: replaced by a later set, returned by a
+ * delete, or still there at the end. */
+#define SET_ROUNDS 20000
+
+static void *set_delete_worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    w->ok = true;
+    for (intptr_t i = 0; i < SET_ROUNDS; i++) {
+        void *v = NULL;
+        if (w->deleter) {
+            if (!skiplist_lf_delete(w->sl, (void *) 1, &v)) { continue; }
+        } else {
+            intptr_t value = 1 + w->id * SET_ROUNDS + i;
+            if (!skiplist_lf_set(w->sl, (void *) 1, (void *) value, &v)) {
+                w->ok = false;
+            }
+            if (v == NULL) { continue; }
+        }
+        if (__atomic_fetch_add(&w->seen[(intptr_t) v], 1,
+                __ATOMIC_RELAXED)) {
+            w->ok = false;
+        }
+    }
+    return NULL;
+}
+
+TEST lf_concurrent_set_delete(void) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t setters = THREADS / 2;
+    const intptr_t limit = 1 + setters * SET_ROUNDS;
+    char *seen = calloc(limit, 1);
+    ASSERT(seen);
+
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (intptr_t i = 0; i < THREADS; i++) {
+        workers[i].sl = sl;
+        workers[i].id = i / 2;
+        workers[i].seen = seen;
+        workers[i].deleter = i % 2;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                set_delete_worker, &workers[i]));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+    }
+
+    void *v = NULL;
+    if (skiplist_lf_get(sl, (void *) 1, &v)) {
+        ASSERT_EQ(1, skiplist_lf_count(sl));
+        seen[(intptr_t) v]++;
+    } else {
+        ASSERT_EQ(0, skiplist_lf_count(sl));
+    }
+    for (intptr_t i = 1; i < limit; i++) { ASSERT_EQ(1, seen[i]); }
+    free(seen);
+    skiplist_lf_free(sl, NULL, NULL);
+    PASS();
+}
+
+/* Several threads pop concurrently; every key is popped exactly once. */
+static void *pop_worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    void *k = NULL;
+    w->ok = true;
+    w->popped = 0;
+    while (w->spray
+        ? skiplist_lf_pop_spray(w->sl, THREADS, &k, NULL)
+        : skiplist_lf_pop_first(w->sl, &k, NULL)) {
+        if (__atomic_exchange_n(&w->seen[(intptr_t) k], 1,
+                __ATOMIC_RELAXED)) {
+            w->ok = false;
+        }
+        w->popped++;
+    }
+    return NULL;
+}
+
+TEST lf_concurrent_pop(bool spray) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = THREADS * PER_THREAD;
+    char *seen = calloc(limit, 1);
+    ASSERT(seen);
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_lf_add(sl, (void *) i, (void *) i));
+    }
+
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        workers[i].sl = sl;
+        workers[i].seen = seen;
+        workers[i].spray = spray;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                pop_worker, &workers[i]));
+    }
+    size_t total = 0;
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+        total += workers[i].popped;
+    }
+    ASSERT_EQ(limit, total);
+    ASSERT(skiplist_lf_empty(sl));
+    free(seen);
+    ASSERT_EQ(0, skiplist_lf_free(sl, NULL, NULL));
+    PASS();
+}
+
+/* A spraying pop takes something near the front, not the minimum. */
+TEST lf_pop_spray(void) {
+    struct skiplist_lf *sl = skiplist_lf_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    const intptr_t limit = 10000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_lf_add(sl, (void *) i, (void *) i));
+    }
+
+    void *k = NULL;
+    ASSERT(skiplist_lf_pop_spray(sl, 1, &k, NULL));
+    ASSERT_EQ(0, (intptr_t) k);     /* one thread: exact */
+    for (int i = 0; i < 100; i++) {
+        ASSERT(skiplist_lf_pop_spray(sl, 16, &k, NULL));
+        ASSERT((intptr_t) k < limit / 10);
+    }
+    ASSERT_EQ(limit - 101, skiplist_lf_count(sl));
+
+    ASSERT_EQ(limit - 101, skiplist_lf_free(sl, NULL, NULL));
+    PASS();
+}
+
+SUITE(lf_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(lf_basics);
+    RUN_TEST(lf_concurrent_add_delete);
+    RUN_TEST(lf_concurrent_set_delete);
+    RUN_TEST1(lf_concurrent_pop, false);
+    RUN_TEST(lf_pop_spray);
+    RUN_TEST1(lf_concurrent_pop, true);
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_lsm.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+static void temp_dir(char *path) {
+    strcpy(path, "/tmp/skiplist_lsm.XXXXXX");
+    char *res = mkdtemp(path);
+    assert(res);
+}
+
+static void remove_dir(const char *path) {
+    DIR *d = opendir(path);
+    assert(d);
+    struct dirent *de;
+    char buf[512];
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') { continue; }
+        snprintf(buf, sizeof(buf), "%s/%s", path, de->d_name);
+        unlink(buf);
+    }
+    closedir(d);
+    rmdir(path);
+}
+
+#define COUNT 3000
+
+static char keys[COUNT][16];
+
+static bool check_keys(struct skiplist_lsm *lsm) {
+    for (intptr_t i = 0; i < COUNT; i++) {
+        void *v = NULL;
+        bool found = skiplist_lsm_get(lsm, keys[i], &v);
+        if (i % 7 == 0) {
+            if (found) { return false; }
+        } else if (!found || v != (void *) (i % 5 == 0 ? -i : i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST set_get_across_runs(void) {
+    char dir[32];
+    temp_dir(dir);
+    for (int i = 0; i < COUNT; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "key%05d", i);
+    }
+    struct skiplist_lsm_config config = { &str_codec, NULL, 500, NULL, NULL };
+    struct skiplist_lsm *lsm = skiplist_lsm_open(dir, sl_strcmp,
+        &config, test_alloc, NULL);
+    ASSERT(lsm);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        ASSERT(skiplist_lsm_set(lsm, keys[i], (void *) i));
+    }
+    /* Shadow some of the older values, mostly already flushed. */
+    for (intptr_t i = 0; i < COUNT; i += 5) {
+        ASSERT(skiplist_lsm_set(lsm, keys[i], (void *) -i));
+    }
+    for (intptr_t i = 0; i < COUNT; i += 7) {
+        ASSERT(skiplist_lsm_delete(lsm, keys[i]));
+    }
+    ASSERT_FALSE(skiplist_lsm_get(lsm, "nope", NULL));
+    ASSERT(check_keys(lsm));
+    ASSERT(skiplist_lsm_wait(lsm));
+    ASSERT(skiplist_lsm_run_count(lsm) >= 6);
+    ASSERT(check_keys(lsm));
+    ASSERT(skiplist_lsm_close(lsm));
+
+    /* Everything is in the runs now. */
+    lsm = skiplist_lsm_open(dir, sl_strcmp, &config, test_alloc, NULL);
+    ASSERT(lsm);
+    size_t runs = skiplist_lsm_run_count(lsm);
+    ASSERT(runs >= 7);
+    ASSERT(check_keys(lsm));
+    ASSERT(skiplist_lsm_close(lsm));
+    remove_dir(dir);
+    PASS();
+}
+
+static void count_freed(void *key, void *value, void *udata) {
+    (void)key;
+    (void)value;
+    (*(int *) udata)++;
+}
+
+TEST free_dropped_pairs(void) {
+    char dir[32];
+    temp_dir(dir);
+    int freed = 0;
+    struct skiplist_lsm_config config = { NULL, NULL, 0,
+        count_freed, &freed };
+    struct skiplist_lsm *lsm = skiplist_lsm_open(dir, sl_longcmp,
+        &config, test_alloc, NULL);
+    ASSERT(lsm);
+    for (intptr_t i = 0; i < 100; i++) {
+        ASSERT(skiplist_lsm_set(lsm, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_lsm_set(lsm, (void *) 1, (void *) 11));
+    ASSERT_EQ(1, freed);
+    ASSERT(skiplist_lsm_rotate(lsm));
+    ASSERT(skiplist_lsm_wait(lsm));
+    ASSERT_EQ(101, freed);
+    ASSERT_EQ(1, skiplist_lsm_run_count(lsm));
+    void *v = NULL;
+    ASSERT(skiplist_lsm_get(lsm, (void *) 1, &v));
+    ASSERT_EQ((void *) 11, v);
+    ASSERT(skiplist_lsm_delete(lsm, (void *) 2));
+    ASSERT_FALSE(skiplist_lsm_get(lsm, (void *) 2, NULL));
+    ASSERT(skiplist_lsm_close(lsm));
+    ASSERT_EQ(102, freed);
+    remove_dir(dir);
+    PASS();
+}
+
+/* Readers search the runs while they are being written, with keys
+ * too long for the stack buffer lookups use. */
+#define LONG_COUNT 400
+#define LONG_KEY 300
+#define READERS 2
+
+static char long_keys[LONG_COUNT][LONG_KEY];
+
+struct reader {
+    struct skiplist_lsm *lsm;
+    intptr_t *written;
+    bool ok;
+};
+
+static void *read_worker(void *arg) {
+    struct reader *r = (struct reader *) arg;
+    r->ok = true;
+    intptr_t n;
+    do {
+        n = __atomic_load_n(r->written, __ATOMIC_ACQUIRE);
+        for (intptr_t i = 0; i < n; i++) {
+            void *v = NULL;
+            if (!skiplist_lsm_get(r->lsm, long_keys[i], &v)
+                || v != (void *) i) {
+                r->ok = false;
+            }
+        }
+    } while (n < LONG_COUNT);
+    return NULL;
+}
+
+TEST concurrent_get_long_keys(void) {
+    char dir[32];
+    temp_dir(dir);
+    for (int i = 0; i < LONG_COUNT; i++) {
+        memset(long_keys[i], 'k', LONG_KEY - 1);
+        snprintf(long_keys[i] + LONG_KEY - 8, 8, "%05d", i);
+    }
+    struct skiplist_lsm_config config = { &str_codec, NULL, 50, NULL, NULL };
+    struct skiplist_lsm *lsm = skiplist_lsm_open(dir, sl_strcmp,
+        &config, test_alloc, NULL);
+    ASSERT(lsm);
+
+    intptr_t written = 0;
+    pthread_t threads[READERS];
+    struct reader readers[READERS];
+    for (int i = 0; i < READERS; i++) {
+        readers[i].lsm = lsm;
+        readers[i].written = &written;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                read_worker, &readers[i]));
+    }
+    bool set_ok = true;         /* keep going, so the readers finish */
+    for (intptr_t i = 0; i < LONG_COUNT; i++) {
+        set_ok &= skiplist_lsm_set(lsm, long_keys[i], (void *) i);
+        __atomic_store_n(&written, i + 1, __ATOMIC_RELEASE);
+    }
+    for (int i = 0; i < READERS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(readers[i].ok);
+    }
+    ASSERT(set_ok);
+    ASSERT(skiplist_lsm_wait(lsm));
+    ASSERT(skiplist_lsm_run_count(lsm) >= 7);
+    ASSERT(skiplist_lsm_close(lsm));
+    remove_dir(dir);
+    PASS();
+}
+
+SUITE(lsm_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(set_get_across_runs);
+    RUN_TEST(free_dropped_pairs);
+    RUN_TEST(concurrent_get_long_keys);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_merge.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+#define LISTS 3
+#define COUNT 1000
+
+/* List i holds the multiples of i + 2 below COUNT, with value i. */
+static void fill(struct skiplist **lists) {
+    for (intptr_t i = 0; i < LISTS; i++) {
+        lists[i] = skiplist_new(sl_longcmp, test_alloc, NULL);
+        assert(lists[i]);
+        for (intptr_t k = 0; k < COUNT; k += i + 2) {
+            bool ok = skiplist_add(lists[i], (void *) k, (void *) i);
+            assert(ok);
+        }
+    }
+}
+
+static void free_lists(struct skiplist **lists) {
+    for (int i = 0; i < LISTS; i++) { skiplist_free(lists[i], NULL, NULL); }
+}
+
+TEST merge_all(void) {
+    struct skiplist *lists[LISTS];
+    fill(lists);
+    struct skiplist_merge *m = skiplist_merge_new(LISTS, lists,
+        SKIPLIST_MERGE_ALL, test_alloc, NULL);
+    ASSERT(m);
+    size_t total = 0;
+    for (int i = 0; i < LISTS; i++) { total += skiplist_count(lists[i]); }
+
+    size_t seen = 0;
+    intptr_t prev_k = -1, prev_v = -1;
+    void *k = NULL, *v = NULL;
+    while (skiplist_merge_next(m, &k, &v)) {
+        intptr_t ki = (intptr_t) k, vi = (intptr_t) v;
+        ASSERT(ki > prev_k || (ki == prev_k && vi > prev_v));
+        ASSERT_EQ(0, ki % (vi + 2));
+        prev_k = ki;
+        prev_v = vi;
+        seen++;
+    }
+    ASSERT_EQ(total, seen);
+    ASSERT_FALSE(skiplist_merge_next(m, NULL, NULL));
+
+    skiplist_merge_rewind(m);
+    ASSERT(skiplist_merge_next(m, &k, &v));
+    ASSERT_EQ((void *) 0, k);
+    ASSERT_EQ((void *) 0, v);
+    skiplist_merge_free(m);
+    free_lists(lists);
+    PASS();
+}
+
+TEST merge_newest(void) {
+    struct skiplist *lists[LISTS];
+    fill(lists);
+    struct skiplist_merge *m = skiplist_merge_new(LISTS, lists,
+        SKIPLIST_MERGE_NEWEST, test_alloc, NULL);
+    ASSERT(m);
+    size_t seen = 0;
+    intptr_t prev_k = -1;
+    void *k = NULL, *v = NULL;
+    while (skiplist_merge_next(m, &k, &v)) {
+        intptr_t ki = (intptr_t) k;
+        ASSERT(ki > prev_k);
+        /* The first list with the key wins. */
+        intptr_t newest = ki % 2 == 0 ? 0 : ki % 3 == 0 ? 1 : 2;
+        ASSERT_EQ((void *) newest, v);
+        prev_k = ki;
+        seen++;
+    }
+    size_t expected = 0;
+    for (intptr_t i = 0; i < COUNT; i++) {
+        if (i % 2 == 0 || i % 3 == 0 || i % 4 == 0) { expected++; }
+    }
+    ASSERT_EQ(expected, seen);
+    skiplist_merge_free(m);
+    free_lists(lists);
+    PASS();
+}
+
+TEST merge_seek(void) {
+    struct skiplist *lists[LISTS];
+    fill(lists);
+    struct skiplist_merge *m = skiplist_merge_new(LISTS, lists,
+        SKIPLIST_MERGE_NEWEST, test_alloc, NULL);
+    ASSERT(m);
+    void *k = NULL, *v = NULL;
+    skiplist_merge_seek(m, (void *) 97);
+    ASSERT(skiplist_merge_next(m, &k, &v));
+    ASSERT_EQ((void *) 98, k);
+    ASSERT(skiplist_merge_next(m, &k, &v));
+    ASSERT_EQ((void *) 99, k);
+    ASSERT_EQ((void *) 1, v);
+    skiplist_merge_seek(m, (void *) COUNT);
+    ASSERT_FALSE(skiplist_merge_next(m, &k, &v));
+    skiplist_merge_free(m);
+    free_lists(lists);
+    PASS();
+}
+
+TEST merge_empty(void) {
+    struct skiplist_merge *m = skiplist_merge_new(0, NULL,
+        SKIPLIST_MERGE_ALL, test_alloc, NULL);
+    ASSERT(m);
+    ASSERT_FALSE(skiplist_merge_next(m, NULL, NULL));
+    skiplist_merge_free(m);
+
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    m = skiplist_merge_new(1, &sl, SKIPLIST_MERGE_ALL, test_alloc, NULL);
+    ASSERT(m);
+    ASSERT_FALSE(skiplist_merge_next(m, NULL, NULL));
+    skiplist_merge_free(m);
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+SUITE(merge_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(merge_all);
+    RUN_TEST(merge_newest);
+    RUN_TEST(merge_seek);
+    RUN_TEST(merge_empty);
+}
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_parallel.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+#define COUNT 100000
+
+/* Keys are scrambled, and repeat, so equal keys must keep input order. */
+static intptr_t key_for(intptr_t i) { return (i * 7919) % (COUNT / 4); }
+
+struct order_env {
+    intptr_t prev_key;
+    intptr_t prev_value;
+    size_t seen;
+    bool ok;
+};
+
+static enum skiplist_iter_res check_order_cb(void *key,
+        void *value, void *udata) {
+    struct order_env *env = (struct order_env *) udata;
+    intptr_t k = (intptr_t) key;
+    intptr_t v = (intptr_t) value;
+    if (key_for(v) != k) { env->ok = false; }
+    if (env->seen > 0) {
+        if (k < env->prev_key) { env->ok = false; }
+        if (k == env->prev_key && v < env->prev_value) { env->ok = false; }
+    }
+    env->prev_key = k;
+    env->prev_value = v;
+    env->seen++;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+static void **make_array(size_t count) {
+    return test_malloc(count * sizeof(void *));
+}
+
+TEST build_parallel_order(unsigned nthreads) {
+    void **keys = make_array(COUNT);
+    void **values = make_array(COUNT);
+    ASSERT(keys && values);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        keys[i] = (void *) key_for(i);
+        values[i] = (void *) i;
+    }
+
+    struct skiplist *sl = skiplist_build_parallel(sl_longcmp,
+        test_alloc, NULL, COUNT, keys, values, nthreads);
+    ASSERT(sl);
+    ASSERT_EQ(COUNT, skiplist_count(sl));
+    skiplist_debug(sl, NULL, NULL, NULL);
+
+    struct order_env env = { 0, 0, 0, true };
+    skiplist_iter(sl, check_order_cb, &env);
+    ASSERT(env.ok);
+    ASSERT_EQ(COUNT, env.seen);
+
+    /* It's an ordinary skiplist afterward. */
+    void *v = NULL;
+    ASSERT(skiplist_get(sl, (void *) key_for(12345), &v));
+    ASSERT(skiplist_add(sl, (void *) -1, (void *) -1));
+    ASSERT(skiplist_delete(sl, (void *) -1, NULL));
+    for (intptr_t k = 0; k < COUNT / 4; k++) {
+        ASSERT(skiplist_delete(sl, (void *) k, NULL));
+    }
+    ASSERT_EQ(COUNT - COUNT / 4, skiplist_count(sl));
+    skiplist_debug(sl, NULL, NULL, NULL);
+
+    skiplist_free(sl, NULL, NULL);
+    test_free(keys, COUNT * sizeof(void *));
+    test_free(values, COUNT * sizeof(void *));
+    PASS();
+}
+
+TEST build_parallel_small(void) {
+    struct skiplist *sl = skiplist_build_parallel(sl_longcmp,
+        test_alloc, NULL, 0, NULL, NULL, 8);
+    ASSERT(sl);
+    ASSERT(skiplist_empty(sl));
+    skiplist_free(sl, NULL, NULL);
+
+    void *keys[] = { (void *) 3, (void *) 1, (void *) 2 };
+    sl = skiplist_build_parallel(sl_longcmp, test_alloc, NULL,
+        3, keys, NULL, 8);
+    ASSERT(sl);
+    void *k = NULL, *v = (void *) 1;
+    ASSERT(skiplist_first(sl, &k, &v));
+    ASSERT_EQ((void *) 1, k);
+    ASSERT_EQ(NULL, v);
+    ASSERT(skiplist_last(sl, &k, NULL));
+    ASSERT_EQ((void *) 3, k);
+    skiplist_free(sl, NULL, NULL);
+
+    ASSERT_EQ(NULL, skiplist_build_parallel(NULL, test_alloc, NULL,
+            3, keys, NULL, 8));
+    PASS();
+}
+
+static long allocs_left;
+
+static void *failing_alloc(void *p, size_t osize, size_t nsize, void *udata) {
+    if (p == NULL && __atomic_sub_fetch(&allocs_left, 1,
+            __ATOMIC_RELAXED) < 0) {
+        return NULL;
+    }
+    return test_alloc(p, osize, nsize, udata);
+}
+
+/* Running out of memory partway through frees everything. */
+TEST build_parallel_alloc_failure(void) {
+    void **keys = make_array(COUNT);
+    ASSERT(keys);
+    for (intptr_t i = 0; i < COUNT; i++) { keys[i] = (void *) i; }
+    allocs_left = COUNT / 2;
+    ASSERT_EQ(NULL, skiplist_build_parallel(sl_longcmp,
+            failing_alloc, NULL, COUNT, keys, NULL, 4));
+    test_free(keys, COUNT * sizeof(void *));
+    PASS();
+}
+
+/* Per-partition result for parallel_iter_sum. */
+struct sum_env {
+    long sum;
+    size_t count;
+    long min;
+    long max;
+    bool ordered;
+};
+
+static enum skiplist_iter_res sum_cb(void *key, void *value, void *udata) {
+    struct sum_env *env = (struct sum_env *) udata;
+    long k = (long) key;
+    (void)value;
+    if (env->count > 0 && k < env->max) { env->ordered = false; }
+    if (env->count == 0 || k < env->min) { env->min = k; }
+    if (env->count == 0 || k > env->max) { env->max = k; }
+    env->sum += k;
+    env->count++;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+static void sum_merge(void *into, void *from) {
+    struct sum_env *a = (struct sum_env *) into;
+    struct sum_env *b = (struct sum_env *) from;
+    if (b->count == 0) { return; }
+    if (a->count > 0 && a->max > b->min) { a->ordered = false; }
+    if (a->count == 0) { a->min = b->min; }
+    a->max = b->max;
+    a->sum += b->sum;
+    a->count += b->count;
+    a->ordered = a->ordered && b->ordered;
+}
+
+/* Partitions cover every pair once, in key order, and merge in order. */
+TEST parallel_iter_sum(unsigned count) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    long expected = 0;
+    for (intptr_t i = 0; i < (intptr_t)count; i++) {
+        ASSERT(skiplist_add(sl, (void *) key_for(i), NULL));
+        expected += key_for(i);
+    }
+
+    for (unsigned nthreads = 1; nthreads <= 8; nthreads++) {
+        struct sum_env envs[8];
+        void *udata[8];
+        for (unsigned i = 0; i < nthreads; i++) {
+            envs[i] = (struct sum_env) { 0, 0, 0, 0, true };
+            udata[i] = &envs[i];
+        }
+        ASSERT(skiplist_parallel_iter(sl, nthreads, sum_cb,
+                udata, sum_merge));
+        ASSERT_EQ(count, envs[0].count);
+        ASSERT_EQ(expected, envs[0].sum);
+        ASSERT(envs[0].ordered);
+    }
+    ASSERT_FALSE(skiplist_parallel_iter(sl, 0, sum_cb, NULL, NULL));
+
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+static enum skiplist_iter_res halt_cb(void *key, void *value, void *udata) {
+    size_t *seen = (size_t *) udata;
+    (void)key;
+    (void)value;
+    return ++*seen < 10 ? SKIPLIST_ITER_CONTINUE : SKIPLIST_ITER_HALT;
+}
+
+/* Halting stops only the partition that asked. */
+TEST parallel_iter_halt(void) {
+    struct skiplist *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    ASSERT(sl);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        ASSERT(skiplist_add(sl, (void *) i, NULL));
+    }
+    size_t seen[4] = { 0, 0, 0, 0 };
+    void *udata[4] = { &seen[0], &seen[1], &seen[2], &seen[3] };
+    ASSERT(skiplist_parallel_iter(sl, 4, halt_cb, udata, NULL));
+    for (int i = 0; i < 4; i++) { ASSERT_EQ(10, seen[i]); }
+    skiplist_free(sl, NULL, NULL);
+    PASS();
+}
+
+SUITE(parallel_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST1(build_parallel_order, 1);
+    RUN_TEST1(build_parallel_order, 3);
+    RUN_TEST1(build_parallel_order, 8);
+    RUN_TEST(build_parallel_small);
+    RUN_TEST(build_parallel_alloc_failure);
+    RUN_TEST1(parallel_iter_sum, 0);
+    RUN_TEST1(parallel_iter_sum, 5);
+    RUN_TEST1(parallel_iter_sum, COUNT);
+    RUN_TEST(parallel_iter_halt);
+}
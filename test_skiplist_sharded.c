@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist_config.h"
+#include "skiplist_sharded.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+/* Checks that keys arrive in ascending order, and counts them. */
+struct order {
+    intptr_t prev;
+    size_t count;
+    bool ok;
+};
+
+static enum skiplist_iter_res check_order_cb(void *key, void *value,
+        void *udata) {
+    struct order *o = (struct order *) udata;
+    intptr_t k = (intptr_t) key;
+    if (k <= o->prev || value != key) { o->ok = false; }
+    o->prev = k;
+    o->count++;
+    return SKIPLIST_ITER_CONTINUE;
+}
+
+TEST sharded_basics(void) {
+    void *splits[] = { (void *) 100, (void *) 200, (void *) 300 };
+    struct skiplist_sharded *ss = skiplist_sharded_new(sl_longcmp,
+        test_alloc, NULL, 4, splits);
+    ASSERT(ss);
+
+    for (intptr_t i = 0; i < 400; i++) {
+        intptr_t k = (i * 37) % 400;    /* scattered across shards */
+        ASSERT(skiplist_sharded_add(ss, (void *) k, (void *) k));
+    }
+    ASSERT_EQ(400, skiplist_sharded_count(ss));
+
+    void *v = NULL;
+    ASSERT(skiplist_sharded_get(ss, (void *) 299, &v));
+    ASSERT_EQ((void *) 299, v);
+    ASSERT(skiplist_sharded_delete(ss, (void *) 300, &v));
+    ASSERT_EQ((void *) 300, v);
+    ASSERT(!skiplist_sharded_member(ss, (void *) 300));
+    ASSERT(skiplist_sharded_set(ss, (void *) 300, (void *) 300, &v));
+    ASSERT_EQ(NULL, v);
+
+    struct order o = { -1, 0, true };
+    skiplist_sharded_iter(ss, check_order_cb, &o);
+    ASSERT(o.ok);
+    ASSERT_EQ(400, o.count);
+
+    o = (struct order){ 149, 0, true };
+    skiplist_sharded_iter_from(ss, (void *) 150, check_order_cb, &o);
+    ASSERT(o.ok);
+    ASSERT_EQ(250, o.count);
+
+    ASSERT_EQ(400, skiplist_sharded_free(ss, NULL, NULL));
+    PASS();
+}
+
+/* With no split points given, everything starts in the first shard,
+ * and rebalancing spreads it out without losing order. */
+TEST sharded_rebalance(void) {
+    struct skiplist_sharded *ss = skiplist_sharded_new(sl_longcmp,
+        test_alloc, NULL, 4, NULL);
+    ASSERT(ss);
+    const intptr_t limit = 20000;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_sharded_add(ss, (void *) i, (void *) i));
+    }
+    /* Adding already triggered rebalancing, otherwise 3/4 of the
+     * pairs would have to move out of the first shard. */
+    ASSERT(skiplist_sharded_rebalance(ss) < (size_t) limit * 3 / 4);
+    ASSERT_EQ(0, skiplist_sharded_rebalance(ss));
+
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_sharded_member(ss, (void *) i));
+    }
+    struct order o = { -1, 0, true };
+    skiplist_sharded_iter(ss, check_order_cb, &o);
+    ASSERT(o.ok);
+    ASSERT_EQ(limit, o.count);
+
+    ASSERT_EQ(limit, skiplist_sharded_free(ss, NULL, NULL));
+    PASS();
+}
+
+/* One shard holding far more than the others (more than twice the
+ * skew that triggers a rebalance, but too few pairs to trigger one on
+ * its own) is evened out by a single call: the pairs have to move
+ * several shards over, and nothing is left to move afterward. */
+TEST sharded_rebalance_skewed(void) {
+    void *splits[] = { (void *) 100, (void *) 200, (void *) 300 };
+    struct skiplist_sharded *ss = skiplist_sharded_new(sl_longcmp,
+        test_alloc, NULL, 4, splits);
+    ASSERT(ss);
+    const intptr_t hot = 2 * SKIPLIST_SHARD_SKEW * 100 + 100;
+    ASSERT(hot <= SKIPLIST_SHARD_CHECK_INTERVAL);
+    const intptr_t limit = 300 + hot;
+    for (intptr_t i = 0; i < limit; i++) {
+        ASSERT(skiplist_sharded_add(ss, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_sharded_rebalance(ss) > 0);
+    ASSERT_EQ(0, skiplist_sharded_rebalance(ss));
+
+    struct order o = { -1, 0, true };
+    skiplist_sharded_iter(ss, check_order_cb, &o);
+    ASSERT(o.ok);
+    ASSERT_EQ((size_t) limit, o.count);
+    ASSERT_EQ((size_t) limit, skiplist_sharded_free(ss, NULL, NULL));
+    PASS();
+}
+
+#define THREADS 4
+#define PER_THREAD 10000
+
+struct worker {
+    struct skiplist_sharded *ss;
+    intptr_t id;
+    bool ok;
+};
+
+static void *add_worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    w->ok = true;
+    for (intptr_t i = 0; i < PER_THREAD; i++) {
+        intptr_t k = i * THREADS + w->id;
+        if (!skiplist_sharded_add(w->ss, (void *) k, (void *) k)) {
+            w->ok = false;
+        }
+    }
+    return NULL;
+}
+
+static void *iter_worker(void *arg) {
+    struct worker *w = (struct worker *) arg;
+    w->ok = true;
+    for (int i = 0; i < 20; i++) {
+        struct order o = { -1, 0, true };
+        skiplist_sharded_iter(w->ss, check_order_cb, &o);
+        if (!o.ok) { w->ok = false; }
+    }
+    return NULL;
+}
+
+/* Concurrent adds, with automatic rebalancing and iteration going on. */
+TEST sharded_concurrent_add(void) {
+    struct skiplist_sharded *ss = skiplist_sharded_new(sl_longcmp,
+        test_alloc, NULL, 8, NULL);
+    ASSERT(ss);
+
+    pthread_t threads[THREADS + 1];
+    struct worker workers[THREADS + 1];
+    for (intptr_t i = 0; i <= THREADS; i++) {
+        workers[i] = (struct worker){ ss, i, false };
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                i < THREADS ? add_worker : iter_worker, &workers[i]));
+    }
+    for (int i = 0; i <= THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+    }
+
+    struct order o = { -1, 0, true };
+    skiplist_sharded_iter(ss, check_order_cb, &o);
+    ASSERT(o.ok);
+    ASSERT_EQ(THREADS * PER_THREAD, o.count);
+    ASSERT_EQ(THREADS * PER_THREAD, skiplist_sharded_count(ss));
+
+    ASSERT_EQ(THREADS * PER_THREAD, skiplist_sharded_free(ss, NULL, NULL));
+    PASS();
+}
+
+SUITE(sharded_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(sharded_basics);
+    RUN_TEST(sharded_rebalance);
+    RUN_TEST(sharded_rebalance_skewed);
+    RUN_TEST(sharded_concurrent_add);
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2011-16 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "test_config.h"
+#include "skiplist.h"
+#include "skiplist_wal.h"
+#include "greatest.h"
+#include "test_alloc.h"
+#include "test_helpers.h"
+
+static void temp_path(char *path) {
+    strcpy(path, "/tmp/skiplist_wal.XXXXXX");
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+}
+
+static off_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+#define COUNT 1000
+
+/* Open PATH into a new skiplist. */
+static struct skiplist_wal *reopen(const char *path, struct skiplist **sl,
+        const struct skiplist_wal_config *config) {
+    *sl = skiplist_new(sl_longcmp, test_alloc, NULL);
+    assert(*sl);
+    return skiplist_wal_open(path, *sl, config, test_alloc, NULL);
+}
+
+TEST log_and_replay(void) {
+    char path[32];
+    temp_path(path);
+    struct skiplist *sl = NULL;
+    struct skiplist_wal *w = reopen(path, &sl, NULL);
+    ASSERT(w);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        ASSERT(skiplist_wal_add(w, (void *) i, (void *) i));
+    }
+    for (intptr_t i = 0; i < COUNT; i += 3) {
+        void *old = NULL;
+        ASSERT(skiplist_wal_set(w, (void *) i, (void *) -i, &old));
+        ASSERT_EQ((void *) i, old);
+    }
+    for (intptr_t i = 0; i < COUNT; i += 5) {
+        ASSERT(skiplist_wal_delete(w, (void *) i, NULL));
+    }
+    ASSERT_FALSE(skiplist_wal_delete(w, (void *) -1, NULL));
+    ASSERT(skiplist_wal_add(w, (void *) -1, (void *) 7));
+    size_t count = skiplist_count(sl);
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+
+    w = reopen(path, &sl, NULL);
+    ASSERT(w);
+    ASSERT_EQ(count, skiplist_count(sl));
+    for (intptr_t i = 0; i < COUNT; i++) {
+        void *v = NULL;
+        if (i % 5 == 0) {
+            ASSERT_FALSE(skiplist_wal_get(w, (void *) i, NULL));
+        } else {
+            ASSERT(skiplist_wal_get(w, (void *) i, &v));
+            ASSERT_EQ((void *) (i % 3 == 0 ? -i : i), v);
+        }
+    }
+    void *v = NULL;
+    ASSERT(skiplist_wal_get(w, (void *) -1, &v));
+    ASSERT_EQ((void *) 7, v);
+    skiplist_debug(sl, NULL, NULL, NULL);
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+    unlink(path);
+    PASS();
+}
+
+/* A record cut short by a crash is dropped, and logging resumes
+ * after the last complete one. */
+TEST torn_tail(void) {
+    char path[32];
+    temp_path(path);
+    struct skiplist *sl = NULL;
+    struct skiplist_wal *w = reopen(path, &sl, NULL);
+    ASSERT(w);
+    for (intptr_t i = 0; i < 10; i++) {
+        ASSERT(skiplist_wal_add(w, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+    ASSERT_EQ(0, truncate(path, file_size(path) - 3));
+
+    w = reopen(path, &sl, NULL);
+    ASSERT(w);
+    ASSERT_EQ(9, skiplist_count(sl));
+    ASSERT_FALSE(skiplist_wal_get(w, (void *) 9, NULL));
+    ASSERT(skiplist_wal_add(w, (void *) 100, NULL));
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+
+    w = reopen(path, &sl, NULL);
+    ASSERT(w);
+    ASSERT_EQ(10, skiplist_count(sl));
+    ASSERT(skiplist_wal_get(w, (void *) 100, NULL));
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+    unlink(path);
+    PASS();
+}
+
+TEST open_bad_file(void) {
+    char path[32];
+    temp_path(path);
+    int fd = open(path, O_WRONLY);
+    ASSERT(fd != -1);
+    ASSERT_EQ(4, write(fd, "junk", 4));
+    close(fd);
+    struct skiplist *sl = NULL;
+    ASSERT_EQ(NULL, reopen(path, &sl, NULL));
+    skiplist_free(sl, NULL, NULL);
+    unlink(path);
+    PASS();
+}
+
+static long allocs_left;
+
+static void *failing_alloc(void *p, size_t osize, size_t nsize, void *udata) {
+    if (p == NULL && --allocs_left < 0) { return NULL; }
+    return test_alloc(p, osize, nsize, udata);
+}
+
+/* Running out of memory partway through replay leaves the skiplist
+ * empty, since its pairs can point into the log. */
+TEST replay_alloc_failure(void) {
+    char path[32];
+    temp_path(path);
+    struct skiplist *sl = NULL;
+    struct skiplist_wal *w = reopen(path, &sl, NULL);
+    ASSERT(w);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        ASSERT(skiplist_wal_add(w, (void *) i, (void *) i));
+    }
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+
+    allocs_left = COUNT / 2;
+    sl = skiplist_new(sl_longcmp, failing_alloc, NULL);
+    ASSERT(sl);
+    ASSERT_EQ(NULL, skiplist_wal_open(path, sl, NULL, test_alloc, NULL));
+    ASSERT_EQ(0, skiplist_count(sl));
+    skiplist_free(sl, NULL, NULL);
+    unlink(path);
+    PASS();
+}
+
+#define THREADS 4
+#define PER_THREAD 500
+
+struct worker {
+    struct skiplist_wal *w;
+    intptr_t id;
+    bool ok;
+};
+
+static void *add_keys(void *arg) {
+    struct worker *wk = (struct worker *) arg;
+    wk->ok = true;
+    for (intptr_t i = 0; i < PER_THREAD; i++) {
+        intptr_t k = i * THREADS + wk->id;
+        if (!skiplist_wal_add(wk->w, (void *) k, (void *) k)) {
+            wk->ok = false;
+        }
+    }
+    return NULL;
+}
+
+/* Concurrent callers share syncs, and every acknowledged change is
+ * there on replay. */
+TEST group_commit(void) {
+    char path[32];
+    temp_path(path);
+    struct skiplist_wal_config config = { NULL, NULL, 4096, 500 };
+    struct skiplist *sl = NULL;
+    struct skiplist_wal *w = reopen(path, &sl, &config);
+    ASSERT(w);
+
+    pthread_t threads[THREADS];
+    struct worker workers[THREADS];
+    for (intptr_t i = 0; i < THREADS; i++) {
+        workers[i].w = w;
+        workers[i].id = i;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                add_keys, &workers[i]));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(0, pthread_join(threads[i], NULL));
+        ASSERT(workers[i].ok);
+    }
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+
+    w = reopen(path, &sl, &config);
+    ASSERT(w);
+    ASSERT_EQ(THREADS * PER_THREAD, skiplist_count(sl));
+    for (intptr_t k = 0; k < THREADS * PER_THREAD; k++) {
+        void *v = NULL;
+        ASSERT(skiplist_wal_get(w, (void *) k, &v));
+        ASSERT_EQ((void *) k, v);
+    }
+    ASSERT(skiplist_wal_close(w));
+    skiplist_free(sl, NULL, NULL);
+    unlink(path);
+    PASS();
+}
+
+SUITE(wal_suite) {
+    SET_SETUP(test_setup, NULL);
+    SET_TEARDOWN(test_teardown, NULL);
+
+    RUN_TEST(log_and_replay);
+    RUN_TEST(torn_tail);
+    RUN_TEST(open_bad_file);
+    RUN_TEST(replay_alloc_failure);
+    RUN_TEST(group_commit);
+}